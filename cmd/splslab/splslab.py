@@ -16,6 +16,7 @@ class Stat:
     SLAB = 128
     OFFSLAB = 256
     NOEMERGENCY = 512
+    AUTO = 4096
     DEADLOCKED = 16384
     GROWING = 32768
     REAPING = 65536
@@ -29,19 +30,22 @@ class Stat:
         SLAB : "SLAB",
         OFFSLAB : "OFSL",
         NOEMERGENCY : "NEMG",
+        AUTO : "AUTO",
         DEADLOCKED : "DDLK",
         GROWING : "GROW",
         REAPING : "REAP",
         DESTROY : "DSTR"
         }
 
-    def __init__(self, name, flags, size, alloc, slabsize, objsize):
+    def __init__(self, name, flags, size, alloc, slabsize, objsize,
+                 merged=False):
         self._name = name
         self._flags = self.f2str(flags)
         self._size = size
         self._alloc = alloc
         self._slabsize = slabsize
         self._objsize = objsize
+        self._merged = merged
 
     def f2str(self, flags):
         fstring = ''
@@ -70,6 +74,11 @@ class CumulativeStat:
         else:
             key = s._size
         self._stats[key].append(s)
+
+        # Merged caches are already counted by their backing cache
+        if s._merged:
+            return
+
         self._size = self._size + s._size
         self._alloc = self._alloc + s._alloc
         if self._size:
@@ -89,12 +98,13 @@ class CumulativeStat:
         del k[0:2]
 
         for s in k:
-            if not s:
+            if not s or s.startswith("total magazine"):
                 continue
             m = self._regexp.match(s)
             if m:
                 self.add(Stat(m.group(1), int(m.group(2),16), int(m.group(3)),
-                            int(m.group(4)), int(m.group(5)), int(m.group(6))))
+                            int(m.group(4)), int(m.group(5)), int(m.group(6)),
+                            s.split()[-1] == "merge"))
             else:
                 sys.stderr.write("Error: unexpected input format\n" % s)
                 exit(-1)
@@ -44,6 +44,9 @@ AC_DEFUN([SPL_AC_CONFIG_KERNEL], [
 	SPL_AC_USLEEP_RANGE
 	SPL_AC_KMEM_CACHE_ALLOCFLAGS
 	SPL_AC_WAIT_ON_BIT
+	SPL_AC_TRACEPOINTS
+	SPL_AC_CPUHP_SETUP_STATE
+	SPL_AC_CPUS_READ_LOCK
 ])
 
 AC_DEFUN([SPL_AC_MODULE_SYMVERS], [
@@ -1447,3 +1450,73 @@ AC_DEFUN([SPL_AC_WAIT_ON_BIT], [
 		AC_MSG_RESULT(no)
 	])
 ])
+
+dnl #
+dnl # 2.6.33 API change,
+dnl # DECLARE_EVENT_CLASS() was added to linux/tracepoint.h.  When the
+dnl # kernel was built with CONFIG_TRACEPOINTS the DTRACE_PROBE* macros
+dnl # are mapped to real static tracepoints, otherwise they are compiled
+dnl # out entirely.
+dnl #
+AC_DEFUN([SPL_AC_TRACEPOINTS], [
+	AC_MSG_CHECKING([whether tracepoints are available])
+	SPL_LINUX_TRY_COMPILE([
+		#include <linux/tracepoint.h>
+	],[
+		#if !defined(CONFIG_TRACEPOINTS)
+		#error CONFIG_TRACEPOINTS not defined
+		#endif
+		#if !defined(DECLARE_EVENT_CLASS)
+		#error DECLARE_EVENT_CLASS not defined
+		#endif
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_DECLARE_EVENT_CLASS, 1,
+		          [tracepoints are available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
+
+dnl #
+dnl # 4.10 API change,
+dnl # The CPU hotplug notifiers were replaced by the cpuhp state machine.
+dnl #
+AC_DEFUN([SPL_AC_CPUHP_SETUP_STATE], [
+	AC_MSG_CHECKING([whether cpuhp_setup_state_nocalls() exists])
+	SPL_LINUX_TRY_COMPILE([
+		#include <linux/cpuhotplug.h>
+	],[
+		int (*startup)(unsigned int) = NULL;
+		int (*teardown)(unsigned int) = NULL;
+		int state __attribute__ ((unused));
+
+		state = cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN,
+		    "spl:test", startup, teardown);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_CPUHP_SETUP_STATE, 1,
+		          [cpuhp_setup_state_nocalls() exists])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
+
+dnl #
+dnl # 4.13 API change,
+dnl # get_online_cpus() and put_online_cpus() were renamed.
+dnl #
+AC_DEFUN([SPL_AC_CPUS_READ_LOCK], [
+	AC_MSG_CHECKING([whether cpus_read_lock() exists])
+	SPL_LINUX_TRY_COMPILE([
+		#include <linux/cpu.h>
+	],[
+		cpus_read_lock();
+		cpus_read_unlock();
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_CPUS_READ_LOCK, 1, [cpus_read_lock() exists])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,40 @@
+/*****************************************************************************\
+ *  Copyright (C) 2007-2015 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+\*****************************************************************************/
+
+#ifndef _SPL_CPU_COMPAT_H
+#define _SPL_CPU_COMPAT_H
+
+#include <linux/cpu.h>
+
+/* get_online_cpus() and put_online_cpus() renamed in 4.13 */
+#ifndef HAVE_CPUS_READ_LOCK
+#define	cpus_read_lock()	get_online_cpus()
+#define	cpus_read_unlock()	put_online_cpus()
+#endif /* HAVE_CPUS_READ_LOCK */
+
+#ifdef HAVE_CPUHP_SETUP_STATE
+#include <linux/cpuhotplug.h>
+#endif /* HAVE_CPUHP_SETUP_STATE */
+
+#endif /* _SPL_CPU_COMPAT_H */
@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <rpc/types.h>
+#include <asm/byteorder.h>
 
 /*
  * XDR enums and types.
@@ -33,6 +34,14 @@ enum xdr_op {
 	XDR_DECODE
 };
 
+/*
+ * Or'ed in to the op passed to xdrmem_create() to create a native stream.
+ * Native streams store values in host byte order, aligned to their natural
+ * size relative to the start of the buffer, without XDR padding.  They
+ * are only suitable for data decoded on the host which encoded it.
+ */
+#define XDR_NATIVE	0x100
+
 struct xdr_ops;
 
 typedef struct {
@@ -41,6 +50,10 @@ typedef struct {
 	caddr_t         x_addr;     /* Current buffer addr */
 	caddr_t         x_addr_end; /* End of the buffer */
 	enum xdr_op     x_op;       /* Stream direction */
+	caddr_t         x_addr_start; /* Start of the buffer */
+	void            *x_last;    /* Last value coded by a native stream */
+	uint_t          x_last_size; /* Size of the last native value */
+	bool_t          x_inline;   /* XDR memory stream, coded inline */
 } XDR;
 
 typedef bool_t (*xdrproc_t)(XDR *xdrs, void *ptr);
@@ -80,6 +93,53 @@ void xdrmem_create(XDR *xdrs, const caddr_t addr, const uint_t size,
 #define xdr_control(xdrs, req, info) (xdrs)->x_ops->xdr_control((xdrs),        \
                                          (req), (info))
 
+/*
+ * Integer coding for XDR memory streams.  These are the bulk of the work
+ * when packing nvlists so they are done inline, avoiding an indirect call
+ * per field.  The semantics match xdrmem_enc_uint32()/xdrmem_dec_uint32()
+ * and the range checks of the out-of-line decoders in spl-xdr.c.
+ */
+static inline bool_t xdrmem_inline_uint32(XDR *xdrs, uint32_t *val,
+    const uint32_t max)
+{
+	uint32_t *addr = (uint32_t *) xdrs->x_addr;
+
+	if (xdrs->x_addr_end - xdrs->x_addr < (ptrdiff_t) sizeof(uint32_t))
+		return FALSE;
+
+	if (xdrs->x_op == XDR_ENCODE) {
+		*addr = cpu_to_be32(*val);
+	} else {
+		*val = be32_to_cpu(*addr);
+		if (*val > max)
+			return FALSE;
+	}
+
+	xdrs->x_addr += sizeof(uint32_t);
+
+	return TRUE;
+}
+
+static inline bool_t xdrmem_inline_uint64(XDR *xdrs, u_longlong_t *ullp)
+{
+	uint32_t *addr = (uint32_t *) xdrs->x_addr;
+
+	if (xdrs->x_addr_end - xdrs->x_addr < (ptrdiff_t) sizeof(u_longlong_t))
+		return FALSE;
+
+	if (xdrs->x_op == XDR_ENCODE) {
+		addr[0] = cpu_to_be32(*ullp >> 32);
+		addr[1] = cpu_to_be32(*ullp & 0xffffffff);
+	} else {
+		*ullp = ((u_longlong_t) be32_to_cpu(addr[0]) << 32) |
+		    be32_to_cpu(addr[1]);
+	}
+
+	xdrs->x_addr += sizeof(u_longlong_t);
+
+	return TRUE;
+}
+
 /*
  * For precaution, the following are defined as static inlines instead of macros
  * to get some amount of type safety.
@@ -89,40 +149,76 @@ void xdrmem_create(XDR *xdrs, const caddr_t addr, const uint_t size,
  */
 static inline bool_t xdr_char(XDR *xdrs, char *cp)
 {
-	return xdrs->x_ops->xdr_char(xdrs, cp);
+	uint32_t val;
+
+	BUILD_BUG_ON(sizeof(char) != 1);
+
+	if (!xdrs->x_inline)
+		return xdrs->x_ops->xdr_char(xdrs, cp);
+
+	val = *((unsigned char *) cp);
+	if (!xdrmem_inline_uint32(xdrs, &val, 0xff))
+		return FALSE;
+
+	*((unsigned char *) cp) = val;
+
+	return TRUE;
 }
 
 static inline bool_t xdr_u_short(XDR *xdrs, unsigned short *usp)
 {
-	return xdrs->x_ops->xdr_u_short(xdrs, usp);
+	uint32_t val;
+
+	BUILD_BUG_ON(sizeof(unsigned short) != 2);
+
+	if (!xdrs->x_inline)
+		return xdrs->x_ops->xdr_u_short(xdrs, usp);
+
+	val = *usp;
+	if (!xdrmem_inline_uint32(xdrs, &val, 0xffff))
+		return FALSE;
+
+	*usp = val;
+
+	return TRUE;
 }
 
 static inline bool_t xdr_short(XDR *xdrs, short *sp)
 {
 	BUILD_BUG_ON(sizeof(short) != 2);
-	return xdrs->x_ops->xdr_u_short(xdrs, (unsigned short *) sp);
+	return xdr_u_short(xdrs, (unsigned short *) sp);
 }
 
 static inline bool_t xdr_u_int(XDR *xdrs, unsigned *up)
 {
-	return xdrs->x_ops->xdr_u_int(xdrs, up);
+	BUILD_BUG_ON(sizeof(unsigned) != 4);
+
+	if (!xdrs->x_inline)
+		return xdrs->x_ops->xdr_u_int(xdrs, up);
+
+	return xdrmem_inline_uint32(xdrs, (uint32_t *) up, 0xffffffff);
 }
 
 static inline bool_t xdr_int(XDR *xdrs, int *ip)
 {
 	BUILD_BUG_ON(sizeof(int) != 4);
-	return xdrs->x_ops->xdr_u_int(xdrs, (unsigned *) ip);
+	return xdr_u_int(xdrs, (unsigned *) ip);
 }
 
 static inline bool_t xdr_u_longlong_t(XDR *xdrs, u_longlong_t *ullp)
 {
-	return xdrs->x_ops->xdr_u_longlong_t(xdrs, ullp);
+	BUILD_BUG_ON(sizeof(u_longlong_t) != 8);
+
+	if (!xdrs->x_inline)
+		return xdrs->x_ops->xdr_u_longlong_t(xdrs, ullp);
+
+	return xdrmem_inline_uint64(xdrs, ullp);
 }
 
 static inline bool_t xdr_longlong_t(XDR *xdrs, longlong_t *llp)
 {
 	BUILD_BUG_ON(sizeof(longlong_t) != 8);
-	return xdrs->x_ops->xdr_u_longlong_t(xdrs, (u_longlong_t *) llp);
+	return xdr_u_longlong_t(xdrs, (u_longlong_t *) llp);
 }
 
 /*
@@ -37,6 +37,9 @@ extern void cmn_err(int, const char *, ...);
 extern void vcmn_err(int, const char *, __va_list);
 extern void vpanic(const char *, __va_list);
 
+int spl_err_init(void);
+void spl_err_fini(void);
+
 #define fm_panic	panic
 
 #endif /* SPL_CMN_ERR_H */
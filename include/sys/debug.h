@@ -52,26 +52,72 @@ int spl_panic(const char *file, const char *func, int line,
     const char *fmt, ...);
 void spl_dumpstack(void);
 
+/*
+ * Every VERIFY() site emits a static descriptor in to the __spl_verify
+ * section which records where the check lives and what it compares.  On
+ * failure only a pointer to that descriptor and the two operand values
+ * are passed to the cold, out-of-line spl_verify_failed().  This keeps
+ * the inline portion of each check down to a compare and a branch which
+ * is almost never taken, regardless of how verbose the failure message is.
+ */
+typedef enum spl_verify_type {
+	SPL_VERIFY_BOOL,
+	SPL_VERIFY_SIGNED,
+	SPL_VERIFY_UNSIGNED,
+	SPL_VERIFY_POINTER,
+} spl_verify_type_t;
+
+typedef struct spl_verify {
+	const char		*sv_file;	/* source file */
+	const char		*sv_func;	/* calling function */
+	const char		*sv_expr;	/* stringified check */
+	const char		*sv_op;		/* comparison operator */
+	int			sv_line;	/* source line */
+	spl_verify_type_t	sv_type;	/* operand type */
+} spl_verify_t;
+
+void spl_verify_failed(const spl_verify_t *sv, unsigned long long left,
+    unsigned long long right) __attribute__((cold, noreturn));
+
+#define	SPL_VERIFY_DESC(name, expr, op, type)				\
+	static const spl_verify_t name					\
+	    __attribute__((section("__spl_verify"))) = {		\
+		.sv_file = __FILE__,					\
+		.sv_func = __FUNCTION__,				\
+		.sv_expr = expr,					\
+		.sv_op = op,						\
+		.sv_line = __LINE__,					\
+		.sv_type = type,					\
+	}
+
 #define	PANIC(fmt, a...)						\
 	spl_panic(__FILE__, __FUNCTION__, __LINE__, fmt, ## a)
 
 #define	VERIFY(cond)							\
-	(void)(unlikely(!(cond)) &&					\
-	    spl_panic(__FILE__, __FUNCTION__, __LINE__,			\
-	    "%s", "VERIFY(" #cond ") failed\n"))
-
-#define	VERIFY3_IMPL(LEFT, OP, RIGHT, TYPE, FMT, CAST)			\
-	(void)((!((TYPE)(LEFT) OP (TYPE)(RIGHT))) &&			\
-	    spl_panic(__FILE__, __FUNCTION__, __LINE__,			\
-	    "VERIFY3(" #LEFT " " #OP " " #RIGHT ") "			\
-	    "failed (" FMT " " #OP " " FMT ")\n",			\
-	    CAST (LEFT), CAST (RIGHT)))
-
-#define	VERIFY3S(x,y,z)	VERIFY3_IMPL(x, y, z, int64_t, "%lld", (long long))
-#define	VERIFY3U(x,y,z)	VERIFY3_IMPL(x, y, z, uint64_t, "%llu",		\
-				    (unsigned long long))
-#define	VERIFY3P(x,y,z)	VERIFY3_IMPL(x, y, z, uintptr_t, "%p", (void *))
-#define	VERIFY0(x)	VERIFY3_IMPL(0, ==, x, int64_t, "%lld",	(long long))
+	(void)(unlikely(!(cond)) && ({					\
+	    SPL_VERIFY_DESC(__spl_verify, "VERIFY(" #cond ")", "",	\
+	        SPL_VERIFY_BOOL);					\
+	    spl_verify_failed(&__spl_verify, 0, 0);			\
+	    0;								\
+	}))
+
+#define	VERIFY3_IMPL(LEFT, OP, RIGHT, TYPE, VTYPE)			\
+	((void)({							\
+	    const TYPE __spl_left = (TYPE)(LEFT);			\
+	    const TYPE __spl_right = (TYPE)(RIGHT);			\
+	    if (unlikely(!(__spl_left OP __spl_right))) {		\
+		SPL_VERIFY_DESC(__spl_verify,				\
+		    "VERIFY3(" #LEFT " " #OP " " #RIGHT ")", #OP, VTYPE); \
+		spl_verify_failed(&__spl_verify,			\
+		    (unsigned long long)__spl_left,			\
+		    (unsigned long long)__spl_right);			\
+	    }								\
+	}))
+
+#define	VERIFY3S(x,y,z)	VERIFY3_IMPL(x, y, z, int64_t, SPL_VERIFY_SIGNED)
+#define	VERIFY3U(x,y,z)	VERIFY3_IMPL(x, y, z, uint64_t, SPL_VERIFY_UNSIGNED)
+#define	VERIFY3P(x,y,z)	VERIFY3_IMPL(x, y, z, uintptr_t, SPL_VERIFY_POINTER)
+#define	VERIFY0(x)	VERIFY3_IMPL(0, ==, x, int64_t, SPL_VERIFY_SIGNED)
 
 #define	CTASSERT_GLOBAL(x)		_CTASSERT(x, __LINE__)
 #define	CTASSERT(x)			{ _CTASSERT(x, __LINE__); }
@@ -124,6 +124,14 @@ extern unsigned long long kmem_alloc_max;
 
 extern unsigned int spl_kmem_alloc_warn;
 extern unsigned int spl_kmem_alloc_max;
+extern unsigned int spl_kmem_zero_pool;
+
+/* Pre-zeroed buffer pool statistics, see spl_kmem_zero_stat() */
+#define	SPL_KMEM_ZERO_HITS	0
+#define	SPL_KMEM_ZERO_MISSES	1
+#define	SPL_KMEM_ZERO_REFILLS	2
+
+extern uint64_t spl_kmem_zero_stat(int stat);
 
 #define	kmem_alloc(sz, fl)	spl_kmem_alloc((sz), (fl), __func__, __LINE__)
 #define	kmem_zalloc(sz, fl)	spl_kmem_zalloc((sz), (fl), __func__, __LINE__)
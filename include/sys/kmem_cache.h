@@ -26,6 +26,7 @@
 #define	_SPL_KMEM_CACHE_H
 
 #include <sys/taskq.h>
+#include <linux/rcupdate.h>
 
 /*
  * Slab allocation interfaces.  The SPL slab differs from the standard
@@ -46,6 +47,9 @@ enum {
 	KMC_BIT_SLAB		= 7,	/* Use Linux slab cache */
 	KMC_BIT_OFFSLAB		= 8,	/* Objects not on slab */
 	KMC_BIT_NOEMERGENCY	= 9,	/* Disable emergency objects */
+	KMC_BIT_MERGE		= 10,	/* Shared backing for merged caches */
+	KMC_BIT_TYPESAFE_BY_RCU	= 11,	/* Defer slab free for RCU readers */
+	KMC_BIT_AUTO		= 12,	/* Backend selected at runtime */
 	KMC_BIT_DEADLOCKED	= 14,	/* Deadlock detected */
 	KMC_BIT_GROWING		= 15,	/* Growing in progress */
 	KMC_BIT_REAPING		= 16,	/* Reaping in progress */
@@ -74,6 +78,9 @@ typedef enum kmem_cbrc {
 #define	KMC_SLAB		(1 << KMC_BIT_SLAB)
 #define	KMC_OFFSLAB		(1 << KMC_BIT_OFFSLAB)
 #define	KMC_NOEMERGENCY		(1 << KMC_BIT_NOEMERGENCY)
+#define	KMC_MERGE		(1 << KMC_BIT_MERGE)
+#define	KMC_TYPESAFE_BY_RCU	(1 << KMC_BIT_TYPESAFE_BY_RCU)
+#define	KMC_AUTO		(1 << KMC_BIT_AUTO)
 #define	KMC_DEADLOCKED		(1 << KMC_BIT_DEADLOCKED)
 #define	KMC_GROWING		(1 << KMC_BIT_GROWING)
 #define	KMC_REAPING		(1 << KMC_BIT_REAPING)
@@ -90,7 +97,29 @@ typedef enum kmem_cbrc {
 
 #define	KMC_RECLAIM_ONCE	0x1	/* Force a single shrinker pass */
 
+/* Reason the current backend was selected, see spl_kmem_cache_reason() */
+typedef enum kmem_reason {
+	KMC_REASON_FLAGS	= 0,	/* Requested by the caller */
+	KMC_REASON_SIZE		= 1,	/* Object size heuristic */
+	KMC_REASON_MERGE	= 2,	/* Merged with another cache */
+	KMC_REASON_RATE		= 3,	/* High allocation rate */
+	KMC_REASON_IDLE		= 4,	/* Low allocation rate, no objects */
+	KMC_REASON_FRAG		= 5,	/* Low allocation rate, fragmented */
+} kmem_reason_t;
+
+/* Background reaper statistics, see spl_kmem_reap_stat() */
+#define	SPL_KMEM_REAP_WAKEUPS	0	/* Reaper passes */
+#define	SPL_KMEM_REAP_ACTIVE	1	/* Passes below the watermark */
+#define	SPL_KMEM_REAP_CACHES	2	/* Caches reaped */
+#define	SPL_KMEM_REAP_BYTES	3	/* Slab bytes released */
+
 extern unsigned int spl_kmem_cache_expire;
+extern unsigned int spl_kmem_cache_color;
+extern unsigned int spl_kmem_cache_merge;
+extern unsigned long spl_kmem_cache_magazine_limit;
+extern unsigned int spl_kmem_cache_auto_rate;
+extern unsigned int spl_kmem_reap_interval;
+extern unsigned int spl_kmem_reap_watermark;
 extern struct list_head spl_kmem_cache_list;
 extern struct rw_semaphore spl_kmem_cache_sem;
 
@@ -104,6 +133,7 @@ extern struct rw_semaphore spl_kmem_cache_sem;
 #define	SPL_KMEM_CACHE_OBJ_PER_SLAB	8	/* Target objects per slab */
 #define	SPL_KMEM_CACHE_OBJ_PER_SLAB_MIN	1	/* Minimum objects per slab */
 #define	SPL_KMEM_CACHE_ALIGN		8	/* Default object alignment */
+#define	SPL_MAGAZINE_MIN		2	/* Minimum magazine size */
 #ifdef _LP64
 #define	SPL_KMEM_CACHE_MAX_SIZE		32	/* Max slab size in MB */
 #else
@@ -135,6 +165,7 @@ typedef struct spl_kmem_magazine {
 	struct spl_kmem_cache	*skm_cache;	/* Owned by cache */
 	unsigned long		skm_age;	/* Last cache access */
 	unsigned int		skm_cpu;	/* Owned by cpu */
+	unsigned long		skm_alloc;	/* Allocations served */
 	void			*skm_objs[0];	/* Object pointers */
 } spl_kmem_magazine_t;
 
@@ -153,6 +184,8 @@ typedef struct spl_kmem_slab {
 	struct list_head	sks_free_list;	/* Free object list */
 	unsigned long		sks_age;	/* Last modify jiffie */
 	uint32_t		sks_ref;	/* Ref count used objects */
+	struct rcu_head		sks_rcu;	/* Deferred free linkage */
+	taskq_ent_t		sks_tqe;	/* Deferred free task entry */
 } spl_kmem_slab_t;
 
 typedef struct spl_kmem_alloc {
@@ -167,32 +200,43 @@ typedef struct spl_kmem_emergency {
 } spl_kmem_emergency_t;
 
 typedef struct spl_kmem_cache {
+	/*
+	 * Read-mostly fields consulted on every allocation and free.  They
+	 * are set when the cache is created and are kept apart from the
+	 * lock and counters below which are written far more frequently.
+	 */
 	uint32_t		skc_magic;	/* Sanity magic */
 	uint32_t		skc_name_size;	/* Name length */
 	char			*skc_name;	/* Name string */
 	spl_kmem_magazine_t	**skc_mag;	/* Per-CPU warm cache */
-	uint32_t		skc_mag_size;	/* Magazine size */
-	uint32_t		skc_mag_refill;	/* Magazine refill count */
 	spl_kmem_ctor_t		skc_ctor;	/* Constructor */
 	spl_kmem_dtor_t		skc_dtor;	/* Destructor */
 	spl_kmem_reclaim_t	skc_reclaim;	/* Reclaimator */
 	void			*skc_private;	/* Private data */
 	void			*skc_vmp;	/* Unused */
 	struct kmem_cache	*skc_linux_cache; /* Linux slab cache if used */
+	struct spl_kmem_cache	*skc_merge;	/* Backing cache when merged */
 	unsigned long		skc_flags;	/* Flags */
 	uint32_t		skc_obj_size;	/* Object size */
 	uint32_t		skc_obj_align;	/* Object alignment */
 	uint32_t		skc_slab_objs;	/* Objects per slab */
 	uint32_t		skc_slab_size;	/* Slab size */
+	uint32_t		skc_mag_size;	/* Magazine size */
+	uint32_t		skc_mag_refill;	/* Magazine refill count */
 	uint32_t		skc_delay;	/* Slab reclaim interval */
 	uint32_t		skc_reap;	/* Slab reclaim count */
-	atomic_t		skc_ref;	/* Ref count callers */
 	taskqid_t		skc_taskqid;	/* Slab reclaim task */
 	struct list_head	skc_list;	/* List of caches linkage */
+	struct list_head	skc_merge_list;	/* Merged caches linkage */
+
+	/* Cache lock and the slab state protected by it */
+	spinlock_t		skc_lock ____cacheline_aligned_in_smp;
+	uint32_t		skc_slab_color;	/* Next slab color offset */
+	uint32_t		skc_slab_color_max; /* Max slab color offset */
+	uint64_t		skc_mag_miss;	/* Magazine refills/overflows */
 	struct list_head	skc_complete_list; /* Completely alloc'ed */
 	struct list_head	skc_partial_list;  /* Partially alloc'ed */
 	struct rb_root		skc_emergency_tree; /* Min sized objects */
-	spinlock_t		skc_lock;	/* Cache lock */
 	wait_queue_head_t	skc_waitq;	/* Allocation waiters */
 	uint64_t		skc_slab_fail;	/* Slab alloc failures */
 	uint64_t		skc_slab_create;  /* Slab creates */
@@ -206,6 +250,23 @@ typedef struct spl_kmem_cache {
 	uint64_t		skc_obj_deadlock;  /* Obj emergency deadlocks */
 	uint64_t		skc_obj_emergency; /* Obj emergency current */
 	uint64_t		skc_obj_emergency_max; /* Obj emergency max */
+
+	/* Counters updated without skc_lock by allocating threads */
+	atomic_t		skc_ref ____cacheline_aligned_in_smp;
+	atomic_long_t		skc_merge_alloc; /* Obj alloc when merged */
+	atomic_long_t		skc_linux_alloc; /* Linux slab allocations */
+	atomic_long_t		skc_linux_free;	/* Linux slab frees */
+	unsigned long		skc_linux_max;	/* Linux slab obj max */
+
+	/* Owned by the periodic magazine balance and backend selection */
+	uint32_t		skc_mag_target ____cacheline_aligned_in_smp;
+	uint64_t		skc_mag_miss_last; /* Misses at last rebalance */
+	uint64_t		skc_mag_weight;	/* Share of magazine budget */
+	uint64_t		skc_auto_allocs; /* Allocations at last pass */
+	uint64_t		skc_auto_rate;	/* Allocations per second */
+	uint64_t		skc_auto_migrations; /* Backend changes */
+	unsigned long		skc_auto_time;	/* Last backend change */
+	kmem_reason_t		skc_auto_reason; /* Reason for backend */
 } spl_kmem_cache_t;
 #define	kmem_cache_t		spl_kmem_cache_t
 
@@ -219,7 +280,14 @@ extern void *spl_kmem_cache_alloc(spl_kmem_cache_t *skc, int flags);
 extern void spl_kmem_cache_free(spl_kmem_cache_t *skc, void *obj);
 extern void spl_kmem_cache_set_allocflags(spl_kmem_cache_t *skc, gfp_t flags);
 extern void spl_kmem_cache_reap_now(spl_kmem_cache_t *skc, int count);
+extern uint64_t spl_kmem_cache_magazine_bytes(spl_kmem_cache_t *skc);
+extern uint64_t spl_kmem_cache_magazine_total(uint64_t *limit);
+extern void spl_kmem_cache_magazine_balance(void);
+extern unsigned long spl_kmem_cache_linux_alloc(spl_kmem_cache_t *skc);
+extern const char *spl_kmem_cache_reason(spl_kmem_cache_t *skc);
 extern void spl_kmem_reap(void);
+extern void spl_kmem_reap_schedule(void);
+extern uint64_t spl_kmem_reap_stat(int stat);
 
 #define	kmem_cache_create(name, size, align, ctor, dtor, rclm, priv, vmp, fl) \
     spl_kmem_cache_create(name, size, align, ctor, dtor, rclm, priv, vmp, fl)
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2007-2010 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SPL_KMEM_PAGE_H
+#define	_SPL_KMEM_PAGE_H
+
+#include <sys/kmem.h>
+#include <linux/mm.h>
+
+/*
+ * Order-0 page pool.  Consumers which build buffers from individual pages
+ * may allocate them with kmem_page_alloc() and release them with
+ * kmem_page_free().  Freed pages are kept on a per-cpu list, up to
+ * spl_kmem_page_pool pages, and reused by the next allocation on that
+ * cpu.  The lists are refilled from and drained to the page allocator in
+ * batches and are trimmed by the kernel shrinker under memory pressure.
+ * Only pages local to the freeing cpu's NUMA node are pooled.
+ *
+ * Pages must be returned with a single reference held by the caller.
+ */
+extern unsigned int spl_kmem_page_pool;
+
+/* Page pool statistics, see kmem_page_stat() */
+#define	SPL_KMEM_PAGE_HITS	0	/* Served from the pool */
+#define	SPL_KMEM_PAGE_MISSES	1	/* Served by the page allocator */
+#define	SPL_KMEM_PAGE_POOLED	2	/* Pages currently pooled */
+
+extern struct page *kmem_page_alloc(int flags);
+extern void kmem_page_free(struct page *page);
+extern uint64_t kmem_page_stat(int stat);
+
+/*
+ * The following functions are only available for internal use.
+ */
+extern int spl_kmem_page_init(void);
+extern void spl_kmem_page_fini(void);
+
+#endif	/* _SPL_KMEM_PAGE_H */
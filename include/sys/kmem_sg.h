@@ -0,0 +1,88 @@
+/*
+ *  Copyright (C) 2007-2010 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SPL_KMEM_SG_H
+#define	_SPL_KMEM_SG_H
+
+#include <sys/kmem.h>
+#include <linux/mm.h>
+
+/*
+ * Scatter-list allocation interfaces.  Large kmem_alloc() and vmem_alloc()
+ * allocations require either physically contiguous memory or vmalloc()
+ * which serializes on a global lock and is expensive to free.  Consumers
+ * which do not require a virtually contiguous buffer may instead allocate
+ * a kmem_sg_t which is backed by a list of equally sized page chunks.  The
+ * chunks are of the largest order up to KMEM_SG_MAX_ORDER which can be
+ * cheaply allocated, falling back to order-0 pages under fragmentation.
+ *
+ * The contents are accessed through the iterate, copy, and checksum
+ * helpers below which walk the chunks covering a byte range.
+ */
+#define	KMEM_SG_MAX_ORDER	PAGE_ALLOC_COSTLY_ORDER
+
+typedef struct kmem_sg {
+	size_t		ksg_size;	/* Buffer size in bytes */
+	uint_t		ksg_nchunks;	/* Number of chunks */
+	uint_t		ksg_order;	/* Page order of each chunk */
+	struct page	**ksg_chunks;	/* Chunk pages */
+} kmem_sg_t;
+
+/*
+ * Called for each virtually contiguous segment of a range, a non-zero
+ * return value terminates the iteration and is returned to the caller.
+ */
+typedef int (*kmem_sg_func_t)(void *buf, size_t len, void *priv);
+
+static inline size_t
+kmem_sg_size(kmem_sg_t *sg)
+{
+	return (sg->ksg_size);
+}
+
+static inline size_t
+kmem_sg_chunk_size(kmem_sg_t *sg)
+{
+	return (PAGE_SIZE << sg->ksg_order);
+}
+
+extern kmem_sg_t *kmem_sg_alloc(size_t size, int flags);
+extern kmem_sg_t *kmem_sg_zalloc(size_t size, int flags);
+extern void kmem_sg_free(kmem_sg_t *sg);
+
+extern int kmem_sg_iterate(kmem_sg_t *sg, size_t off, size_t len,
+    kmem_sg_func_t func, void *priv);
+extern void kmem_sg_zero(kmem_sg_t *sg, size_t off, size_t len);
+extern void kmem_sg_copy_from_buf(kmem_sg_t *sg, size_t off,
+    const void *buf, size_t len);
+extern void kmem_sg_copy_to_buf(void *buf, kmem_sg_t *sg, size_t off,
+    size_t len);
+extern void kmem_sg_copy(kmem_sg_t *dst, size_t doff, kmem_sg_t *src,
+    size_t soff, size_t len);
+extern int kmem_sg_cmp(kmem_sg_t *sg, size_t off, const void *buf,
+    size_t len);
+extern void kmem_sg_fletcher_4(kmem_sg_t *sg, size_t off, size_t len,
+    uint64_t *cksum);
+
+#endif	/* _SPL_KMEM_SG_H */
@@ -27,6 +27,7 @@
 
 #include <linux/module.h>
 #include <linux/proc_compat.h>
+#include <linux/seqlock.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/kmem.h>
@@ -68,6 +69,7 @@
 #define KSTAT_FLAG_WRITABLE     0x04
 #define KSTAT_FLAG_PERSISTENT   0x08
 #define KSTAT_FLAG_DORMANT      0x10
+#define KSTAT_FLAG_SEQCOUNT     0x20
 #define KSTAT_FLAG_UNSUPPORTED  (KSTAT_FLAG_VAR_SIZE | KSTAT_FLAG_WRITABLE | \
 				 KSTAT_FLAG_PERSISTENT | KSTAT_FLAG_DORMANT)
 
@@ -121,6 +123,10 @@ struct kstat_s {
 	kstat_raw_ops_t  ks_raw_ops;                /* ops table for raw type */
 	char             *ks_raw_buf;               /* buf used for raw ops */
 	size_t           ks_raw_bufsize;            /* size of raw ops buffer */
+	seqcount_t       ks_seq;                    /* data update sequence */
+	kmutex_t         ks_snap_lock;              /* snapshot reader lock */
+	void             *ks_snap_buf;              /* snapshot of ks_data */
+	atomic_t         ks_event;                  /* change event count */
 };
 
 typedef struct kstat_named_s {
@@ -194,9 +200,53 @@ extern void kstat_waitq_exit(kstat_io_t *);
 extern void kstat_runq_enter(kstat_io_t *);
 extern void kstat_runq_exit(kstat_io_t *);
 
+extern void __kstat_snapshot(kstat_t *ksp, void *buf);
+extern void __kstat_changed(kstat_t *ksp);
+
+/*
+ * The data of a KSTAT_FLAG_SEQCOUNT kstat is read without taking ks_lock.
+ * Readers copy ks_data optimistically and retry when an update raced with
+ * the copy, so formatting the kstat for user space never stalls updaters.
+ * Updaters wrap each change to ks_data in kstat_update_enter() and
+ * kstat_update_exit() and must not sleep in between.  Concurrent updaters
+ * must still be serialized by the caller, typically with ks_lock.  The
+ * ks_update callback of such a kstat is called without ks_lock held.
+ */
+static inline void
+kstat_update_enter(kstat_t *ksp)
+{
+	ASSERT(ksp->ks_flags & KSTAT_FLAG_SEQCOUNT);
+	preempt_disable();
+	write_seqcount_begin(&ksp->ks_seq);
+}
+
+static inline void
+kstat_update_exit(kstat_t *ksp)
+{
+	write_seqcount_end(&ksp->ks_seq);
+	preempt_enable();
+}
+
 #define kstat_set_raw_ops(k,h,d,a)	__kstat_set_raw_ops(k,h,d,a)
 #define kstat_create(m,i,n,c,t,s,f)	__kstat_create(m,i,n,c,t,s,f)
 #define kstat_install(k)		__kstat_install(k)
 #define kstat_delete(k)			__kstat_delete(k)
+#define kstat_snapshot(k,b)		__kstat_snapshot(k,b)
+#define kstat_changed(k)		__kstat_changed(k)
+
+/*
+ * Add delta to a 64-bit named counter and notify pollers when the new
+ * value is the first to reach or exceed threshold.
+ */
+static inline void
+kstat_named_add_threshold(kstat_t *ksp, kstat_named_t *knp, uint64_t delta,
+    uint64_t threshold)
+{
+	uint64_t old = knp->value.ui64;
+
+	knp->value.ui64 = old + delta;
+	if (old < threshold && knp->value.ui64 >= threshold)
+		kstat_changed(ksp);
+}
 
 #endif  /* _SPL_KSTAT_H */
@@ -41,6 +41,27 @@ typedef enum {
 	RW_READER	= 2
 } krw_t;
 
+/*
+ * Fairness policy passed as the rw_init() 'arg'.  The default uses the
+ * native rw_semaphore and its fairness.  Any other policy is implemented
+ * by the SPL and is honored by rw_enter(), rw_tryupgrade() and
+ * rw_downgrade().
+ *
+ * RW_POLICY_WRITER - New readers wait while any writer is waiting.
+ * RW_POLICY_READER - Writers wait while any reader is active or waiting.
+ * RW_POLICY_FAIR   - Phase-fair, readers and writers alternate.  Readers
+ *                    wait for writers which were waiting when they arrived,
+ *                    writers are granted the lock in FIFO order.
+ */
+typedef enum {
+	RW_POLICY_DEFAULT	= 0,
+	RW_POLICY_WRITER	= 1,
+	RW_POLICY_READER	= 2,
+	RW_POLICY_FAIR		= 3
+} krw_policy_t;
+
+struct spl_rw_policy;
+
 /*
  * If CONFIG_RWSEM_SPIN_ON_OWNER is defined, rw_semaphore will have an owner
  * field, so we don't need our own.
@@ -53,8 +74,18 @@ typedef struct {
 #ifdef CONFIG_LOCKDEP
 	krw_type_t	rw_type;
 #endif /* CONFIG_LOCKDEP */
+	struct spl_rw_policy *rw_policy;
 } krwlock_t;
 
+extern void spl_rw_policy_init(krwlock_t *, krw_policy_t);
+extern void spl_rw_policy_destroy(krwlock_t *);
+extern int spl_rw_policy_held(krwlock_t *, krw_t);
+extern int spl_rw_policy_tryenter(krwlock_t *, krw_t);
+extern void spl_rw_policy_enter(krwlock_t *, krw_t);
+extern void spl_rw_policy_exit(krwlock_t *);
+extern void spl_rw_policy_downgrade(krwlock_t *);
+extern int spl_rw_policy_tryupgrade(krwlock_t *);
+
 #define SEM(rwp)	(&(rwp)->rw_rwlock)
 
 static inline void
@@ -114,18 +145,27 @@ spl_rw_lockdep_on_maybe(krwlock_t *rwp)			\
 static inline int
 RW_READ_HELD(krwlock_t *rwp)
 {
+	if (rwp->rw_policy != NULL)
+		return (spl_rw_policy_held(rwp, RW_READER));
+
 	return (spl_rwsem_is_locked(SEM(rwp)) && rw_owner(rwp) == NULL);
 }
 
 static inline int
 RW_WRITE_HELD(krwlock_t *rwp)
 {
+	if (rwp->rw_policy != NULL)
+		return (spl_rw_policy_held(rwp, RW_WRITER));
+
 	return (rw_owner(rwp) == current);
 }
 
 static inline int
 RW_LOCK_HELD(krwlock_t *rwp)
 {
+	if (rwp->rw_policy != NULL)
+		return (spl_rw_policy_held(rwp, RW_NONE));
+
 	return spl_rwsem_is_locked(SEM(rwp));
 }
 
@@ -143,11 +183,16 @@ RW_LOCK_HELD(krwlock_t *rwp)
 	__init_rwsem(SEM(rwp), #rwp, &__key);				\
 	spl_rw_clear_owner(rwp);					\
 	spl_rw_set_type(rwp, type);					\
+	(rwp)->rw_policy = NULL;					\
+	if ((krw_policy_t)(uintptr_t)(arg) != RW_POLICY_DEFAULT)	\
+		spl_rw_policy_init(rwp, (krw_policy_t)(uintptr_t)(arg));\
 })
 
 #define rw_destroy(rwp)							\
 ({									\
 	VERIFY(!RW_LOCK_HELD(rwp));					\
+	if ((rwp)->rw_policy != NULL)					\
+		spl_rw_policy_destroy(rwp);				\
 })
 
 #define rw_tryenter(rwp, rw)						\
@@ -155,16 +200,20 @@ RW_LOCK_HELD(krwlock_t *rwp)
 	int _rc_ = 0;							\
 									\
 	spl_rw_lockdep_off_maybe(rwp);					\
-	switch (rw) {							\
-	case RW_READER:							\
-		_rc_ = down_read_trylock(SEM(rwp));			\
-		break;							\
-	case RW_WRITER:							\
-		if ((_rc_ = down_write_trylock(SEM(rwp))))		\
-			spl_rw_set_owner(rwp);				\
-		break;							\
-	default:							\
-		VERIFY(0);						\
+	if ((rwp)->rw_policy != NULL) {					\
+		_rc_ = spl_rw_policy_tryenter(rwp, rw);			\
+	} else {							\
+		switch (rw) {						\
+		case RW_READER:						\
+			_rc_ = down_read_trylock(SEM(rwp));		\
+			break;						\
+		case RW_WRITER:						\
+			if ((_rc_ = down_write_trylock(SEM(rwp))))	\
+				spl_rw_set_owner(rwp);			\
+			break;						\
+		default:						\
+			VERIFY(0);					\
+		}							\
 	}								\
 	spl_rw_lockdep_on_maybe(rwp);					\
 	_rc_;								\
@@ -173,16 +222,20 @@ RW_LOCK_HELD(krwlock_t *rwp)
 #define rw_enter(rwp, rw)						\
 ({									\
 	spl_rw_lockdep_off_maybe(rwp);					\
-	switch (rw) {							\
-	case RW_READER:							\
-		down_read(SEM(rwp));					\
-		break;							\
-	case RW_WRITER:							\
-		down_write(SEM(rwp));					\
-		spl_rw_set_owner(rwp);					\
-		break;							\
-	default:							\
-		VERIFY(0);						\
+	if ((rwp)->rw_policy != NULL) {					\
+		spl_rw_policy_enter(rwp, rw);				\
+	} else {							\
+		switch (rw) {						\
+		case RW_READER:						\
+			down_read(SEM(rwp));				\
+			break;						\
+		case RW_WRITER:						\
+			down_write(SEM(rwp));				\
+			spl_rw_set_owner(rwp);				\
+			break;						\
+		default:						\
+			VERIFY(0);					\
+		}							\
 	}								\
 	spl_rw_lockdep_on_maybe(rwp);					\
 })
@@ -190,7 +243,9 @@ RW_LOCK_HELD(krwlock_t *rwp)
 #define rw_exit(rwp)							\
 ({									\
 	spl_rw_lockdep_off_maybe(rwp);					\
-	if (RW_WRITE_HELD(rwp)) {					\
+	if ((rwp)->rw_policy != NULL) {					\
+		spl_rw_policy_exit(rwp);				\
+	} else if (RW_WRITE_HELD(rwp)) {				\
 		spl_rw_clear_owner(rwp);				\
 		up_write(SEM(rwp));					\
 	} else {							\
@@ -203,8 +258,12 @@ RW_LOCK_HELD(krwlock_t *rwp)
 #define rw_downgrade(rwp)						\
 ({									\
 	spl_rw_lockdep_off_maybe(rwp);					\
-	spl_rw_clear_owner(rwp);					\
-	downgrade_write(SEM(rwp));					\
+	if ((rwp)->rw_policy != NULL) {					\
+		spl_rw_policy_downgrade(rwp);				\
+	} else {							\
+		spl_rw_clear_owner(rwp);				\
+		downgrade_write(SEM(rwp));				\
+	}								\
 	spl_rw_lockdep_on_maybe(rwp);					\
 })
 
@@ -224,7 +283,7 @@ RW_LOCK_HELD(krwlock_t *rwp)
 extern void __up_read_locked(struct rw_semaphore *);
 extern int __down_write_trylock_locked(struct rw_semaphore *);
 
-#define rw_tryupgrade(rwp)						\
+#define __rw_tryupgrade(rwp)						\
 ({									\
 	unsigned long _flags_;						\
 	int _rc_ = 0;							\
@@ -249,9 +308,15 @@ extern int __down_write_trylock_locked(struct rw_semaphore *);
  * rwsem would be safe.  For now that's not worth the trouble so in this
  * case rw_tryupgrade() has just been disabled.
  */
-#define rw_tryupgrade(rwp)	({ 0; })
+#define __rw_tryupgrade(rwp)	({ 0; })
 #endif
 
+#define rw_tryupgrade(rwp)						\
+({									\
+	((rwp)->rw_policy != NULL) ?					\
+	    spl_rw_policy_tryupgrade(rwp) : __rw_tryupgrade(rwp);	\
+})
+
 int spl_rw_init(void);
 void spl_rw_fini(void);
 
@@ -123,31 +123,67 @@
 #define bcopy(src,dest,size)		memmove(dest,src,size)
 #define bcmp(src,dest,size)		memcmp((src), (dest), (size_t)(size))
 
-/* Dtrace probes do not exist in the linux kernel */
+/*
+ * Dtrace probes are mapped to the generic spl_probe* tracepoints when the
+ * kernel supports them, see sys/trace.h.  Arguments are recorded along
+ * with their declared type and widened to 64-bits, pointers included.
+ */
 #ifdef DTRACE_PROBE
 #undef  DTRACE_PROBE
 #endif  /* DTRACE_PROBE */
-#define DTRACE_PROBE(a)					((void)0)
 
 #ifdef DTRACE_PROBE1
 #undef  DTRACE_PROBE1
 #endif  /* DTRACE_PROBE1 */
-#define DTRACE_PROBE1(a, b, c)				((void)0)
 
 #ifdef DTRACE_PROBE2
 #undef  DTRACE_PROBE2
 #endif  /* DTRACE_PROBE2 */
-#define DTRACE_PROBE2(a, b, c, d, e)			((void)0)
 
 #ifdef DTRACE_PROBE3
 #undef  DTRACE_PROBE3
 #endif  /* DTRACE_PROBE3 */
-#define DTRACE_PROBE3(a, b, c, d, e, f, g)		((void)0)
 
 #ifdef DTRACE_PROBE4
 #undef  DTRACE_PROBE4
 #endif  /* DTRACE_PROBE4 */
+
+#ifdef HAVE_DECLARE_EVENT_CLASS
+#include <sys/trace.h>
+
+/*
+ * Probe arguments are recorded as uint64_t.  Pointers are converted
+ * through uintptr_t and integers through int64_t so 64-bit integers are
+ * not truncated on 32-bit kernels.  The intermediate type is selected
+ * without casting the argument in the branch which is not taken, which
+ * would warn about pointer to integer casts of a different size.
+ */
+#define DTRACE_PROBE_ARG(x)					\
+	((uint64_t)(__typeof__(__builtin_choose_expr(		\
+	    __builtin_classify_type(x) == 5, (uintptr_t)0,	\
+	    (int64_t)0)))(x))
+
+#define DTRACE_PROBE(a)					\
+	trace_spl_probe0(#a)
+#define DTRACE_PROBE1(a, b, c)				\
+	trace_spl_probe1(#a, #b, DTRACE_PROBE_ARG(c))
+#define DTRACE_PROBE2(a, b, c, d, e)			\
+	trace_spl_probe2(#a, #b, DTRACE_PROBE_ARG(c),	\
+	    #d, DTRACE_PROBE_ARG(e))
+#define DTRACE_PROBE3(a, b, c, d, e, f, g)		\
+	trace_spl_probe3(#a, #b, DTRACE_PROBE_ARG(c),	\
+	    #d, DTRACE_PROBE_ARG(e), #f, DTRACE_PROBE_ARG(g))
+#define DTRACE_PROBE4(a, b, c, d, e, f, g, h, i)	\
+	trace_spl_probe4(#a, #b, DTRACE_PROBE_ARG(c),	\
+	    #d, DTRACE_PROBE_ARG(e), #f, DTRACE_PROBE_ARG(g),	\
+	    #h, DTRACE_PROBE_ARG(i))
+#else
+#define DTRACE_PROBE(a)					((void)0)
+#define DTRACE_PROBE1(a, b, c)				((void)0)
+#define DTRACE_PROBE2(a, b, c, d, e)			((void)0)
+#define DTRACE_PROBE3(a, b, c, d, e, f, g)		((void)0)
 #define DTRACE_PROBE4(a, b, c, d, e, f, g, h, i)	((void)0)
+#endif /* HAVE_DECLARE_EVENT_CLASS */
 
 /* Missing globals */
 extern char spl_version[32];
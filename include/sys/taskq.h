@@ -26,10 +26,12 @@
 #define	_SPL_TASKQ_H
 
 #include <linux/module.h>
+#include <linux/cache.h>
 #include <linux/gfp.h>
 #include <linux/slab.h>
 #include <linux/interrupt.h>
 #include <linux/kthread.h>
+#include <linux/rwsem.h>
 #include <sys/types.h>
 #include <sys/thread.h>
 
@@ -54,6 +56,7 @@
 #define	TQ_NOALLOC		0x02000000
 #define	TQ_NEW			0x04000000
 #define	TQ_FRONT		0x08000000
+#define	TQ_COALESCE		0x10000000
 
 /*
  * spin_lock(lock) and spin_lock_nested(lock,0) are equivalent,
@@ -68,39 +71,64 @@ typedef unsigned long taskqid_t;
 typedef void (task_func_t)(void *);
 
 typedef struct taskq {
-	spinlock_t		tq_lock;	/* protects taskq_t */
+	/*
+	 * Read-mostly configuration.  These fields are set by taskq_create()
+	 * and are kept off the cache lines written under tq_lock so checking
+	 * them does not contend with dispatchers and workers.
+	 */
 	char			*tq_name;	/* taskq name */
-	struct list_head	tq_thread_list;	/* list of all threads */
-	struct list_head	tq_active_list;	/* list of active threads */
-	int			tq_nactive;	/* # of active threads */
-	int			tq_nthreads;	/* # of existing threads */
-	int			tq_nspawn;	/* # of threads being spawned */
+	uint_t			tq_flags;	/* flags */
 	int			tq_maxthreads;	/* # of threads maximum */
 	int			tq_pri;		/* priority */
 	int			tq_minalloc;	/* min task_t pool size */
 	int			tq_maxalloc;	/* max task_t pool size */
-	int			tq_nalloc;	/* cur task_t pool size */
-	uint_t			tq_flags;	/* flags */
+	tq_lock_role_t		tq_lock_class;	/* class when taking tq_lock */
+	int			tq_limit;	/* max queued tasks, 0 = none */
+	struct list_head	tq_taskqs;	/* all taskqs linkage */
+
+	/*
+	 * Lock and all state protected by it.  These fields are only
+	 * written while holding tq_lock so they share its cache lines,
+	 * those used by every dispatch and task first.
+	 */
+	spinlock_t		tq_lock ____cacheline_aligned_in_smp;
 	taskqid_t		tq_next_id;	/* next pend/work id */
 	taskqid_t		tq_lowest_id;	/* lowest pend/work id */
+	int			tq_nalloc;	/* cur task_t pool size */
+	int			tq_nqueued;	/* # of queued tasks */
+	int			tq_nactive;	/* # of active threads */
+	int			tq_nthreads;	/* # of existing threads */
+	int			tq_nspawn;	/* # of threads being spawned */
 	struct list_head	tq_free_list;	/* free task_t's */
 	struct list_head	tq_pend_list;	/* pending task_t's */
 	struct list_head	tq_prio_list;	/* priority pending task_t's */
+	struct list_head	tq_active_list;	/* list of active threads */
+	struct list_head	tq_thread_list;	/* list of all threads */
+	struct list_head	tq_coalesce_list; /* coalescing pending task_t's */
 	struct list_head	tq_delay_list;	/* delayed task_t's */
-	wait_queue_head_t	tq_work_waitq;	/* new work waitq */
+	uint64_t		tq_throttle_count; /* throttled dispatches */
+	uint64_t		tq_throttle_fail; /* refused dispatches */
+	hrtime_t		tq_throttle_time; /* time spent throttled */
+	uint64_t		tq_coalesced;	/* dispatches coalesced */
+
+	/* Wait queues, each serialized by its own internal lock */
+	wait_queue_head_t	tq_work_waitq ____cacheline_aligned_in_smp;
 	wait_queue_head_t	tq_wait_waitq;	/* wait waitq */
-	tq_lock_role_t		tq_lock_class;	/* class when taking tq_lock */
+	wait_queue_head_t	tq_throttle_waitq; /* throttled dispatchers */
 } taskq_t;
 
+/*
+ * The timer needed by delayed tasks is allocated separately by
+ * taskq_dispatch_delay() so that entries embedded by consumers stay small.
+ */
+struct taskq_delay;
+
 typedef struct taskq_ent {
-	spinlock_t		tqent_lock;
-	wait_queue_head_t	tqent_waitq;
-	struct timer_list	tqent_timer;
 	struct list_head	tqent_list;
 	taskqid_t		tqent_id;
 	task_func_t		*tqent_func;
 	void			*tqent_arg;
-	taskq_t			*tqent_taskq;
+	struct taskq_delay	*tqent_delay;
 	uintptr_t		tqent_flags;
 } taskq_ent_t;
 
@@ -120,6 +148,10 @@ typedef struct taskq_thread {
 /* Global system-wide dynamic task queue available for all consumers */
 extern taskq_t *system_taskq;
 
+/* List of all taskqs */
+extern struct list_head spl_taskq_list;
+extern struct rw_semaphore spl_taskq_sem;
+
 extern taskqid_t taskq_dispatch(taskq_t *, task_func_t, void *, uint_t);
 extern taskqid_t taskq_dispatch_delay(taskq_t *, task_func_t, void *,
     uint_t, clock_t);
@@ -134,6 +166,7 @@ extern void taskq_wait_outstanding(taskq_t *, taskqid_t);
 extern void taskq_wait(taskq_t *);
 extern int taskq_cancel_id(taskq_t *, taskqid_t);
 extern int taskq_member(taskq_t *, void *);
+extern void taskq_set_limit(taskq_t *, int);
 
 #define	taskq_create_proc(name, nthreads, pri, min, max, proc, flags) \
     taskq_create(name, nthreads, pri, min, max, flags)
@@ -142,5 +175,7 @@ extern int taskq_member(taskq_t *, void *);
 
 int spl_taskq_init(void);
 void spl_taskq_fini(void);
+int spl_taskq_system_init(void);
+void spl_taskq_system_fini(void);
 
 #endif  /* _SPL_TASKQ_H */
@@ -0,0 +1,171 @@
+/*****************************************************************************\
+ *  Copyright (C) 2007-2010 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+\*****************************************************************************/
+
+/*
+ * Static tracepoints backing the Solaris DTRACE_PROBE* macros.
+ *
+ * A DTRACE_PROBEn(name, type1, arg1, ...) site expands to a call to the
+ * matching spl_probeN tracepoint.  While the tracepoint is disabled the
+ * call site is a patched out branch (a static key when the kernel was
+ * built with CONFIG_JUMP_LABEL).  Once enabled, e.g. with
+ *
+ *   echo 1 >/sys/kernel/debug/tracing/events/spl/enable
+ *   perf record -e 'spl:spl_probe*' -a
+ *
+ * each hit records the probe name, the declared C type of every argument,
+ * and the argument values widened to 64-bits.  Use a trace filter on the
+ * 'name' field to select individual probe sites.
+ */
+
+#if defined(HAVE_DECLARE_EVENT_CLASS)
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM spl
+
+#if !defined(_TRACE_SPL_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_SPL_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+TRACE_EVENT(spl_probe0,
+	TP_PROTO(const char *name),
+	TP_ARGS(name),
+	TP_STRUCT__entry(
+		__string(name, name)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+	),
+	TP_printk("%s", __get_str(name))
+);
+
+TRACE_EVENT(spl_probe1,
+	TP_PROTO(const char *name, const char *t1, uint64_t a1),
+	TP_ARGS(name, t1, a1),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(t1, t1)
+		__field(uint64_t, a1)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(t1, t1);
+		__entry->a1 = a1;
+	),
+	TP_printk("%s (%s)0x%llx", __get_str(name),
+	    __get_str(t1), __entry->a1)
+);
+
+TRACE_EVENT(spl_probe2,
+	TP_PROTO(const char *name, const char *t1, uint64_t a1,
+	    const char *t2, uint64_t a2),
+	TP_ARGS(name, t1, a1, t2, a2),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(t1, t1)
+		__field(uint64_t, a1)
+		__string(t2, t2)
+		__field(uint64_t, a2)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(t1, t1);
+		__entry->a1 = a1;
+		__assign_str(t2, t2);
+		__entry->a2 = a2;
+	),
+	TP_printk("%s (%s)0x%llx (%s)0x%llx", __get_str(name),
+	    __get_str(t1), __entry->a1, __get_str(t2), __entry->a2)
+);
+
+TRACE_EVENT(spl_probe3,
+	TP_PROTO(const char *name, const char *t1, uint64_t a1,
+	    const char *t2, uint64_t a2, const char *t3, uint64_t a3),
+	TP_ARGS(name, t1, a1, t2, a2, t3, a3),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(t1, t1)
+		__field(uint64_t, a1)
+		__string(t2, t2)
+		__field(uint64_t, a2)
+		__string(t3, t3)
+		__field(uint64_t, a3)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(t1, t1);
+		__entry->a1 = a1;
+		__assign_str(t2, t2);
+		__entry->a2 = a2;
+		__assign_str(t3, t3);
+		__entry->a3 = a3;
+	),
+	TP_printk("%s (%s)0x%llx (%s)0x%llx (%s)0x%llx", __get_str(name),
+	    __get_str(t1), __entry->a1, __get_str(t2), __entry->a2,
+	    __get_str(t3), __entry->a3)
+);
+
+TRACE_EVENT(spl_probe4,
+	TP_PROTO(const char *name, const char *t1, uint64_t a1,
+	    const char *t2, uint64_t a2, const char *t3, uint64_t a3,
+	    const char *t4, uint64_t a4),
+	TP_ARGS(name, t1, a1, t2, a2, t3, a3, t4, a4),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__string(t1, t1)
+		__field(uint64_t, a1)
+		__string(t2, t2)
+		__field(uint64_t, a2)
+		__string(t3, t3)
+		__field(uint64_t, a3)
+		__string(t4, t4)
+		__field(uint64_t, a4)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__assign_str(t1, t1);
+		__entry->a1 = a1;
+		__assign_str(t2, t2);
+		__entry->a2 = a2;
+		__assign_str(t3, t3);
+		__entry->a3 = a3;
+		__assign_str(t4, t4);
+		__entry->a4 = a4;
+	),
+	TP_printk("%s (%s)0x%llx (%s)0x%llx (%s)0x%llx (%s)0x%llx",
+	    __get_str(name), __get_str(t1), __entry->a1, __get_str(t2),
+	    __entry->a2, __get_str(t3), __entry->a3, __get_str(t4),
+	    __entry->a4)
+);
+
+#endif /* _TRACE_SPL_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH sys
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
+
+#endif /* HAVE_DECLARE_EVENT_CLASS */
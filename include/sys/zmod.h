@@ -63,6 +63,28 @@ extern int z_compress_level(void *dest, size_t *destLen, const void *source,
 extern int z_uncompress(void *dest, size_t *destLen, const void *source,
     size_t sourceLen);
 
+/*
+ * Preset dictionaries improve the ratio of small structured buffers by
+ * giving the compressor history to match against.  A dictionary is
+ * registered once by id and then used for both directions.
+ *
+ * The kernel zlib cannot set or copy deflate state, so every call to
+ * z_compress_dict() deflates the whole dictionary at the requested level
+ * before the data.  The CPU cost of a call is therefore roughly that of
+ * compressing dictLen + sourceLen bytes, and small dictionaries should be
+ * preferred for small buffers.  Decompression only copies the dictionary
+ * in to the window and is cheap.
+ */
+#define Z_DICT_MAX		(1 << MAX_WBITS)
+#define Z_DICT_PREFIX_OVERHEAD	64
+
+extern int z_dict_add(uint32_t id, const void *dict, size_t dictLen);
+extern int z_dict_remove(uint32_t id);
+extern int z_compress_dict(void *dest, size_t *destLen, const void *source,
+    size_t sourceLen, int level, uint32_t id);
+extern int z_uncompress_dict(void *dest, size_t *destLen, const void *source,
+    size_t sourceLen, uint32_t id);
+
 int spl_zlib_init(void);
 void spl_zlib_fini(void);
 
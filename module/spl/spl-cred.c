@@ -32,6 +32,18 @@
 
 #define DEBUG_SUBSYSTEM S_CRED
 
+/*
+ * Groups lists at or below this size are scanned linearly, which for the
+ * common handful of supplemental groups is cheaper than a binary search.
+ */
+#define	CR_GROUPS_LINEAR_MAX	8
+
+/*
+ * The group_info attached to a credential is never modified once the
+ * credential has been committed, and set_groups() sorts it beforehand.
+ * It is therefore safe to search without taking a reference for as long
+ * as the caller holds the credential itself.
+ */
 static int
 #ifdef HAVE_KUIDGID_T
 cr_groups_search(const struct group_info *group_info, kgid_t grp)
@@ -45,6 +57,15 @@ cr_groups_search(const struct group_info *group_info, gid_t grp)
 	if (!group_info)
 		return 0;
 
+	if (group_info->ngroups <= CR_GROUPS_LINEAR_MAX) {
+		for (mid = 0; mid < group_info->ngroups; mid++) {
+			if (KGID_TO_SGID(GROUP_AT(group_info, mid)) ==
+			    KGID_TO_SGID(grp))
+				return 1;
+		}
+		return 0;
+	}
+
 	left = 0;
 	right = group_info->ngroups;
 	while (left < right) {
@@ -62,19 +83,20 @@ cr_groups_search(const struct group_info *group_info, gid_t grp)
 	return 0;
 }
 
-/* Hold a reference on the credential and group info */
+/*
+ * Hold a reference on the credential.  The credential in turn holds a
+ * reference on its group info for its entire lifetime.
+ */
 void
 crhold(cred_t *cr)
 {
 	(void)get_cred((const cred_t *)cr);
-	(void)get_group_info(cr->group_info);
 }
 
-/* Free a reference on the credential and group info */
+/* Free a reference on the credential */
 void
 crfree(cred_t *cr)
 {
-	put_group_info(cr->group_info);
 	put_cred((const cred_t *)cr);
 }
 
@@ -82,14 +104,7 @@ crfree(cred_t *cr)
 int
 crgetngroups(const cred_t *cr)
 {
-	struct group_info *gi;
-	int rc;
-
-	gi = get_group_info(cr->group_info);
-	rc = gi->ngroups;
-	put_group_info(gi);
-
-	return rc;
+	return cr->group_info->ngroups;
 }
 
 /*
@@ -100,28 +115,14 @@ crgetngroups(const cred_t *cr)
 gid_t *
 crgetgroups(const cred_t *cr)
 {
-	struct group_info *gi;
-	gid_t *gids;
-
-	gi = get_group_info(cr->group_info);
-	gids = KGIDP_TO_SGIDP(gi->blocks[0]);
-	put_group_info(gi);
-
-	return gids;
+	return KGIDP_TO_SGIDP(cr->group_info->blocks[0]);
 }
 
 /* Check if the passed gid is available in supplied credential. */
 int
 groupmember(gid_t gid, const cred_t *cr)
 {
-	struct group_info *gi;
-	int rc;
-
-	gi = get_group_info(cr->group_info);
-	rc = cr_groups_search(gi, SGID_TO_KGID(gid));
-	put_group_info(gi);
-
-	return rc;
+	return cr_groups_search(cr->group_info, SGID_TO_KGID(gid));
 }
 
 /* Return the effective user id */
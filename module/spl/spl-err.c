@@ -26,7 +26,51 @@
 
 #include <sys/sysmacros.h>
 #include <sys/cmn_err.h>
+#include <linux/percpu.h>
 #include <linux/ratelimit.h>
+#include <linux/workqueue.h>
+#include <linux/compiler_compat.h>
+
+/*
+ * When set CE_CONT, CE_NOTE and CE_WARN messages are formatted by the
+ * caller and then queued on a per-cpu ring instead of being written to
+ * the console synchronously.  Identical back-to-back messages are
+ * coalesced in to a single entry with a repeat count, and the rings are
+ * drained to the log asynchronously by spl_err_work.  When a ring is full
+ * new messages are dropped and a count of dropped messages is logged.
+ * CE_PANIC is never deferred.
+ */
+int spl_cmn_err_deferred = 0;
+module_param(spl_cmn_err_deferred, int, 0644);
+MODULE_PARM_DESC(spl_cmn_err_deferred,
+	"Queue cmn_err() messages for asynchronous logging");
+
+#define	SPL_ERR_RING_SIZE	32	/* Must be a power of two */
+#define	SPL_ERR_RING_MASK	(SPL_ERR_RING_SIZE - 1)
+
+typedef struct spl_err_msg {
+	atomic_t		sem_count;	/* Occurrences, 0 if drained */
+	int			sem_ce;		/* CE_* level */
+	char			sem_msg[MAXMSGLEN];
+} spl_err_msg_t;
+
+/*
+ * Single producer, single consumer ring.  Only the owning cpu advances
+ * ser_head (with interrupts disabled) and only spl_err_work advances
+ * ser_tail, so no lock is required on either side.
+ */
+typedef struct spl_err_ring {
+	unsigned int		ser_head;	/* Next slot to fill */
+	unsigned int		ser_tail;	/* Next slot to drain */
+	atomic_t		ser_dropped;	/* Messages lost, ring full */
+	spl_err_msg_t		ser_msgs[SPL_ERR_RING_SIZE];
+} spl_err_ring_t;
+
+static spl_err_ring_t __percpu *spl_err_rings = NULL;
+static int spl_err_active = 0;
+
+static void spl_err_drain(struct work_struct *work);
+static DECLARE_WORK(spl_err_work, spl_err_drain);
 
 /*
  * Limit the number of stack traces dumped to not more than 5 every
@@ -74,13 +118,45 @@ spl_panic(const char *file, const char *func, int line, const char *fmt, ...) {
 }
 EXPORT_SYMBOL(spl_panic);
 
+/*
+ * Cold failure path shared by all VERIFY()/ASSERT() sites.  The message is
+ * rebuilt from the static descriptor emitted at the call site.
+ */
 void
-vcmn_err(int ce, const char *fmt, va_list ap)
+spl_verify_failed(const spl_verify_t *sv, unsigned long long left,
+    unsigned long long right)
 {
-	char msg[MAXMSGLEN];
+	switch (sv->sv_type) {
+	case SPL_VERIFY_SIGNED:
+		spl_panic(sv->sv_file, sv->sv_func, sv->sv_line,
+		    "%s failed (%lld %s %lld)\n", sv->sv_expr,
+		    (long long)left, sv->sv_op, (long long)right);
+		break;
+	case SPL_VERIFY_UNSIGNED:
+		spl_panic(sv->sv_file, sv->sv_func, sv->sv_line,
+		    "%s failed (%llu %s %llu)\n", sv->sv_expr,
+		    left, sv->sv_op, right);
+		break;
+	case SPL_VERIFY_POINTER:
+		spl_panic(sv->sv_file, sv->sv_func, sv->sv_line,
+		    "%s failed (%p %s %p)\n", sv->sv_expr,
+		    (void *)(uintptr_t)left, sv->sv_op,
+		    (void *)(uintptr_t)right);
+		break;
+	default:
+		spl_panic(sv->sv_file, sv->sv_func, sv->sv_line,
+		    "%s failed\n", sv->sv_expr);
+		break;
+	}
 
-	vsnprintf(msg, MAXMSGLEN - 1, fmt, ap);
+	/* Unreachable */
+	unreachable();
+}
+EXPORT_SYMBOL(spl_verify_failed);
 
+static void
+spl_err_print(int ce, const char *msg, int count)
+{
 	switch (ce) {
 	case CE_IGNORE:
 		break;
@@ -93,6 +169,161 @@ vcmn_err(int ce, const char *fmt, va_list ap)
 	case CE_WARN:
 		printk(KERN_WARNING "WARNING: %s\n", msg);
 		break;
+	}
+
+	if (count > 1)
+		printk(KERN_NOTICE "SPL: last message repeated %d times\n",
+		    count - 1);
+}
+
+/*
+ * Allocate the per-cpu rings.  Rings are only created once deferred
+ * logging has been enabled, until then every cpu falls back to logging
+ * synchronously.
+ */
+static void
+spl_err_ring_alloc(void)
+{
+	spl_err_ring_t __percpu *rings;
+
+	if (spl_err_rings != NULL)
+		return;
+
+	rings = alloc_percpu(spl_err_ring_t);
+	if (rings == NULL)
+		return;
+
+	smp_wmb();
+	spl_err_rings = rings;
+}
+
+static void
+spl_err_ring_drain(spl_err_ring_t *ring)
+{
+	spl_err_msg_t *sem;
+	unsigned int tail;
+	int count;
+
+	while ((tail = ring->ser_tail) != ACCESS_ONCE(ring->ser_head)) {
+		smp_rmb();
+		sem = &ring->ser_msgs[tail & SPL_ERR_RING_MASK];
+
+		/*
+		 * Claim the entry before logging it, once the count has
+		 * dropped to zero new repeats will be queued separately.
+		 */
+		count = atomic_xchg(&sem->sem_count, 0);
+		spl_err_print(sem->sem_ce, sem->sem_msg, count);
+
+		smp_mb();
+		ring->ser_tail = tail + 1;
+	}
+
+	count = atomic_xchg(&ring->ser_dropped, 0);
+	if (count > 0)
+		printk(KERN_WARNING "SPL: %d cmn_err messages dropped\n",
+		    count);
+}
+
+static void
+spl_err_drain(struct work_struct *work)
+{
+	spl_err_ring_t __percpu *rings;
+	int cpu;
+
+	if (spl_cmn_err_deferred && spl_err_active)
+		spl_err_ring_alloc();
+
+	rings = ACCESS_ONCE(spl_err_rings);
+	if (rings == NULL)
+		return;
+
+	for_each_possible_cpu(cpu)
+		spl_err_ring_drain(per_cpu_ptr(rings, cpu));
+}
+
+/*
+ * Queue a formatted message on the local cpu's ring.  Returns 0 if no
+ * ring is available yet and the caller must log the message itself.
+ * The work is only scheduled when there is something new for it to do,
+ * a repeat coalesced with a pending entry is logged by the work already
+ * scheduled for that entry.
+ */
+static int
+spl_err_queue(int ce, const char *msg)
+{
+	spl_err_ring_t __percpu *rings;
+	spl_err_ring_t *ring;
+	spl_err_msg_t *sem;
+	unsigned long flags;
+	unsigned int head, tail;
+	int wake = 1;
+
+	/* The work allocates the rings */
+	rings = ACCESS_ONCE(spl_err_rings);
+	if (rings == NULL) {
+		schedule_work(&spl_err_work);
+		return (0);
+	}
+
+	local_irq_save(flags);
+
+	ring = this_cpu_ptr(rings);
+
+	head = ring->ser_head;
+	tail = ACCESS_ONCE(ring->ser_tail);
+	smp_mb();
+
+	/* Coalesce with the most recent entry if it is still pending */
+	if (head != tail) {
+		sem = &ring->ser_msgs[(head - 1) & SPL_ERR_RING_MASK];
+		if (sem->sem_ce == ce && strcmp(sem->sem_msg, msg) == 0 &&
+		    atomic_inc_not_zero(&sem->sem_count)) {
+			wake = 0;
+			goto out;
+		}
+	}
+
+	if (head - tail >= SPL_ERR_RING_SIZE) {
+		atomic_inc(&ring->ser_dropped);
+		goto out;
+	}
+
+	sem = &ring->ser_msgs[head & SPL_ERR_RING_MASK];
+	sem->sem_ce = ce;
+	strlcpy(sem->sem_msg, msg, sizeof (sem->sem_msg));
+	atomic_set(&sem->sem_count, 1);
+
+	smp_wmb();
+	ring->ser_head = head + 1;
+out:
+	local_irq_restore(flags);
+
+	if (wake)
+		schedule_work(&spl_err_work);
+
+	return (1);
+}
+
+void
+vcmn_err(int ce, const char *fmt, va_list ap)
+{
+	char msg[MAXMSGLEN];
+
+	vsnprintf(msg, MAXMSGLEN - 1, fmt, ap);
+
+	switch (ce) {
+	case CE_IGNORE:
+		break;
+	case CE_CONT:
+	case CE_NOTE:
+	case CE_WARN:
+		if (spl_cmn_err_deferred && spl_err_active &&
+		    spl_err_queue(ce, msg))
+			break;
+
+		spl_err_print(ce, msg, 1);
+		break;
 	case CE_PANIC:
 		printk(KERN_EMERG "PANIC: %s\n", msg);
 		spl_dumpstack();
@@ -115,3 +346,25 @@ cmn_err(int ce, const char *fmt, ...)
 	va_end(ap);
 } /* cmn_err() */
 EXPORT_SYMBOL(cmn_err);
+
+int
+spl_err_init(void)
+{
+	spl_err_active = 1;
+	schedule_work(&spl_err_work);
+
+	return (0);
+}
+
+void
+spl_err_fini(void)
+{
+	spl_err_active = 0;
+	flush_work(&spl_err_work);
+	spl_err_drain(NULL);
+
+	if (spl_err_rings != NULL) {
+		free_percpu(spl_err_rings);
+		spl_err_rings = NULL;
+	}
+}
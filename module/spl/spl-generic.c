@@ -30,6 +30,7 @@
 #include <sys/kobj.h>
 #include <sys/kmem.h>
 #include <sys/kmem_cache.h>
+#include <sys/kmem_page.h>
 #include <sys/vmem.h>
 #include <sys/mutex.h>
 #include <sys/rwlock.h>
@@ -37,10 +38,14 @@
 #include <sys/tsd.h>
 #include <sys/zmod.h>
 #include <sys/debug.h>
+#include <sys/cmn_err.h>
 #include <sys/proc.h>
 #include <sys/kstat.h>
 #include <sys/file.h>
+#include <sys/thread.h>
+#include <linux/completion.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
 #include <linux/kmod.h>
 #include <linux/math64_compat.h>
 #include <linux/proc_compat.h>
@@ -501,7 +506,13 @@ spl_kvmem_init(void)
 	if (rc)
 		goto out3;
 
+	rc = spl_kmem_page_init();
+	if (rc)
+		goto out4;
+
 	return (rc);
+out4:
+	spl_kmem_cache_fini();
 out3:
 	spl_vmem_fini();
 out2:
@@ -513,55 +524,219 @@ out1:
 static void
 spl_kvmem_fini(void)
 {
+	spl_kmem_page_fini();
 	spl_kmem_cache_fini();
 	spl_vmem_fini();
 	spl_kmem_fini();
 }
 
+/*
+ * Bring up independent subsystems concurrently when the module is loaded.
+ * Creating the system taskqs spawns a thread per cpu and dominates the
+ * load time on large systems, it is run on a helper thread while the
+ * remaining subsystems are initialized.
+ */
+int spl_init_parallel = 1;
+module_param(spl_init_parallel, int, 0444);
+MODULE_PARM_DESC(spl_init_parallel, "Initialize subsystems concurrently");
+
+/*
+ * Time in nanoseconds spent initializing each subsystem when the module
+ * was loaded, reported by /proc/spl/kstat/spl/init.  The tsd hash table
+ * and zlib workspace cache are created on first use and are not included.
+ */
+typedef enum spl_init_stat {
+	SPL_INIT_ERR,
+	SPL_INIT_KVMEM,
+	SPL_INIT_MUTEX,
+	SPL_INIT_RWLOCK,
+	SPL_INIT_TASKQ,
+	SPL_INIT_VNODE,
+	SPL_INIT_PROC,
+	SPL_INIT_KSTAT,
+	SPL_INIT_TSD,
+	SPL_INIT_ZLIB,
+	SPL_INIT_TOTAL,
+	SPL_INIT_STATS
+} spl_init_stat_t;
+
+static kstat_named_t spl_init_stats[SPL_INIT_STATS] = {
+	{ "err",	KSTAT_DATA_UINT64 },
+	{ "kvmem",	KSTAT_DATA_UINT64 },
+	{ "mutex",	KSTAT_DATA_UINT64 },
+	{ "rwlock",	KSTAT_DATA_UINT64 },
+	{ "taskq",	KSTAT_DATA_UINT64 },
+	{ "vnode",	KSTAT_DATA_UINT64 },
+	{ "proc",	KSTAT_DATA_UINT64 },
+	{ "kstat",	KSTAT_DATA_UINT64 },
+	{ "tsd",	KSTAT_DATA_UINT64 },
+	{ "zlib",	KSTAT_DATA_UINT64 },
+	{ "total",	KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *spl_init_ksp;
+
+typedef struct spl_init_async {
+	struct completion	sia_done;
+	int			sia_rc;
+} spl_init_async_t;
+
+static int
+spl_init_timed(spl_init_stat_t stat, int (*func)(void))
+{
+	hrtime_t start;
+	int rc;
+
+	start = gethrtime();
+	rc = func();
+	spl_init_stats[stat].value.ui64 += gethrtime() - start;
+
+	return (rc);
+}
+
+/*
+ * The helper must not return until spl_init() calls kthread_stop(),
+ * otherwise it could still be executing module text which is freed
+ * when the initialization fails.
+ */
+static int
+spl_init_taskq_thread(void *arg)
+{
+	spl_init_async_t *sia = (spl_init_async_t *)arg;
+
+	sia->sia_rc = spl_init_timed(SPL_INIT_TASKQ, spl_taskq_system_init);
+	complete(&sia->sia_done);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return (0);
+}
+
+static void
+spl_init_kstat_create(void)
+{
+	spl_init_ksp = kstat_create("spl", 0, "init", "misc",
+	    KSTAT_TYPE_NAMED, SPL_INIT_STATS, KSTAT_FLAG_VIRTUAL);
+	if (spl_init_ksp != NULL) {
+		spl_init_ksp->ks_data = spl_init_stats;
+		kstat_install(spl_init_ksp);
+	}
+}
+
+static void
+spl_init_kstat_destroy(void)
+{
+	if (spl_init_ksp != NULL) {
+		kstat_delete(spl_init_ksp);
+		spl_init_ksp = NULL;
+	}
+}
+
 static int __init
 spl_init(void)
 {
+	struct task_struct *thr = NULL;
+	spl_init_async_t sia;
+	hrtime_t start;
 	int rc = 0;
 
-	if ((rc = spl_kvmem_init()))
+	start = gethrtime();
+
+	if ((rc = spl_init_timed(SPL_INIT_ERR, spl_err_init)))
+		goto out0;
+
+	if ((rc = spl_init_timed(SPL_INIT_KVMEM, spl_kvmem_init)))
 		goto out1;
 
-	if ((rc = spl_mutex_init()))
+	if ((rc = spl_init_timed(SPL_INIT_MUTEX, spl_mutex_init)))
 		goto out2;
 
-	if ((rc = spl_rw_init()))
+	if ((rc = spl_init_timed(SPL_INIT_RWLOCK, spl_rw_init)))
 		goto out3;
 
-	if ((rc = spl_taskq_init()))
+	/*
+	 * The dynamic_taskq is a single thread and is needed by every
+	 * TASKQ_DYNAMIC taskq, including those dispatched to by the kmem
+	 * caches created below, so it is always created synchronously.
+	 */
+	if ((rc = spl_init_timed(SPL_INIT_TASKQ, spl_taskq_init)))
 		goto out4;
 
-	if ((rc = spl_vn_init()))
+	/*
+	 * Nothing initialized below depends on the system_taskq, so it is
+	 * created on a helper thread when possible.  On failure to start
+	 * the helper it is created synchronously.
+	 */
+	init_completion(&sia.sia_done);
+	sia.sia_rc = 0;
+	if (spl_init_parallel) {
+		thr = spl_kthread_create(spl_init_taskq_thread, &sia,
+		    "spl_init");
+		if (IS_ERR(thr))
+			thr = NULL;
+		else
+			wake_up_process(thr);
+	}
+
+	if (thr == NULL &&
+	    (rc = spl_init_timed(SPL_INIT_TASKQ, spl_taskq_system_init)))
 		goto out5;
 
-	if ((rc = spl_proc_init()))
+	if ((rc = spl_init_timed(SPL_INIT_VNODE, spl_vn_init)))
 		goto out6;
 
-	if ((rc = spl_kstat_init()))
+	if ((rc = spl_init_timed(SPL_INIT_PROC, spl_proc_init)))
 		goto out7;
 
-	if ((rc = spl_tsd_init()))
+	if ((rc = spl_init_timed(SPL_INIT_KSTAT, spl_kstat_init)))
 		goto out8;
 
-	if ((rc = spl_zlib_init()))
+	if ((rc = spl_init_timed(SPL_INIT_TSD, spl_tsd_init)))
 		goto out9;
 
+	if ((rc = spl_init_timed(SPL_INIT_ZLIB, spl_zlib_init)))
+		goto out10;
+
+	if (thr != NULL) {
+		wait_for_completion(&sia.sia_done);
+		kthread_stop(thr);
+		thr = NULL;
+
+		if ((rc = sia.sia_rc))
+			goto out11;
+	}
+
+	spl_init_stats[SPL_INIT_TOTAL].value.ui64 = gethrtime() - start;
+	spl_init_kstat_create();
+
 	printk(KERN_NOTICE "SPL: Loaded module v%s-%s%s\n", SPL_META_VERSION,
 	       SPL_META_RELEASE, SPL_DEBUG_STR);
 	return (rc);
 
-out9:
+out11:
+	spl_zlib_fini();
+out10:
 	spl_tsd_fini();
-out8:
+out9:
 	spl_kstat_fini();
-out7:
+out8:
 	spl_proc_fini();
-out6:
+out7:
 	spl_vn_fini();
+out6:
+	if (thr != NULL) {
+		wait_for_completion(&sia.sia_done);
+		kthread_stop(thr);
+	}
+
+	/* A failed helper has already cleaned up after itself */
+	if (sia.sia_rc == 0)
+		spl_taskq_system_fini();
 out5:
 	spl_taskq_fini();
 out4:
@@ -571,6 +746,8 @@ out3:
 out2:
 	spl_kvmem_fini();
 out1:
+	spl_err_fini();
+out0:
 	printk(KERN_NOTICE "SPL: Failed to Load Solaris Porting Layer "
 	       "v%s-%s%s, rc = %d\n", SPL_META_VERSION, SPL_META_RELEASE,
 	       SPL_DEBUG_STR, rc);
@@ -583,15 +760,18 @@ spl_fini(void)
 {
 	printk(KERN_NOTICE "SPL: Unloaded module v%s-%s%s\n",
 	       SPL_META_VERSION, SPL_META_RELEASE, SPL_DEBUG_STR);
+	spl_init_kstat_destroy();
 	spl_zlib_fini();
 	spl_tsd_fini();
 	spl_kstat_fini();
 	spl_proc_fini();
 	spl_vn_fini();
+	spl_taskq_system_fini();
 	spl_taskq_fini();
 	spl_rw_fini();
 	spl_mutex_fini();
 	spl_kvmem_fini();
+	spl_err_fini();
 }
 
 module_init(spl_init);
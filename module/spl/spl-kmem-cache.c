@@ -27,11 +27,16 @@
 #include <sys/taskq.h>
 #include <sys/timer.h>
 #include <sys/vmem.h>
+#include <sys/vmsystm.h>
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/mm_compat.h>
 #include <linux/wait_compat.h>
 #include <linux/prefetch.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/compiler_compat.h>
+#include <linux/cpu_compat.h>
 
 /*
  * Within the scope of spl-kmem.c file the kmem_cache_* definitions
@@ -90,6 +95,22 @@ module_param(spl_kmem_cache_magazine_size, uint, 0444);
 MODULE_PARM_DESC(spl_kmem_cache_magazine_size,
 	"Default magazine size (2-256), set automatically (0)");
 
+/*
+ * Objects held in magazines are neither in use nor free.  With many caches
+ * on systems with many cpus they can add up to a significant amount of
+ * memory.  The spl_kmem_cache_magazine_limit sets a global budget in bytes
+ * for the memory which may be held by all magazines, when set to 0 the
+ * budget is 1/64 of physical memory.  When the budget is exceeded it is
+ * periodically redistributed between caches in proportion to how busy
+ * their magazines are, idle caches will have their magazines shrunk while
+ * busy caches may grow their magazines up to their default size.
+ */
+unsigned long spl_kmem_cache_magazine_limit = 0;
+EXPORT_SYMBOL(spl_kmem_cache_magazine_limit);
+module_param(spl_kmem_cache_magazine_limit, ulong, 0644);
+MODULE_PARM_DESC(spl_kmem_cache_magazine_limit,
+	"Limit in bytes for all magazines, 1/64 of memory (0)");
+
 /*
  * The default behavior is to report the number of objects remaining in the
  * cache.  This allows the Linux VM to repeatedly reclaim objects from the
@@ -101,6 +122,64 @@ unsigned int spl_kmem_cache_reclaim = 0 /* KMC_RECLAIM_ONCE */;
 module_param(spl_kmem_cache_reclaim, uint, 0644);
 MODULE_PARM_DESC(spl_kmem_cache_reclaim, "Single reclaim pass (0x1)");
 
+/*
+ * The background reaper periodically samples the amount of free memory.
+ * When free memory, extrapolated from its current rate of decline over
+ * the next SPL_KMEM_REAP_LOOKAHEAD intervals, is expected to fall below
+ * spl_kmem_reap_watermark percent of physical memory the reaper releases
+ * free slabs and runs the reclaim callbacks of caches until the expected
+ * shortfall has been covered.  This is intended to keep the caches small
+ * before the kernel shrinker is invoked from direct reclaim.  Each pass
+ * resumes with the cache following the last one reaped so no cache is
+ * favored.  The reaper is disabled by default since it may invoke the
+ * reclaim callbacks of consumers, set spl_kmem_reap_interval to enable it.
+ */
+unsigned int spl_kmem_reap_interval = 0;
+EXPORT_SYMBOL(spl_kmem_reap_interval);
+
+/*
+ * The reaper is only scheduled while enabled, setting a non-zero
+ * interval starts it.  When the interval is reset to zero the pending
+ * pass runs and is not rescheduled.
+ */
+static int
+#ifdef module_param_cb
+param_set_kmem_reap_interval(const char *val, const struct kernel_param *kp)
+#else
+param_set_kmem_reap_interval(const char *val, struct kernel_param *kp)
+#endif
+{
+	int ret;
+
+	ret = param_set_uint(val, kp);
+	if (ret < 0 || !spl_kmem_reap_interval)
+		return (ret);
+
+	spl_kmem_reap_schedule();
+
+	return (ret);
+}
+
+#ifdef module_param_cb
+static const struct kernel_param_ops param_ops_kmem_reap_interval = {
+	.set = param_set_kmem_reap_interval,
+	.get = param_get_uint,
+};
+module_param_cb(spl_kmem_reap_interval, &param_ops_kmem_reap_interval,
+	&spl_kmem_reap_interval, 0644);
+#else
+module_param_call(spl_kmem_reap_interval, param_set_kmem_reap_interval,
+	param_get_uint, &spl_kmem_reap_interval, 0644);
+#endif
+MODULE_PARM_DESC(spl_kmem_reap_interval,
+	"Milliseconds between background reaper passes, disabled (0)");
+
+unsigned int spl_kmem_reap_watermark = 10;
+EXPORT_SYMBOL(spl_kmem_reap_watermark);
+module_param(spl_kmem_reap_watermark, uint, 0644);
+MODULE_PARM_DESC(spl_kmem_reap_watermark,
+	"Percent of memory kept free by the background reaper");
+
 unsigned int spl_kmem_cache_obj_per_slab = SPL_KMEM_CACHE_OBJ_PER_SLAB;
 module_param(spl_kmem_cache_obj_per_slab, uint, 0644);
 MODULE_PARM_DESC(spl_kmem_cache_obj_per_slab, "Number of objects per slab");
@@ -129,6 +208,23 @@ module_param(spl_kmem_cache_slab_limit, uint, 0644);
 MODULE_PARM_DESC(spl_kmem_cache_slab_limit,
 	"Objects less than N bytes use the Linux slab");
 
+/*
+ * Caches which do not request a specific backend start on the backend
+ * selected by the object size but may later move between the SPL slab
+ * and the Linux slab.  A cache moves to the SPL slab, and its lockless
+ * per-cpu magazines, once it sustains more than twice this many
+ * allocations per second.  It moves back to the Linux slab when its rate
+ * drops below half this value while its SPL slabs are either empty or
+ * less than half used.  Only caches created while this value is non-zero
+ * may migrate.  It defaults to 0 which disables migration, the allocation
+ * rate of each cache is still reported.
+ */
+unsigned int spl_kmem_cache_auto_rate = 0;
+EXPORT_SYMBOL(spl_kmem_cache_auto_rate);
+module_param(spl_kmem_cache_auto_rate, uint, 0644);
+MODULE_PARM_DESC(spl_kmem_cache_auto_rate,
+	"Allocations per second moving a cache between backends, disabled (0)");
+
 /*
  * This value defaults to a threshold designed to avoid allocations which
  * have been deemed costly by the kernel.
@@ -140,6 +236,32 @@ module_param(spl_kmem_cache_kmem_limit, uint, 0644);
 MODULE_PARM_DESC(spl_kmem_cache_kmem_limit,
 	"Objects less than N bytes use the kmalloc");
 
+/*
+ * Slab coloring staggers the offset of the first object in consecutive
+ * slabs through the otherwise unused space at the end of each slab.  This
+ * prevents the same fields of objects in different slabs from always
+ * mapping to the same hardware cache sets.  It has no memory cost and
+ * only applies to caches whose objects are located on the slab.
+ */
+unsigned int spl_kmem_cache_color = 1;
+EXPORT_SYMBOL(spl_kmem_cache_color);
+module_param(spl_kmem_cache_color, uint, 0644);
+MODULE_PARM_DESC(spl_kmem_cache_color, "Stagger objects across slabs");
+
+/*
+ * Caches without a constructor, destructor, or reclaim callback which
+ * share an identical object size, alignment, and flags are transparently
+ * merged on to a single shared backing cache.  This consolidates their
+ * partial slabs and magazines which reduces fragmentation.  Each merged
+ * cache still tracks its own allocated object count which is reported
+ * beneath the backing cache in /proc/spl/kmem/slab.  Disabled by default
+ * since merged caches lose their own slab statistics and leak detection.
+ */
+unsigned int spl_kmem_cache_merge = 0;
+EXPORT_SYMBOL(spl_kmem_cache_merge);
+module_param(spl_kmem_cache_merge, uint, 0644);
+MODULE_PARM_DESC(spl_kmem_cache_merge, "Merge identically shaped caches");
+
 /*
  * The number of threads available to allocate new slabs for caches.  This
  * should not need to be tuned but it is available for performance analysis.
@@ -184,6 +306,21 @@ MODULE_PARM_DESC(spl_kmem_cache_kmem_threads,
 struct list_head spl_kmem_cache_list;   /* List of caches */
 struct rw_semaphore spl_kmem_cache_sem; /* Cache list lock */
 taskq_t *spl_kmem_cache_taskq;		/* Task queue for ageing / reclaim */
+static taskqid_t spl_magazine_balance_id;	/* Magazine rebalance task */
+static int spl_magazine_balance_stop;		/* Stop rebalancing */
+static DEFINE_MUTEX(spl_magazine_balance_lock);	/* Serialize rebalancing */
+static DEFINE_MUTEX(spl_kmem_reap_lock);	/* Reaper scheduling */
+static taskqid_t spl_kmem_reap_id;		/* Background reaper task */
+static int spl_kmem_reap_stop;			/* Stop the reaper */
+static unsigned long spl_kmem_reap_free;	/* Last free memory sample */
+static uint64_t spl_kmem_reap_stats[4];		/* Reaper statistics */
+static spl_kmem_cache_t *spl_kmem_reap_cursor;	/* Next cache to reap */
+static DEFINE_MUTEX(spl_kmem_cache_merge_lock); /* Merge create/destroy */
+
+#define	KMC_MERGE_NAMELEN	48	/* Backing cache name length */
+#define	SPL_MAGAZINE_INTERVAL	5	/* Seconds between rebalancing */
+#define	SPL_KMEM_AUTO_DWELL	30	/* Seconds between backend changes */
+#define	SPL_KMEM_REAP_LOOKAHEAD	4	/* Intervals to extrapolate */
 
 static void spl_cache_shrink(spl_kmem_cache_t *skc, void *obj);
 
@@ -275,6 +412,34 @@ spl_offslab_size(spl_kmem_cache_t *skc)
 	return (1UL << (fls64(spl_obj_size(skc)) + 1));
 }
 
+/*
+ * Distance between successive slab colors.  Objects must remain aligned
+ * and there is no benefit in moving them by less than a cache line.
+ */
+static inline uint32_t
+spl_color_size(spl_kmem_cache_t *skc)
+{
+	return (MAX(skc->skc_obj_align, L1_CACHE_BYTES));
+}
+
+/*
+ * Select the color for a new slab and advance to the next color.  This
+ * is only called when growing the cache which is serialized by the
+ * KMC_BIT_GROWING bit so no additional locking is required.
+ */
+static inline uint32_t
+spl_slab_color(spl_kmem_cache_t *skc)
+{
+	uint32_t color = skc->skc_slab_color;
+
+	if (skc->skc_slab_color + spl_color_size(skc) > skc->skc_slab_color_max)
+		skc->skc_slab_color = 0;
+	else
+		skc->skc_slab_color += spl_color_size(skc);
+
+	return (color);
+}
+
 /*
  * It's important that we pack the spl_kmem_obj_t structure and the
  * actual objects in to one large address space to minimize the number
@@ -305,6 +470,10 @@ spl_offslab_size(spl_kmem_cache_t *skc)
  * | spl_kmem_obj_t      |  |       | skc_obj_size    | <-+ |
  * | ...                 v  |       | spl_kmem_obj_t  |     |
  * +------------------------+       +-----------------+     v
+ *
+ * For KMC_ONSLAB caches the first object is placed after the slab header
+ * at an additional color offset which rotates through the unused space at
+ * the end of the slab, see spl_slab_color().
  */
 static spl_kmem_slab_t *
 spl_slab_alloc(spl_kmem_cache_t *skc, int flags)
@@ -312,7 +481,7 @@ spl_slab_alloc(spl_kmem_cache_t *skc, int flags)
 	spl_kmem_slab_t *sks;
 	spl_kmem_obj_t *sko, *n;
 	void *base, *obj;
-	uint32_t obj_size, offslab_size = 0;
+	uint32_t obj_size, offslab_size = 0, color = 0;
 	int i,  rc = 0;
 
 	base = kv_alloc(skc, skc->skc_slab_size, flags);
@@ -331,6 +500,8 @@ spl_slab_alloc(spl_kmem_cache_t *skc, int flags)
 
 	if (skc->skc_flags & KMC_OFFSLAB)
 		offslab_size = spl_offslab_size(skc);
+	else
+		color = spl_slab_color(skc);
 
 	for (i = 0; i < sks->sks_objs; i++) {
 		if (skc->skc_flags & KMC_OFFSLAB) {
@@ -340,7 +511,8 @@ spl_slab_alloc(spl_kmem_cache_t *skc, int flags)
 				goto out;
 			}
 		} else {
-			obj = base + spl_sks_size(skc) + (i * obj_size);
+			obj = base + spl_sks_size(skc) + color +
+			    (i * obj_size);
 		}
 
 		ASSERT(IS_P2ALIGNED(obj, skc->skc_obj_align));
@@ -398,34 +570,17 @@ spl_slab_free(spl_kmem_slab_t *sks,
 }
 
 /*
- * Reclaim empty slabs at the end of the partial list.
+ * Free the slabs and offslab objects on the private work lists built by
+ * spl_slab_reclaim() back to the system.
  */
 static void
-spl_slab_reclaim(spl_kmem_cache_t *skc)
+spl_slab_release(spl_kmem_cache_t *skc, struct list_head *sks_list,
+    struct list_head *sko_list)
 {
 	spl_kmem_slab_t *sks, *m;
 	spl_kmem_obj_t *sko, *n;
-	LIST_HEAD(sks_list);
-	LIST_HEAD(sko_list);
 	uint32_t size = 0;
 
-	/*
-	 * Empty slabs and objects must be moved to a private list so they
-	 * can be safely freed outside the spin lock.  All empty slabs are
-	 * at the end of skc->skc_partial_list, therefore once a non-empty
-	 * slab is found we can stop scanning.
-	 */
-	spin_lock(&skc->skc_lock);
-	list_for_each_entry_safe_reverse(sks, m,
-	    &skc->skc_partial_list, sks_list) {
-
-		if (sks->sks_ref > 0)
-			break;
-
-		spl_slab_free(sks, &sks_list, &sko_list);
-	}
-	spin_unlock(&skc->skc_lock);
-
 	/*
 	 * The following two loops ensure all the object destructors are
 	 * run, any offslab objects are freed, and the slabs themselves
@@ -437,19 +592,112 @@ spl_slab_reclaim(spl_kmem_cache_t *skc)
 	if (skc->skc_flags & KMC_OFFSLAB)
 		size = spl_offslab_size(skc);
 
-	list_for_each_entry_safe(sko, n, &sko_list, sko_list) {
+	list_for_each_entry_safe(sko, n, sko_list, sko_list) {
 		ASSERT(sko->sko_magic == SKO_MAGIC);
 
 		if (skc->skc_flags & KMC_OFFSLAB)
 			kv_free(skc, sko->sko_addr, size);
 	}
 
-	list_for_each_entry_safe(sks, m, &sks_list, sks_list) {
+	list_for_each_entry_safe(sks, m, sks_list, sks_list) {
 		ASSERT(sks->sks_magic == SKS_MAGIC);
 		kv_free(skc, sks, skc->skc_slab_size);
 	}
 }
 
+/*
+ * Free a slab once the RCU grace period has elapsed.  This runs from the
+ * taskq because vfree() may not be called from the RCU callback.  The
+ * slab must not be referenced after it is released, spl_kmem_cache_destroy()
+ * may free the cache as soon as this returns.
+ */
+static void
+spl_slab_release_work(void *data)
+{
+	spl_kmem_slab_t *sks = (spl_kmem_slab_t *)data;
+	spl_kmem_cache_t *skc = sks->sks_cache;
+	LIST_HEAD(sks_list);
+	LIST_HEAD(sko_list);
+
+	list_add(&sks->sks_list, &sks_list);
+	list_splice_init(&sks->sks_free_list, &sko_list);
+	spl_slab_release(skc, &sks_list, &sko_list);
+}
+
+static void
+spl_slab_release_cb(struct rcu_head *head)
+{
+	spl_kmem_slab_t *sks = container_of(head, spl_kmem_slab_t, sks_rcu);
+
+	taskq_init_ent(&sks->sks_tqe);
+	taskq_dispatch_ent(spl_kmem_cache_taskq,
+	    spl_slab_release_work, sks, TQ_NOSLEEP, &sks->sks_tqe);
+}
+
+/*
+ * KMC_TYPESAFE_BY_RCU caches may have lock-free readers which still
+ * reference objects in the reclaimed slabs.  Objects may be reused
+ * within the cache immediately, but the slab memory may not be returned
+ * to the system until after an RCU grace period.  The rcu_head and task
+ * entry needed to defer the free are embedded in each slab, so this never
+ * allocates or blocks and is safe from any context which may free.
+ */
+static void
+spl_slab_release_rcu(spl_kmem_cache_t *skc, struct list_head *sks_list,
+    struct list_head *sko_list)
+{
+	spl_kmem_slab_t *sks, *m;
+	spl_kmem_obj_t *sko, *n;
+
+	/* Return the free objects to the slabs which own them */
+	list_for_each_entry_safe(sko, n, sko_list, sko_list) {
+		ASSERT(sko->sko_magic == SKO_MAGIC);
+		list_move(&sko->sko_list, &sko->sko_slab->sks_free_list);
+	}
+
+	list_for_each_entry_safe(sks, m, sks_list, sks_list) {
+		ASSERT(sks->sks_magic == SKS_MAGIC);
+		list_del_init(&sks->sks_list);
+		call_rcu(&sks->sks_rcu, spl_slab_release_cb);
+	}
+}
+
+/*
+ * Reclaim empty slabs at the end of the partial list.
+ */
+static void
+spl_slab_reclaim(spl_kmem_cache_t *skc)
+{
+	spl_kmem_slab_t *sks, *m;
+	LIST_HEAD(sks_list);
+	LIST_HEAD(sko_list);
+
+	/*
+	 * Empty slabs and objects must be moved to a private list so they
+	 * can be safely freed outside the spin lock.  All empty slabs are
+	 * at the end of skc->skc_partial_list, therefore once a non-empty
+	 * slab is found we can stop scanning.
+	 */
+	spin_lock(&skc->skc_lock);
+	list_for_each_entry_safe_reverse(sks, m,
+	    &skc->skc_partial_list, sks_list) {
+
+		if (sks->sks_ref > 0)
+			break;
+
+		spl_slab_free(sks, &sks_list, &sko_list);
+	}
+	spin_unlock(&skc->skc_lock);
+
+	if (list_empty(&sks_list))
+		return;
+
+	if (skc->skc_flags & KMC_TYPESAFE_BY_RCU)
+		spl_slab_release_rcu(skc, &sks_list, &sko_list);
+	else
+		spl_slab_release(skc, &sks_list, &sko_list);
+}
+
 static spl_kmem_emergency_t *
 spl_emergency_search(struct rb_root *root, void *obj)
 {
@@ -720,6 +968,14 @@ spl_slab_size(spl_kmem_cache_t *skc, uint32_t *objs, uint32_t *size)
 			tgt_objs = (max_size - sks_size) / obj_size;
 			tgt_size = (tgt_objs * obj_size) + sks_size;
 		}
+
+		/*
+		 * Virtual slabs are always backed by whole pages, account
+		 * for the tail of the last page so it may be used for
+		 * slab coloring.
+		 */
+		if (!(skc->skc_flags & KMC_KMEM))
+			tgt_size = P2ROUNDUP(tgt_size, PAGE_SIZE);
 	}
 
 	if (tgt_objs == 0)
@@ -774,76 +1030,632 @@ spl_magazine_alloc(spl_kmem_cache_t *skc, int cpu)
 	if (skm) {
 		skm->skm_magic = SKM_MAGIC;
 		skm->skm_avail = 0;
-		skm->skm_size = skc->skc_mag_size;
-		skm->skm_refill = skc->skc_mag_refill;
+		skm->skm_size = skc->skc_mag_target;
+		skm->skm_refill = (skc->skc_mag_target + 1) / 2;
 		skm->skm_cache = skc;
 		skm->skm_age = jiffies;
 		skm->skm_cpu = cpu;
+		skm->skm_alloc = 0;
+	}
+
+	return (skm);
+}
+
+/*
+ * Free a per-cpu magazine associated with a specific core.
+ */
+static void
+spl_magazine_free(spl_kmem_magazine_t *skm)
+{
+	ASSERT(skm->skm_magic == SKM_MAGIC);
+	ASSERT(skm->skm_avail == 0);
+	kfree(skm);
+}
+
+/*
+ * Create per-cpu magazines of reasonable sizes for all online cpus.  The
+ * magazines for other cpus are created by spl_magazine_cpu_prepare() if
+ * they are brought online.  The caller must hold the cpu hotplug lock.
+ */
+static int
+spl_magazine_create(spl_kmem_cache_t *skc)
+{
+	int i;
+
+	if (skc->skc_flags & KMC_NOMAGAZINE)
+		return (0);
+
+	skc->skc_mag = kzalloc(sizeof (spl_kmem_magazine_t *) *
+	    nr_cpu_ids, kmem_flags_convert(KM_SLEEP));
+	if (skc->skc_mag == NULL)
+		return (-ENOMEM);
+
+	skc->skc_mag_size = spl_magazine_size(skc);
+	skc->skc_mag_refill = (skc->skc_mag_size + 1) / 2;
+	skc->skc_mag_target = skc->skc_mag_size;
+
+	for_each_online_cpu(i) {
+		skc->skc_mag[i] = spl_magazine_alloc(skc, i);
+		if (!skc->skc_mag[i]) {
+			for_each_possible_cpu(i) {
+				if (skc->skc_mag[i])
+					spl_magazine_free(skc->skc_mag[i]);
+			}
+
+			kfree(skc->skc_mag);
+			return (-ENOMEM);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Destroy all pre-cpu magazines.
+ */
+static void
+spl_magazine_destroy(spl_kmem_cache_t *skc)
+{
+	spl_kmem_magazine_t *skm;
+	int i;
+
+	if (skc->skc_flags & KMC_NOMAGAZINE)
+		return;
+
+	for_each_possible_cpu(i) {
+		skm = skc->skc_mag[i];
+		if (skm == NULL)
+			continue;
+
+		spl_cache_flush(skc, skm, skm->skm_avail);
+		spl_magazine_free(skm);
+	}
+
+	kfree(skc->skc_mag);
+}
+
+/*
+ * Called before a cpu is brought online to create its magazines.
+ */
+static int
+spl_magazine_cpu_prepare(unsigned int cpu)
+{
+	spl_kmem_cache_t *skc;
+	int rc = 0;
+
+	down_write(&spl_kmem_cache_sem);
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list) {
+		if ((skc->skc_flags & KMC_NOMAGAZINE) ||
+		    (skc->skc_mag[cpu] != NULL))
+			continue;
+
+		skc->skc_mag[cpu] = spl_magazine_alloc(skc, cpu);
+		if (skc->skc_mag[cpu] == NULL) {
+			rc = -ENOMEM;
+			break;
+		}
+	}
+	up_write(&spl_kmem_cache_sem);
+
+	return (rc);
+}
+
+/*
+ * Called once a cpu is offline to return the objects stranded in its
+ * magazines to the slabs and free the magazines.  The spl_kmem_cache_sem
+ * is taken as writer so no reader walking the per-cpu magazines under
+ * the read lock may still be referencing a magazine when it is freed.
+ */
+static int
+spl_magazine_cpu_dead(unsigned int cpu)
+{
+	spl_kmem_cache_t *skc;
+	spl_kmem_magazine_t *skm;
+
+	down_write(&spl_kmem_cache_sem);
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list) {
+		if (skc->skc_flags & KMC_NOMAGAZINE)
+			continue;
+
+		skm = skc->skc_mag[cpu];
+		if (skm == NULL)
+			continue;
+
+		skc->skc_mag[cpu] = NULL;
+		spl_cache_flush(skc, skm, skm->skm_avail);
+		spl_magazine_free(skm);
+		spl_slab_reclaim(skc);
+	}
+	up_write(&spl_kmem_cache_sem);
+
+	return (0);
+}
+
+#ifdef HAVE_CPUHP_SETUP_STATE
+static enum cpuhp_state spl_magazine_cpuhp_state;
+#else
+static int
+spl_magazine_cpu_callback(struct notifier_block *nb, unsigned long action,
+    void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+	int rc = 0;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_UP_PREPARE:
+		rc = spl_magazine_cpu_prepare(cpu);
+		break;
+	case CPU_UP_CANCELED:
+	case CPU_DEAD:
+		rc = spl_magazine_cpu_dead(cpu);
+		break;
+	}
+
+	return (rc ? NOTIFY_BAD : NOTIFY_OK);
+}
+
+static struct notifier_block spl_magazine_cpu_notifier = {
+	.notifier_call = spl_magazine_cpu_callback,
+};
+#endif /* HAVE_CPUHP_SETUP_STATE */
+
+/*
+ * Apply a new magazine size to the local cpu magazine.  Objects in excess
+ * of the new size are returned to their slabs first.  The magazine size
+ * is left unchanged if the cache lock is contended, it will be retried
+ * the next time the magazines are rebalanced.
+ */
+static void
+spl_magazine_resize(void *data)
+{
+	spl_kmem_cache_t *skc = (spl_kmem_cache_t *)data;
+	spl_kmem_magazine_t *skm = skc->skc_mag[smp_processor_id()];
+	uint32_t size = skc->skc_mag_target;
+
+	ASSERT(skm->skm_magic == SKM_MAGIC);
+	ASSERT(irqs_disabled());
+	ASSERT3U(size, <=, skc->skc_mag_size);
+
+	if (skm->skm_avail > size) {
+		if (!spin_trylock(&skc->skc_lock))
+			return;
+
+		__spl_cache_flush(skc, skm, skm->skm_avail - size);
+		spin_unlock(&skc->skc_lock);
+	}
+
+	skm->skm_size = size;
+	skm->skm_refill = (size + 1) / 2;
+}
+
+/*
+ * Return all objects in the local cpu magazine to their slabs.  As with
+ * spl_magazine_resize() a contended cache lock leaves objects in the
+ * magazine, the caller is responsible for flushing them.
+ */
+static void
+spl_magazine_drain(void *data)
+{
+	spl_kmem_cache_t *skc = (spl_kmem_cache_t *)data;
+	spl_kmem_magazine_t *skm = skc->skc_mag[smp_processor_id()];
+
+	ASSERT(skm->skm_magic == SKM_MAGIC);
+	ASSERT(irqs_disabled());
+
+	if (skm->skm_avail == 0 || !spin_trylock(&skc->skc_lock))
+		return;
+
+	__spl_cache_flush(skc, skm, skm->skm_avail);
+	spin_unlock(&skc->skc_lock);
+}
+
+/*
+ * Number of objects currently allocated from the Linux slab.
+ */
+unsigned long
+spl_kmem_cache_linux_alloc(spl_kmem_cache_t *skc)
+{
+	return (atomic_long_read(&skc->skc_linux_alloc) -
+	    atomic_long_read(&skc->skc_linux_free));
+}
+EXPORT_SYMBOL(spl_kmem_cache_linux_alloc);
+
+const char *
+spl_kmem_cache_reason(spl_kmem_cache_t *skc)
+{
+	switch (skc->skc_auto_reason) {
+	case KMC_REASON_FLAGS:
+		return ("flags");
+	case KMC_REASON_SIZE:
+		return ("size");
+	case KMC_REASON_MERGE:
+		return ("merge");
+	case KMC_REASON_RATE:
+		return ("rate");
+	case KMC_REASON_IDLE:
+		return ("idle");
+	case KMC_REASON_FRAG:
+		return ("frag");
+	}
+
+	return ("-");
+}
+EXPORT_SYMBOL(spl_kmem_cache_reason);
+
+/*
+ * Sample the allocation rate of a cache and, for KMC_AUTO caches, select
+ * the backend used for future allocations.  A KMC_AUTO cache always has
+ * both an SPL slab with magazines and a Linux slab, objects are freed to
+ * whichever backend they were allocated from.  Therefore switching only
+ * redirects allocations and the previous backend drains as its objects
+ * are freed.  Called from spl_magazine_balance() every interval seconds.
+ */
+static void
+spl_kmem_cache_select(spl_kmem_cache_t *skc, unsigned int interval)
+{
+	spl_kmem_magazine_t *skm;
+	uint64_t allocs, cached = 0, rate, obj_alloc, obj_total;
+	unsigned int auto_rate = ACCESS_ONCE(spl_kmem_cache_auto_rate);
+	kmem_reason_t reason;
+	int i;
+
+	allocs = atomic_long_read(&skc->skc_linux_alloc);
+	if (!(skc->skc_flags & KMC_NOMAGAZINE)) {
+		for_each_possible_cpu(i) {
+			skm = ACCESS_ONCE(skc->skc_mag[i]);
+			if (skm != NULL) {
+				allocs += ACCESS_ONCE(skm->skm_alloc);
+				cached += ACCESS_ONCE(skm->skm_avail);
+			}
+		}
+	}
+
+	/* Counts are lost when a cpu's magazine is freed */
+	rate = 0;
+	if (allocs > skc->skc_auto_allocs)
+		rate = div64_u64(allocs - skc->skc_auto_allocs, interval);
+
+	skc->skc_auto_allocs = allocs;
+	skc->skc_auto_rate = rate;
+
+	if (!(skc->skc_flags & KMC_AUTO) || auto_rate == 0)
+		return;
+
+	if (skc->skc_auto_migrations > 0 && time_before(jiffies,
+	    skc->skc_auto_time + SPL_KMEM_AUTO_DWELL * HZ))
+		return;
+
+	if (skc->skc_flags & KMC_SLAB) {
+		if (rate <= 2 * (uint64_t)auto_rate)
+			return;
+
+		clear_bit(KMC_BIT_SLAB, &skc->skc_flags);
+		reason = KMC_REASON_RATE;
+	} else {
+		if (rate >= auto_rate / 2)
+			return;
+
+		spin_lock(&skc->skc_lock);
+		obj_alloc = skc->skc_obj_alloc;
+		obj_total = skc->skc_obj_total;
+		spin_unlock(&skc->skc_lock);
+
+		/* Objects cached in magazines are not in use */
+		obj_alloc -= MIN(obj_alloc, cached);
+
+		if (obj_alloc == 0)
+			reason = KMC_REASON_IDLE;
+		else if (obj_alloc * 2 < obj_total)
+			reason = KMC_REASON_FRAG;
+		else
+			return;
+
+		/*
+		 * Allocations and frees check the backend with interrupts
+		 * disabled so once the drain has run on every cpu no object
+		 * is added to or removed from a magazine.  A drain leaves
+		 * objects behind when the cache lock is contended, those
+		 * magazines are no longer in use and are flushed here.  The
+		 * spl_kmem_cache_sem held by the caller keeps them from
+		 * being freed by a cpu going offline.
+		 */
+		set_bit(KMC_BIT_SLAB, &skc->skc_flags);
+		if (!(skc->skc_flags & KMC_NOMAGAZINE)) {
+			on_each_cpu(spl_magazine_drain, skc, 1);
+			for_each_possible_cpu(i) {
+				skm = skc->skc_mag[i];
+				if (skm != NULL)
+					spl_cache_flush(skc, skm,
+					    skm->skm_size);
+			}
+		}
+		spl_slab_reclaim(skc);
+	}
+
+	skc->skc_auto_reason = reason;
+	skc->skc_auto_time = jiffies;
+	skc->skc_auto_migrations++;
+}
+
+static uint64_t
+spl_magazine_limit(void)
+{
+	if (spl_kmem_cache_magazine_limit > 0)
+		return (spl_kmem_cache_magazine_limit);
+
+	return (((uint64_t)physmem * PAGE_SIZE) / 64);
+}
+
+/*
+ * Memory currently held by the magazines of a cache.  The per-cpu counts
+ * are read without synchronization so the result is approximate.  The
+ * caller must hold the spl_kmem_cache_sem to keep the magazines from
+ * being freed by a cpu going offline.
+ */
+uint64_t
+spl_kmem_cache_magazine_bytes(spl_kmem_cache_t *skc)
+{
+	uint64_t objs = 0;
+	int i;
+
+	if (skc->skc_flags & KMC_NOMAGAZINE)
+		return (0);
+
+	for_each_possible_cpu(i) {
+		spl_kmem_magazine_t *skm = ACCESS_ONCE(skc->skc_mag[i]);
+
+		if (skm != NULL)
+			objs += ACCESS_ONCE(skm->skm_avail);
+	}
+
+	return (objs * skc->skc_obj_size);
+}
+EXPORT_SYMBOL(spl_kmem_cache_magazine_bytes);
+
+/*
+ * Memory currently held by all magazines and the budget for it.  The
+ * caller must hold the spl_kmem_cache_sem.
+ */
+uint64_t
+spl_kmem_cache_magazine_total(uint64_t *limit)
+{
+	spl_kmem_cache_t *skc;
+	uint64_t total = 0;
+
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list)
+		total += spl_kmem_cache_magazine_bytes(skc);
+
+	if (limit != NULL)
+		*limit = spl_magazine_limit();
+
+	return (total);
+}
+EXPORT_SYMBOL(spl_kmem_cache_magazine_total);
+
+/*
+ * Size the magazines of all caches to fit in the global budget.  When
+ * the default magazine sizes of all caches fit they are used unchanged.
+ * Otherwise the budget is divided between the caches weighted by the
+ * number of magazine misses, refills from and overflows to the slabs,
+ * each cache incurred since the last pass.  A cache's share is converted
+ * in to a per-cpu magazine size which is bounded by SPL_MAGAZINE_MIN and
+ * the cache's default magazine size.  This is done periodically by
+ * spl_magazine_balance() and may be called to apply a new budget at once.
+ */
+void
+spl_kmem_cache_magazine_balance(void)
+{
+	spl_kmem_cache_t *skc;
+	uint64_t limit = spl_magazine_limit(), want = 0, weight = 0, share;
+	uint32_t size, ncpus;
+
+	mutex_lock(&spl_magazine_balance_lock);
+
+	/*
+	 * Magazines only exist for online cpus.  The count may briefly
+	 * disagree while a cpu is changing state, which only affects the
+	 * sizes chosen for this pass.
+	 */
+	down_read(&spl_kmem_cache_sem);
+	ncpus = num_online_cpus();
+
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list) {
+		if (skc->skc_flags & KMC_NOMAGAZINE)
+			continue;
+
+		spin_lock(&skc->skc_lock);
+		skc->skc_mag_weight = skc->skc_mag_miss -
+		    skc->skc_mag_miss_last + 1;
+		skc->skc_mag_miss_last = skc->skc_mag_miss;
+		spin_unlock(&skc->skc_lock);
+
+		want += (uint64_t)skc->skc_mag_size * ncpus *
+		    spl_obj_size(skc);
+		weight += skc->skc_mag_weight;
+	}
+
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list) {
+		if (skc->skc_flags & KMC_NOMAGAZINE)
+			continue;
+
+		if (want <= limit) {
+			size = skc->skc_mag_size;
+		} else {
+			share = div64_u64(limit, weight) * skc->skc_mag_weight;
+			share = div64_u64(share, (uint64_t)ncpus *
+			    spl_obj_size(skc));
+			size = MAX(MIN(share, skc->skc_mag_size),
+			    MIN(SPL_MAGAZINE_MIN, skc->skc_mag_size));
+		}
+
+		if (size == skc->skc_mag_target)
+			continue;
+
+		atomic_inc(&skc->skc_ref);
+		skc->skc_mag_target = size;
+		on_each_cpu(spl_magazine_resize, skc, 1);
+		spl_slab_reclaim(skc);
+		atomic_dec(&skc->skc_ref);
 	}
 
-	return (skm);
+	up_read(&spl_kmem_cache_sem);
+	mutex_unlock(&spl_magazine_balance_lock);
 }
+EXPORT_SYMBOL(spl_kmem_cache_magazine_balance);
 
 /*
- * Free a per-cpu magazine associated with a specific core.
+ * Periodically select the backend of KMC_AUTO caches and rebalance the
+ * magazines of all caches.
  */
 static void
-spl_magazine_free(spl_kmem_magazine_t *skm)
+spl_magazine_balance(void *arg)
 {
-	ASSERT(skm->skm_magic == SKM_MAGIC);
-	ASSERT(skm->skm_avail == 0);
-	kfree(skm);
+	spl_kmem_cache_t *skc;
+	taskqid_t id = 0;
+
+	down_read(&spl_kmem_cache_sem);
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list)
+		spl_kmem_cache_select(skc, SPL_MAGAZINE_INTERVAL);
+	up_read(&spl_kmem_cache_sem);
+
+	spl_kmem_cache_magazine_balance();
+
+	while (!ACCESS_ONCE(spl_magazine_balance_stop) && !id) {
+		id = taskq_dispatch_delay(spl_kmem_cache_taskq,
+		    spl_magazine_balance, NULL, TQ_SLEEP,
+		    ddi_get_lbolt() + SPL_MAGAZINE_INTERVAL * HZ);
+	}
+
+	spl_magazine_balance_id = id;
 }
 
 /*
- * Create all pre-cpu magazines of reasonable sizes.
+ * Determine if a new cache may be merged with other identically shaped
+ * caches.  Caches which will be backed by the Linux slab are excluded
+ * because the Linux slab already performs its own cache merging.  The
+ * KMC_TYPESAFE_BY_RCU caches are excluded because their objects may only
+ * ever be reused as objects of the same type.
  */
 static int
-spl_magazine_create(spl_kmem_cache_t *skc)
+spl_kmem_cache_mergeable(size_t size, spl_kmem_ctor_t ctor,
+    spl_kmem_dtor_t dtor, spl_kmem_reclaim_t reclaim, int flags)
 {
-	int i;
+	if (!spl_kmem_cache_merge)
+		return (0);
 
-	if (skc->skc_flags & KMC_NOMAGAZINE)
+	if (ctor || dtor || reclaim)
 		return (0);
 
-	skc->skc_mag = kzalloc(sizeof (spl_kmem_magazine_t *) *
-	    num_possible_cpus(), kmem_flags_convert(KM_SLEEP));
-	skc->skc_mag_size = spl_magazine_size(skc);
-	skc->skc_mag_refill = (skc->skc_mag_size + 1) / 2;
+	if (flags & (KMC_SLAB | KMC_OFFSLAB | KMC_MERGE | KMC_TYPESAFE_BY_RCU))
+		return (0);
 
-	for_each_possible_cpu(i) {
-		skc->skc_mag[i] = spl_magazine_alloc(skc, i);
-		if (!skc->skc_mag[i]) {
-			for (i--; i >= 0; i--)
-				spl_magazine_free(skc->skc_mag[i]);
+	if (!(flags & (KMC_KMEM | KMC_VMEM)) && spl_kmem_cache_slab_limit &&
+	    size <= (size_t)spl_kmem_cache_slab_limit)
+		return (0);
 
-			kfree(skc->skc_mag);
-			return (-ENOMEM);
+	return (1);
+}
+
+/*
+ * Create a merged cache which is an alias for a shared backing cache.
+ * The backing cache is located by a name which encodes its shape and is
+ * created on demand.  It is destroyed along with its last merged cache.
+ */
+static spl_kmem_cache_t *
+spl_kmem_cache_merge_create(char *name, size_t size, size_t align, int flags)
+{
+	spl_kmem_cache_t *skc, *backing = NULL, *tmp;
+	char backing_name[KMC_MERGE_NAMELEN];
+
+	skc = kzalloc(sizeof (*skc), kmem_flags_convert(KM_SLEEP));
+	if (skc == NULL)
+		return (NULL);
+
+	skc->skc_name_size = strlen(name) + 1;
+	skc->skc_name = kmalloc(skc->skc_name_size,
+	    kmem_flags_convert(KM_SLEEP));
+	if (skc->skc_name == NULL) {
+		kfree(skc);
+		return (NULL);
+	}
+	strncpy(skc->skc_name, name, skc->skc_name_size);
+
+	snprintf(backing_name, sizeof (backing_name), "spl_merge_%lu_%lu_%x",
+	    (unsigned long)size, (unsigned long)align, flags);
+
+	mutex_lock(&spl_kmem_cache_merge_lock);
+
+	down_read(&spl_kmem_cache_sem);
+	list_for_each_entry(tmp, &spl_kmem_cache_list, skc_list) {
+		if ((tmp->skc_flags & KMC_MERGE) &&
+		    strcmp(tmp->skc_name, backing_name) == 0) {
+			backing = tmp;
+			break;
 		}
 	}
+	up_read(&spl_kmem_cache_sem);
 
-	return (0);
+	if (backing == NULL) {
+		backing = spl_kmem_cache_create(backing_name, size, align,
+		    NULL, NULL, NULL, NULL, NULL, flags | KMC_MERGE);
+		if (backing == NULL) {
+			mutex_unlock(&spl_kmem_cache_merge_lock);
+			kfree(skc->skc_name);
+			kfree(skc);
+			return (NULL);
+		}
+	}
+
+	skc->skc_magic = SKC_MAGIC;
+	skc->skc_merge = backing;
+	skc->skc_flags = backing->skc_flags & ~KMC_MERGE;
+	skc->skc_auto_reason = KMC_REASON_MERGE;
+	skc->skc_obj_size = backing->skc_obj_size;
+	skc->skc_obj_align = backing->skc_obj_align;
+	skc->skc_reap = SPL_KMEM_CACHE_REAP;
+	atomic_set(&skc->skc_ref, 0);
+	atomic_long_set(&skc->skc_merge_alloc, 0);
+	INIT_LIST_HEAD(&skc->skc_list);
+	INIT_LIST_HEAD(&skc->skc_complete_list);
+	INIT_LIST_HEAD(&skc->skc_partial_list);
+	skc->skc_emergency_tree = RB_ROOT;
+	spin_lock_init(&skc->skc_lock);
+	init_waitqueue_head(&skc->skc_waitq);
+
+	spin_lock(&backing->skc_lock);
+	list_add_tail(&skc->skc_merge_list, &backing->skc_merge_list);
+	spin_unlock(&backing->skc_lock);
+
+	mutex_unlock(&spl_kmem_cache_merge_lock);
+
+	return (skc);
 }
 
 /*
- * Destroy all pre-cpu magazines.
+ * Destroy a merged cache, and its backing cache when no longer shared.
  */
 static void
-spl_magazine_destroy(spl_kmem_cache_t *skc)
+spl_kmem_cache_merge_destroy(spl_kmem_cache_t *skc)
 {
-	spl_kmem_magazine_t *skm;
-	int i;
+	spl_kmem_cache_t *backing = skc->skc_merge;
+	int empty;
 
-	if (skc->skc_flags & KMC_NOMAGAZINE)
-		return;
+	ASSERT3S(atomic_long_read(&skc->skc_merge_alloc), ==, 0);
 
-	for_each_possible_cpu(i) {
-		skm = skc->skc_mag[i];
-		spl_cache_flush(skc, skm, skm->skm_avail);
-		spl_magazine_free(skm);
-	}
+	mutex_lock(&spl_kmem_cache_merge_lock);
 
-	kfree(skc->skc_mag);
+	spin_lock(&backing->skc_lock);
+	list_del_init(&skc->skc_merge_list);
+	empty = list_empty(&backing->skc_merge_list);
+	spin_unlock(&backing->skc_lock);
+
+	if (empty)
+		spl_kmem_cache_destroy(backing);
+
+	mutex_unlock(&spl_kmem_cache_merge_lock);
+
+	kfree(skc->skc_name);
+	kfree(skc);
 }
 
 /*
@@ -866,6 +1678,14 @@ spl_magazine_destroy(spl_kmem_cache_t *skc)
  *	KMC_VMEM        Force vmem backed cache
  *	KMC_SLAB        Force Linux slab backed cache
  *	KMC_OFFSLAB	Locate objects off the slab
+ *	KMC_TYPESAFE_BY_RCU	Defer freeing slabs until an RCU grace period
+ *			has elapsed.  Objects may be reused immediately
+ *			but their memory remains of the same type, see
+ *			SLAB_TYPESAFE_BY_RCU.  A ctor and dtor may not be
+ *			given since they run on every alloc and free, and
+ *			lock-free readers would observe the object while it
+ *			is being constructed or destroyed.  Callers must
+ *			initialize any state readers depend on themselves.
  */
 spl_kmem_cache_t *
 spl_kmem_cache_create(char *name, size_t size, size_t align,
@@ -884,8 +1704,20 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 	ASSERT0(flags & KMC_QCACHE);
 	ASSERT(vmp == NULL);
 
+	/*
+	 * Type stable objects may not be constructed per allocation.
+	 */
+	VERIFY(!(flags & KMC_TYPESAFE_BY_RCU) ||
+	    (ctor == NULL && dtor == NULL));
+
 	might_sleep();
 
+	if (spl_kmem_cache_mergeable(size, ctor, dtor, reclaim, flags)) {
+		skc = spl_kmem_cache_merge_create(name, size, align, flags);
+		if (skc != NULL)
+			return (skc);
+	}
+
 	skc = kzalloc(sizeof (*skc), lflags);
 	if (skc == NULL)
 		return (NULL);
@@ -930,6 +1762,23 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 	skc->skc_obj_deadlock = 0;
 	skc->skc_obj_emergency = 0;
 	skc->skc_obj_emergency_max = 0;
+	skc->skc_slab_color = 0;
+	skc->skc_slab_color_max = 0;
+	skc->skc_merge = NULL;
+	INIT_LIST_HEAD(&skc->skc_merge_list);
+	atomic_long_set(&skc->skc_merge_alloc, 0);
+	atomic_long_set(&skc->skc_linux_alloc, 0);
+	atomic_long_set(&skc->skc_linux_free, 0);
+	skc->skc_linux_max = 0;
+	skc->skc_auto_allocs = 0;
+	skc->skc_auto_rate = 0;
+	skc->skc_auto_migrations = 0;
+	skc->skc_auto_time = jiffies;
+	skc->skc_auto_reason = KMC_REASON_FLAGS;
+	skc->skc_mag_target = 0;
+	skc->skc_mag_miss = 0;
+	skc->skc_mag_miss_last = 0;
+	skc->skc_mag_weight = 0;
 
 	/*
 	 * Verify the requested alignment restriction is sane.
@@ -947,6 +1796,7 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 	 * and default tunables.
 	 */
 	if (!(skc->skc_flags & (KMC_KMEM | KMC_VMEM | KMC_SLAB))) {
+		skc->skc_auto_reason = KMC_REASON_SIZE;
 
 		/*
 		 * Objects smaller than spl_kmem_cache_slab_limit can
@@ -971,6 +1821,25 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 		 */
 		else
 			skc->skc_flags |= KMC_VMEM;
+
+		/*
+		 * Objects which fit on kmem slabs and in the Linux slab may
+		 * have their backend changed at runtime, these caches are
+		 * created with both backends.  KMC_KMEM remains set and
+		 * KMC_SLAB indicates the Linux slab is currently used for
+		 * allocations.  See spl_kmem_cache_select().
+		 */
+		if (spl_kmem_cache_auto_rate &&
+		    !(skc->skc_flags & (KMC_VMEM | KMC_OFFSLAB | KMC_MERGE |
+		    KMC_TYPESAFE_BY_RCU)) &&
+		    size <= (SPL_MAX_KMEM_ORDER_NR_PAGES * PAGE_SIZE)) {
+			skc->skc_flags |= KMC_KMEM;
+			if (spl_slab_size(skc, &skc->skc_slab_objs,
+			    &skc->skc_slab_size) == 0)
+				skc->skc_flags |= KMC_AUTO;
+			else if (skc->skc_flags & KMC_SLAB)
+				skc->skc_flags &= ~KMC_KMEM;
+		}
 	}
 
 	/*
@@ -982,10 +1851,17 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 		if (rc)
 			goto out;
 
-		rc = spl_magazine_create(skc);
-		if (rc)
-			goto out;
-	} else {
+		/*
+		 * The maximum color is the unused space at the end of an
+		 * on-slab slab rounded down to the color size.
+		 */
+		if (!(skc->skc_flags & KMC_OFFSLAB) && spl_kmem_cache_color)
+			skc->skc_slab_color_max = P2ALIGN(skc->skc_slab_size -
+			    spl_sks_size(skc) - skc->skc_slab_objs *
+			    spl_obj_size(skc), spl_color_size(skc));
+	}
+
+	if (skc->skc_flags & (KMC_SLAB | KMC_AUTO)) {
 		unsigned long slabflags = 0;
 
 		if (size > (SPL_MAX_KMEM_ORDER_NR_PAGES * PAGE_SIZE)) {
@@ -1001,6 +1877,14 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 		slabflags |= SLAB_USERCOPY;
 #endif
 
+		if (skc->skc_flags & KMC_TYPESAFE_BY_RCU) {
+#if defined(SLAB_TYPESAFE_BY_RCU)
+			slabflags |= SLAB_TYPESAFE_BY_RCU;
+#else
+			slabflags |= SLAB_DESTROY_BY_RCU;
+#endif
+		}
+
 		skc->skc_linux_cache = kmem_cache_create(
 		    skc->skc_name, size, align, slabflags, NULL);
 		if (skc->skc_linux_cache == NULL) {
@@ -1013,7 +1897,19 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 #elif defined(HAVE_KMEM_CACHE_GFPFLAGS)
 		skc->skc_linux_cache->gfpflags |= __GFP_COMP;
 #endif
-		skc->skc_flags |= KMC_NOMAGAZINE;
+		if (!(skc->skc_flags & KMC_AUTO))
+			skc->skc_flags |= KMC_NOMAGAZINE;
+	}
+
+	/*
+	 * Hold off cpu hotplug until the cache is visible to the hotplug
+	 * callbacks so no online cpu is left without a magazine.
+	 */
+	cpus_read_lock();
+	rc = spl_magazine_create(skc);
+	if (rc) {
+		cpus_read_unlock();
+		goto out;
 	}
 
 	if (spl_kmem_cache_expire & KMC_EXPIRE_AGE)
@@ -1024,9 +1920,13 @@ spl_kmem_cache_create(char *name, size_t size, size_t align,
 	down_write(&spl_kmem_cache_sem);
 	list_add_tail(&skc->skc_list, &spl_kmem_cache_list);
 	up_write(&spl_kmem_cache_sem);
+	cpus_read_unlock();
 
 	return (skc);
 out:
+	if (skc->skc_linux_cache != NULL)
+		kmem_cache_destroy(skc->skc_linux_cache);
+
 	kfree(skc->skc_name);
 	kfree(skc);
 	return (NULL);
@@ -1057,7 +1957,14 @@ spl_kmem_cache_destroy(spl_kmem_cache_t *skc)
 	ASSERT(skc->skc_magic == SKC_MAGIC);
 	ASSERT(skc->skc_flags & (KMC_KMEM | KMC_VMEM | KMC_SLAB));
 
+	if (skc->skc_merge != NULL) {
+		spl_kmem_cache_merge_destroy(skc);
+		return;
+	}
+
 	down_write(&spl_kmem_cache_sem);
+	if (spl_kmem_reap_cursor == skc)
+		spl_kmem_reap_cursor = NULL;
 	list_del_init(&skc->skc_list);
 	up_write(&spl_kmem_cache_sem);
 
@@ -1080,8 +1987,22 @@ spl_kmem_cache_destroy(spl_kmem_cache_t *skc)
 	if (skc->skc_flags & (KMC_KMEM | KMC_VMEM)) {
 		spl_magazine_destroy(skc);
 		spl_slab_reclaim(skc);
-	} else {
-		ASSERT(skc->skc_flags & KMC_SLAB);
+
+		/*
+		 * Wait for slab frees deferred by KMC_TYPESAFE_BY_RCU.  Once
+		 * the callbacks have run every release task has been
+		 * dispatched, flushing the taskq waits for them to finish.
+		 * This may also wait on unrelated delayed tasks which were
+		 * dispatched earlier.
+		 */
+		if (skc->skc_flags & KMC_TYPESAFE_BY_RCU) {
+			rcu_barrier();
+			taskq_wait_outstanding(spl_kmem_cache_taskq, 0);
+		}
+	}
+
+	if (skc->skc_linux_cache != NULL) {
+		ASSERT(skc->skc_flags & (KMC_SLAB | KMC_AUTO));
 		kmem_cache_destroy(skc->skc_linux_cache);
 	}
 
@@ -1204,7 +2125,7 @@ spl_cache_grow(spl_kmem_cache_t *skc, int flags, void **obj)
 
 	ASSERT0(flags & ~KM_PUBLIC_MASK);
 	ASSERT(skc->skc_magic == SKC_MAGIC);
-	ASSERT((skc->skc_flags & KMC_SLAB) == 0);
+	ASSERT((skc->skc_flags & (KMC_SLAB | KMC_AUTO)) != KMC_SLAB);
 	might_sleep();
 	*obj = NULL;
 
@@ -1251,8 +2172,11 @@ spl_cache_grow(spl_kmem_cache_t *skc, int flags, void **obj)
 	 * the timeout is reached the cache is flagged as deadlocked.  From
 	 * this point only new emergency objects will be allocated until the
 	 * asynchronous allocation completes and clears the deadlocked flag.
+	 * Emergency objects are freed immediately so they are never used
+	 * for KMC_TYPESAFE_BY_RCU caches.
 	 */
-	if (test_bit(KMC_BIT_DEADLOCKED, &skc->skc_flags)) {
+	if (test_bit(KMC_BIT_DEADLOCKED, &skc->skc_flags) &&
+	    !(skc->skc_flags & KMC_TYPESAFE_BY_RCU)) {
 		rc = spl_emergency_alloc(skc, flags, obj);
 	} else {
 		remaining = wait_event_timeout(skc->skc_waitq,
@@ -1292,6 +2216,7 @@ spl_cache_refill(spl_kmem_cache_t *skc, spl_kmem_magazine_t *skm, int flags)
 
 	refill = MIN(skm->skm_refill, skm->skm_size - skm->skm_avail);
 	spin_lock(&skc->skc_lock);
+	skc->skc_mag_miss++;
 
 	while (refill > 0) {
 		/* No slabs available we may need to grow the cache */
@@ -1313,6 +2238,10 @@ spl_cache_refill(spl_kmem_cache_t *skc, spl_kmem_magazine_t *skm, int flags)
 			if (skm != skc->skc_mag[smp_processor_id()])
 				goto out;
 
+			/* Switched to the Linux slab, the magazine is drained */
+			if (unlikely(skc->skc_flags & KMC_SLAB))
+				goto out;
+
 			/*
 			 * Potentially rescheduled to the same CPU but
 			 * allocations may have occurred from this CPU while
@@ -1399,6 +2328,32 @@ spl_cache_shrink(spl_kmem_cache_t *skc, void *obj)
 	}
 }
 
+/*
+ * Allocate directly from a Linux slab.  All optimizations are left
+ * to the underlying cache we only need to guarantee that KM_SLEEP
+ * callers will never fail.
+ */
+static void *
+spl_cache_alloc_linux(spl_kmem_cache_t *skc, int flags)
+{
+	struct kmem_cache *slc = skc->skc_linux_cache;
+	unsigned long alloc;
+	void *obj;
+
+	do {
+		obj = kmem_cache_alloc(slc, kmem_flags_convert(flags));
+	} while ((obj == NULL) && !(flags & KM_NOSLEEP));
+
+	if (obj) {
+		atomic_long_inc(&skc->skc_linux_alloc);
+		alloc = spl_kmem_cache_linux_alloc(skc);
+		if (alloc > ACCESS_ONCE(skc->skc_linux_max))
+			skc->skc_linux_max = alloc;
+	}
+
+	return (obj);
+}
+
 /*
  * Allocate an object from the per-cpu magazine, or if the magazine
  * is empty directly allocate from a slab and repopulate the magazine.
@@ -1414,22 +2369,37 @@ spl_kmem_cache_alloc(spl_kmem_cache_t *skc, int flags)
 	ASSERT(!test_bit(KMC_BIT_DESTROY, &skc->skc_flags));
 
 	/*
-	 * Allocate directly from a Linux slab.  All optimizations are left
-	 * to the underlying cache we only need to guarantee that KM_SLEEP
-	 * callers will never fail.
+	 * Merged caches allocate from their shared backing cache.
 	 */
-	if (skc->skc_flags & KMC_SLAB) {
-		struct kmem_cache *slc = skc->skc_linux_cache;
-		do {
-			obj = kmem_cache_alloc(slc, kmem_flags_convert(flags));
-		} while ((obj == NULL) && !(flags & KM_NOSLEEP));
+	if (skc->skc_merge != NULL) {
+		obj = spl_kmem_cache_alloc(skc->skc_merge, flags);
+		if (obj)
+			atomic_long_inc(&skc->skc_merge_alloc);
 
+		return (obj);
+	}
+
+	if (skc->skc_flags & KMC_SLAB) {
+		obj = spl_cache_alloc_linux(skc, flags);
 		goto ret;
 	}
 
 	local_irq_disable();
 
 restart:
+	/*
+	 * A KMC_AUTO cache may have switched to the Linux slab since it was
+	 * last checked.  The magazines are drained after the switch by an
+	 * IPI which cannot run on this cpu while interrupts are disabled,
+	 * so checking again here ensures no object is added to a magazine
+	 * once it has been drained.
+	 */
+	if (unlikely(skc->skc_flags & KMC_SLAB)) {
+		local_irq_enable();
+		obj = spl_cache_alloc_linux(skc, flags);
+		goto ret;
+	}
+
 	/*
 	 * Safe to update per-cpu structure without lock, but
 	 * in the restart case we must be careful to reacquire
@@ -1443,11 +2413,15 @@ restart:
 		/* Object available in CPU cache, use it */
 		obj = skm->skm_objs[--skm->skm_avail];
 		skm->skm_age = jiffies;
+		skm->skm_alloc++;
 	} else {
 		obj = spl_cache_refill(skc, skm, flags);
 		if ((obj == NULL) && !(flags & KM_NOSLEEP))
 			goto restart;
 
+		if (obj)
+			skc->skc_mag[smp_processor_id()]->skm_alloc++;
+
 		local_irq_enable();
 		goto ret;
 	}
@@ -1486,6 +2460,15 @@ spl_kmem_cache_free(spl_kmem_cache_t *skc, void *obj)
 	ASSERT(skc->skc_magic == SKC_MAGIC);
 	ASSERT(!test_bit(KMC_BIT_DESTROY, &skc->skc_flags));
 
+	/*
+	 * Merged caches return objects to their shared backing cache.
+	 */
+	if (skc->skc_merge != NULL) {
+		atomic_long_dec(&skc->skc_merge_alloc);
+		spl_kmem_cache_free(skc->skc_merge, obj);
+		return;
+	}
+
 	/*
 	 * Run the destructor
 	 */
@@ -1493,9 +2476,14 @@ spl_kmem_cache_free(spl_kmem_cache_t *skc, void *obj)
 		skc->skc_dtor(obj, skc->skc_private);
 
 	/*
-	 * Free the object from the Linux underlying Linux slab.
+	 * Free the object from the Linux underlying Linux slab.  Objects of
+	 * KMC_AUTO caches are returned to the backend they were allocated
+	 * from, only objects from the Linux slab reside on PageSlab pages.
 	 */
-	if (skc->skc_flags & KMC_SLAB) {
+	if ((skc->skc_flags & (KMC_SLAB | KMC_AUTO)) == KMC_SLAB ||
+	    ((skc->skc_flags & KMC_AUTO) && !is_vmalloc_addr(obj) &&
+	    PageSlab(virt_to_head_page(obj)))) {
+		atomic_long_inc(&skc->skc_linux_free);
 		kmem_cache_free(skc->skc_linux_cache, obj);
 		return;
 	}
@@ -1517,6 +2505,21 @@ spl_kmem_cache_free(spl_kmem_cache_t *skc, void *obj)
 
 	local_irq_save(flags);
 
+	/*
+	 * A KMC_AUTO cache using the Linux slab returns its remaining SPL
+	 * objects directly to their slabs so they may drain.  This is
+	 * checked with interrupts disabled for the reason given in
+	 * spl_kmem_cache_alloc().
+	 */
+	if (unlikely(skc->skc_flags & KMC_SLAB)) {
+		local_irq_restore(flags);
+		spin_lock(&skc->skc_lock);
+		spl_cache_shrink(skc, obj);
+		spin_unlock(&skc->skc_lock);
+		spl_slab_reclaim(skc);
+		return;
+	}
+
 	/*
 	 * Safe to update per-cpu structure without lock, but
 	 * no remote memory allocation tracking is being performed
@@ -1532,7 +2535,10 @@ spl_kmem_cache_free(spl_kmem_cache_t *skc, void *obj)
 	 * interrupts are re-enabled.
 	 */
 	if (unlikely(skm->skm_avail >= skm->skm_size)) {
-		spl_cache_flush(skc, skm, skm->skm_refill);
+		spin_lock(&skc->skc_lock);
+		skc->skc_mag_miss++;
+		__spl_cache_flush(skc, skm, skm->skm_refill);
+		spin_unlock(&skc->skc_lock);
 		do_reclaim = 1;
 	}
 
@@ -1629,18 +2635,35 @@ SPL_SHRINKER_CALLBACK_WRAPPER(spl_kmem_cache_generic_shrinker);
 void
 spl_kmem_cache_reap_now(spl_kmem_cache_t *skc, int count)
 {
+	int reclaimed = 0;
+
 	ASSERT(skc->skc_magic == SKC_MAGIC);
 	ASSERT(!test_bit(KMC_BIT_DESTROY, &skc->skc_flags));
 
+	/*
+	 * Merged caches have no reclaim callback, reap the backing cache.
+	 */
+	if (skc->skc_merge != NULL) {
+		spl_kmem_cache_reap_now(skc->skc_merge, count);
+		return;
+	}
+
 	atomic_inc(&skc->skc_ref);
 
 	/*
-	 * Execute the registered reclaim callback if it exists.
+	 * Execute the registered reclaim callback if it exists.  A KMC_AUTO
+	 * cache using the Linux slab only drains its SPL slabs below, the
+	 * callback is not invoked a second time.
 	 */
 	if (skc->skc_flags & KMC_SLAB) {
-		if (skc->skc_reclaim)
+		if (skc->skc_reclaim) {
 			skc->skc_reclaim(skc->skc_private);
-		goto out;
+			reclaimed = 1;
+		}
+
+		/* KMC_AUTO caches may also hold SPL slabs */
+		if (!(skc->skc_flags & KMC_AUTO))
+			goto out;
 	}
 
 	/*
@@ -1662,7 +2685,7 @@ spl_kmem_cache_reap_now(spl_kmem_cache_t *skc, int count)
 	 * Longer term this would be the correct place to add the code which
 	 * repacks the slabs in order minimize fragmentation.
 	 */
-	if (skc->skc_reclaim) {
+	if (skc->skc_reclaim && !reclaimed) {
 		uint64_t objects = UINT64_MAX;
 		int do_reclaim;
 
@@ -1717,9 +2740,160 @@ spl_kmem_reap(void)
 }
 EXPORT_SYMBOL(spl_kmem_reap);
 
+/*
+ * Cache following 'skc' on the cache list, wrapping around at the end.
+ * The caller must hold the spl_kmem_cache_sem.
+ */
+static spl_kmem_cache_t *
+spl_kmem_reap_next(spl_kmem_cache_t *skc)
+{
+	struct list_head *next = skc->skc_list.next;
+
+	if (next == &spl_kmem_cache_list)
+		next = next->next;
+
+	return (list_entry(next, spl_kmem_cache_t, skc_list));
+}
+
+/*
+ * Release up to 'target' bytes of free slabs, invoking the reclaim
+ * callback of caches which have no free slabs.  The walk starts at
+ * spl_kmem_reap_cursor and stops once the target is met, leaving the
+ * cursor at the first cache not visited.  Returns the number of bytes
+ * released.
+ */
+static uint64_t
+spl_kmem_reap_caches(uint64_t target)
+{
+	spl_kmem_cache_t *skc, *start;
+	uint64_t released = 0, before, after;
+
+	down_read(&spl_kmem_cache_sem);
+	if (list_empty(&spl_kmem_cache_list)) {
+		up_read(&spl_kmem_cache_sem);
+		return (0);
+	}
+
+	start = spl_kmem_reap_cursor;
+	if (start == NULL)
+		start = list_entry(spl_kmem_cache_list.next,
+		    spl_kmem_cache_t, skc_list);
+
+	skc = start;
+	do {
+		if (!test_bit(KMC_BIT_DESTROY, &skc->skc_flags)) {
+			before = skc->skc_slab_total;
+			spl_kmem_cache_reap_now(skc, 1);
+			after = skc->skc_slab_total;
+
+			spl_kmem_reap_stats[SPL_KMEM_REAP_CACHES]++;
+			if (before > after)
+				released += (before - after) *
+				    skc->skc_slab_size;
+		}
+
+		skc = spl_kmem_reap_next(skc);
+	} while (skc != start && released < target);
+
+	spl_kmem_reap_cursor = skc;
+	up_read(&spl_kmem_cache_sem);
+
+	spl_kmem_reap_stats[SPL_KMEM_REAP_BYTES] += released;
+
+	return (released);
+}
+
+static void spl_kmem_reap_task(void *arg);
+
+/*
+ * Dispatch the next reaper pass unless the reaper is disabled, stopping,
+ * or a pass is already pending or running.  A running pass keeps its id
+ * in spl_kmem_reap_id until it reschedules itself with the lock held.
+ */
+static void
+spl_kmem_reap_dispatch(int running)
+{
+	unsigned int interval = ACCESS_ONCE(spl_kmem_reap_interval);
+
+	ASSERT(mutex_is_locked(&spl_kmem_reap_lock));
+
+	if (running)
+		spl_kmem_reap_id = 0;
+
+	if (spl_kmem_reap_stop || interval == 0 || spl_kmem_reap_id != 0)
+		return;
+
+	spl_kmem_reap_id = taskq_dispatch_delay(spl_kmem_cache_taskq,
+	    spl_kmem_reap_task, NULL, TQ_SLEEP,
+	    ddi_get_lbolt() + MAX(msecs_to_jiffies(interval), 1));
+}
+
+/*
+ * Start the reaper if it has been enabled and is not already scheduled.
+ * Must be called after spl_kmem_reap_interval is changed other than
+ * through the module parameter.
+ */
+void
+spl_kmem_reap_schedule(void)
+{
+	mutex_lock(&spl_kmem_reap_lock);
+	if (spl_kmem_cache_taskq != NULL)
+		spl_kmem_reap_dispatch(0);
+	mutex_unlock(&spl_kmem_reap_lock);
+}
+EXPORT_SYMBOL(spl_kmem_reap_schedule);
+
+/*
+ * Background reaper, see spl_kmem_reap_watermark.  Only a single
+ * instance is ever dispatched so the statistics need no locking.
+ */
+static void
+spl_kmem_reap_task(void *arg)
+{
+	unsigned long free, decline, projected, watermark;
+
+	if (ACCESS_ONCE(spl_kmem_reap_interval) == 0) {
+		spl_kmem_reap_free = 0;
+		goto out;
+	}
+
+	spl_kmem_reap_stats[SPL_KMEM_REAP_WAKEUPS]++;
+
+	free = freemem;
+	decline = 0;
+	if (spl_kmem_reap_free > free)
+		decline = spl_kmem_reap_free - free;
+	spl_kmem_reap_free = free;
+
+	projected = free - MIN(free, decline * SPL_KMEM_REAP_LOOKAHEAD);
+	watermark = (physmem / 100) * MIN(spl_kmem_reap_watermark, 100);
+
+	if (projected < watermark) {
+		spl_kmem_reap_stats[SPL_KMEM_REAP_ACTIVE]++;
+		(void) spl_kmem_reap_caches(
+		    (uint64_t)(watermark - projected) << PAGE_SHIFT);
+	}
+out:
+	mutex_lock(&spl_kmem_reap_lock);
+	spl_kmem_reap_dispatch(1);
+	mutex_unlock(&spl_kmem_reap_lock);
+}
+
+uint64_t
+spl_kmem_reap_stat(int stat)
+{
+	ASSERT3S(stat, >=, 0);
+	ASSERT3S(stat, <, ARRAY_SIZE(spl_kmem_reap_stats));
+
+	return (ACCESS_ONCE(spl_kmem_reap_stats[stat]));
+}
+EXPORT_SYMBOL(spl_kmem_reap_stat);
+
 int
 spl_kmem_cache_init(void)
 {
+	int rc = 0;
+
 	init_rwsem(&spl_kmem_cache_sem);
 	INIT_LIST_HEAD(&spl_kmem_cache_list);
 	spl_kmem_cache_taskq = taskq_create("spl_kmem_cache",
@@ -1728,12 +2902,58 @@ spl_kmem_cache_init(void)
 	    TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
 	spl_register_shrinker(&spl_kmem_cache_shrinker);
 
-	return (0);
+#ifdef HAVE_CPUHP_SETUP_STATE
+	rc = cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN,
+	    "spl/kmem_cache:prepare", spl_magazine_cpu_prepare,
+	    spl_magazine_cpu_dead);
+	if (rc < 0) {
+		spl_unregister_shrinker(&spl_kmem_cache_shrinker);
+		taskq_destroy(spl_kmem_cache_taskq);
+		return (rc);
+	}
+	spl_magazine_cpuhp_state = rc;
+	rc = 0;
+#else
+	register_hotcpu_notifier(&spl_magazine_cpu_notifier);
+#endif /* HAVE_CPUHP_SETUP_STATE */
+
+	spl_magazine_balance_stop = 0;
+	spl_magazine_balance_id = taskq_dispatch_delay(spl_kmem_cache_taskq,
+	    spl_magazine_balance, NULL, TQ_SLEEP,
+	    ddi_get_lbolt() + SPL_MAGAZINE_INTERVAL * HZ);
+
+	spl_kmem_reap_free = 0;
+	spl_kmem_reap_cursor = NULL;
+	mutex_lock(&spl_kmem_reap_lock);
+	spl_kmem_reap_stop = 0;
+	spl_kmem_reap_id = 0;
+	spl_kmem_reap_dispatch(0);
+	mutex_unlock(&spl_kmem_reap_lock);
+
+	return (rc);
 }
 
 void
 spl_kmem_cache_fini(void)
 {
+	taskqid_t id;
+
+	spl_magazine_balance_stop = 1;
+	smp_mb();
+	taskq_cancel_id(spl_kmem_cache_taskq, spl_magazine_balance_id);
+	mutex_lock(&spl_kmem_reap_lock);
+	spl_kmem_reap_stop = 1;
+	id = spl_kmem_reap_id;
+	mutex_unlock(&spl_kmem_reap_lock);
+	taskq_cancel_id(spl_kmem_cache_taskq, id);
+
+#ifdef HAVE_CPUHP_SETUP_STATE
+	cpuhp_remove_state_nocalls(spl_magazine_cpuhp_state);
+#else
+	unregister_hotcpu_notifier(&spl_magazine_cpu_notifier);
+#endif /* HAVE_CPUHP_SETUP_STATE */
+
 	spl_unregister_shrinker(&spl_kmem_cache_shrinker);
+	rcu_barrier();
 	taskq_destroy(spl_kmem_cache_taskq);
 }
@@ -0,0 +1,334 @@
+/*
+ *  Copyright (C) 2007-2010 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/debug.h>
+#include <sys/sysmacros.h>
+#include <sys/kmem.h>
+#include <sys/kmem_page.h>
+#include <linux/highmem.h>
+#include <linux/mm_compat.h>
+
+/*
+ * The maximum number of order-0 pages kept on each cpu's free list.  When
+ * set to 0, the default, kmem_page_alloc() and kmem_page_free() pass
+ * directly through to the page allocator.
+ */
+unsigned int spl_kmem_page_pool = 0;
+EXPORT_SYMBOL(spl_kmem_page_pool);
+module_param(spl_kmem_page_pool, uint, 0644);
+MODULE_PARM_DESC(spl_kmem_page_pool, "Pages pooled per cpu, disabled (0)");
+
+#define	SPL_KMEM_PAGE_BATCH	32	/* Maximum pages per refill or drain */
+
+typedef struct spl_kmem_page_pool {
+	spinlock_t		skp_lock;	/* Pool lock */
+	struct list_head	skp_list;	/* Pooled pages */
+	uint32_t		skp_count;	/* Number of pooled pages */
+	uint64_t		skp_hits;	/* Served from the pool */
+	uint64_t		skp_misses;	/* Served by the page allocator */
+} spl_kmem_page_pool_t;
+
+static spl_kmem_page_pool_t *spl_kmem_page_pools[NR_CPUS];
+
+SPL_SHRINKER_CALLBACK_FWD_DECLARE(spl_kmem_page_shrinker_fn);
+SPL_SHRINKER_DECLARE(spl_kmem_page_shrinker,
+	spl_kmem_page_shrinker_fn, DEFAULT_SEEKS);
+
+/*
+ * Pages are moved between the pools and the page allocator in batches of
+ * a quarter of the pool size so the page allocator is only entered for
+ * every few allocations or frees.
+ */
+static inline uint32_t
+spl_kmem_page_batch(void)
+{
+	return (MAX(MIN(spl_kmem_page_pool / 4, SPL_KMEM_PAGE_BATCH), 1));
+}
+
+static void
+spl_kmem_page_free_list(struct list_head *list)
+{
+	struct page *page, *tmp;
+
+	list_for_each_entry_safe(page, tmp, list, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+}
+
+/*
+ * Allocate a page from the local node on a pool miss.  Sleeping callers
+ * additionally allocate a batch of pages for the local pool, these extra
+ * pages are opportunistic and may not retry or warn.
+ */
+static struct page *
+spl_kmem_page_refill(int flags, gfp_t lflags)
+{
+	spl_kmem_page_pool_t *skp;
+	struct page *page, *extra;
+	unsigned long irq_flags;
+	LIST_HEAD(list);
+	int i, node = numa_node_id(), count = 0;
+
+	page = alloc_pages_node(node, lflags, 0);
+	if (page == NULL || (flags & KM_NOSLEEP) || spl_kmem_page_pool == 0)
+		return (page);
+
+	for (i = 1; i < spl_kmem_page_batch(); i++) {
+		extra = alloc_pages_node(node,
+		    lflags | __GFP_NORETRY | __GFP_NOWARN, 0);
+		if (extra == NULL)
+			break;
+
+		list_add(&extra->lru, &list);
+		count++;
+	}
+
+	if (count > 0) {
+		local_irq_save(irq_flags);
+		skp = spl_kmem_page_pools[smp_processor_id()];
+		spin_lock(&skp->skp_lock);
+		list_splice(&list, &skp->skp_list);
+		skp->skp_count += count;
+		spin_unlock(&skp->skp_lock);
+		local_irq_restore(irq_flags);
+	}
+
+	return (page);
+}
+
+/*
+ * Allocate an order-0 page, KM_ZERO requests are zeroed.  As with
+ * kmem_alloc() a KM_SLEEP allocation never fails.
+ */
+struct page *
+kmem_page_alloc(int flags)
+{
+	gfp_t lflags = kmem_flags_convert(flags) & ~(__GFP_COMP | __GFP_ZERO);
+	spl_kmem_page_pool_t *skp;
+	struct page *page = NULL;
+	unsigned long irq_flags;
+
+	ASSERT0(flags & ~(KM_PUBLIC_MASK | KM_ZERO));
+
+	local_irq_save(irq_flags);
+	skp = spl_kmem_page_pools[smp_processor_id()];
+	spin_lock(&skp->skp_lock);
+	if (skp->skp_count > 0) {
+		page = list_entry(skp->skp_list.next, struct page, lru);
+		list_del(&page->lru);
+		skp->skp_count--;
+		skp->skp_hits++;
+	} else {
+		skp->skp_misses++;
+	}
+	spin_unlock(&skp->skp_lock);
+	local_irq_restore(irq_flags);
+
+	while (page == NULL) {
+		page = spl_kmem_page_refill(flags, lflags);
+		if (page != NULL || (flags & KM_NOSLEEP))
+			break;
+
+		cond_resched();
+	}
+
+	if (page != NULL && (flags & KM_ZERO))
+		clear_highpage(page);
+
+	return (page);
+}
+EXPORT_SYMBOL(kmem_page_alloc);
+
+/*
+ * Return a page to the local pool.  Pages from a remote node and high
+ * memory pages are freed immediately.  Once the pool is full a batch of
+ * its least recently freed pages is returned to the page allocator.
+ */
+void
+kmem_page_free(struct page *page)
+{
+	spl_kmem_page_pool_t *skp;
+	unsigned long irq_flags;
+	LIST_HEAD(list);
+	uint32_t i, count;
+
+	ASSERT3S(page_count(page), ==, 1);
+
+	if (spl_kmem_page_pool == 0 || PageHighMem(page) ||
+	    page_to_nid(page) != numa_node_id()) {
+		__free_page(page);
+		return;
+	}
+
+	local_irq_save(irq_flags);
+	skp = spl_kmem_page_pools[smp_processor_id()];
+	spin_lock(&skp->skp_lock);
+	list_add(&page->lru, &skp->skp_list);
+	skp->skp_count++;
+
+	if (skp->skp_count > spl_kmem_page_pool) {
+		count = MIN(spl_kmem_page_batch(), skp->skp_count);
+		for (i = 0; i < count; i++) {
+			page = list_entry(skp->skp_list.prev, struct page, lru);
+			list_move(&page->lru, &list);
+		}
+		skp->skp_count -= count;
+	}
+	spin_unlock(&skp->skp_lock);
+	local_irq_restore(irq_flags);
+
+	spl_kmem_page_free_list(&list);
+}
+EXPORT_SYMBOL(kmem_page_free);
+
+/*
+ * Release up to nr pooled pages from all cpus to the page allocator.
+ */
+static unsigned long
+spl_kmem_page_drain(unsigned long nr)
+{
+	spl_kmem_page_pool_t *skp;
+	struct page *page;
+	unsigned long irq_flags, freed = 0;
+	LIST_HEAD(list);
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		skp = spl_kmem_page_pools[cpu];
+		if (skp == NULL)
+			continue;
+
+		spin_lock_irqsave(&skp->skp_lock, irq_flags);
+		while (skp->skp_count > 0 && freed < nr) {
+			page = list_entry(skp->skp_list.prev, struct page, lru);
+			list_move(&page->lru, &list);
+			skp->skp_count--;
+			freed++;
+		}
+		spin_unlock_irqrestore(&skp->skp_lock, irq_flags);
+
+		spl_kmem_page_free_list(&list);
+
+		if (freed >= nr)
+			break;
+	}
+
+	return (freed);
+}
+
+uint64_t
+kmem_page_stat(int stat)
+{
+	spl_kmem_page_pool_t *skp;
+	unsigned long irq_flags;
+	uint64_t val = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		skp = spl_kmem_page_pools[cpu];
+		if (skp == NULL)
+			continue;
+
+		spin_lock_irqsave(&skp->skp_lock, irq_flags);
+		switch (stat) {
+		case SPL_KMEM_PAGE_HITS:
+			val += skp->skp_hits;
+			break;
+		case SPL_KMEM_PAGE_MISSES:
+			val += skp->skp_misses;
+			break;
+		case SPL_KMEM_PAGE_POOLED:
+			val += skp->skp_count;
+			break;
+		}
+		spin_unlock_irqrestore(&skp->skp_lock, irq_flags);
+	}
+
+	return (val);
+}
+EXPORT_SYMBOL(kmem_page_stat);
+
+/*
+ * Pooled pages are always freeable, they are released to the page
+ * allocator when the kernel shrinkers are invoked under memory pressure.
+ */
+static spl_shrinker_t
+__spl_kmem_page_shrinker_fn(struct shrinker *shrink,
+    struct shrink_control *sc)
+{
+#ifdef HAVE_SPLIT_SHRINKER_CALLBACK
+	if (sc->nr_to_scan)
+		return (spl_kmem_page_drain(sc->nr_to_scan));
+#else
+	if (sc->nr_to_scan)
+		(void) spl_kmem_page_drain(sc->nr_to_scan);
+#endif /* HAVE_SPLIT_SHRINKER_CALLBACK */
+
+	return (MIN(kmem_page_stat(SPL_KMEM_PAGE_POOLED), INT_MAX));
+}
+
+SPL_SHRINKER_CALLBACK_WRAPPER(spl_kmem_page_shrinker_fn);
+
+int
+spl_kmem_page_init(void)
+{
+	spl_kmem_page_pool_t *skp;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		skp = kmalloc_node(sizeof (*skp), GFP_KERNEL | __GFP_ZERO,
+		    cpu_to_node(cpu));
+		if (skp == NULL) {
+			for_each_possible_cpu(cpu) {
+				kfree(spl_kmem_page_pools[cpu]);
+				spl_kmem_page_pools[cpu] = NULL;
+			}
+
+			return (-ENOMEM);
+		}
+
+		spin_lock_init(&skp->skp_lock);
+		INIT_LIST_HEAD(&skp->skp_list);
+		spl_kmem_page_pools[cpu] = skp;
+	}
+
+	spl_register_shrinker(&spl_kmem_page_shrinker);
+
+	return (0);
+}
+
+void
+spl_kmem_page_fini(void)
+{
+	int cpu;
+
+	spl_unregister_shrinker(&spl_kmem_page_shrinker);
+	spl_kmem_page_drain(ULONG_MAX);
+
+	for_each_possible_cpu(cpu) {
+		kfree(spl_kmem_page_pools[cpu]);
+		spl_kmem_page_pools[cpu] = NULL;
+	}
+}
@@ -0,0 +1,329 @@
+/*
+ *  Copyright (C) 2007-2010 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/debug.h>
+#include <sys/sysmacros.h>
+#include <sys/kmem.h>
+#include <sys/vmem.h>
+#include <sys/kmem_sg.h>
+#include <sys/kmem_page.h>
+
+static void
+kmem_sg_free_chunk(struct page *page, uint_t order)
+{
+	if (order == 0)
+		kmem_page_free(page);
+	else
+		__free_pages(page, order);
+}
+
+/*
+ * Allocate the chunks for a scatter-list at the given order.  Higher
+ * order allocations are opportunistic and must fail quickly so they are
+ * not permitted to retry or to warn.  Order-0 chunks are taken from the
+ * per-cpu page pool.  The chunk array is sized for this order and is
+ * allocated with vmem_alloc() so a large buffer never depends on a
+ * physically contiguous descriptor.
+ */
+static int
+kmem_sg_alloc_chunks(kmem_sg_t *sg, uint_t order, int flags, gfp_t lflags)
+{
+	uint_t nchunks = DIV_ROUND_UP(sg->ksg_size, PAGE_SIZE << order);
+	struct page **chunks;
+	int i;
+
+	chunks = vmem_alloc(nchunks * sizeof (struct page *), flags & ~KM_ZERO);
+	if (chunks == NULL)
+		return (-ENOMEM);
+
+	if (order > 0)
+		lflags |= __GFP_NORETRY | __GFP_NOWARN;
+
+	for (i = 0; i < nchunks; i++) {
+		if (order == 0)
+			chunks[i] = kmem_page_alloc(flags);
+		else
+			chunks[i] = alloc_pages(lflags, order);
+
+		if (chunks[i] == NULL) {
+			while (--i >= 0)
+				kmem_sg_free_chunk(chunks[i], order);
+
+			vmem_free(chunks, nchunks * sizeof (struct page *));
+			return (-ENOMEM);
+		}
+	}
+
+	sg->ksg_order = order;
+	sg->ksg_nchunks = nchunks;
+	sg->ksg_chunks = chunks;
+
+	return (0);
+}
+
+static kmem_sg_t *
+kmem_sg_alloc_impl(size_t size, int flags)
+{
+	gfp_t lflags = kmem_flags_convert(flags) & ~__GFP_COMP;
+	kmem_sg_t *sg;
+	uint_t order;
+
+	ASSERT3U(size, >, 0);
+
+	order = MIN(get_order(size), KMEM_SG_MAX_ORDER);
+	sg = kmem_alloc(sizeof (kmem_sg_t), flags & ~KM_ZERO);
+	if (sg == NULL)
+		return (NULL);
+
+	sg->ksg_size = size;
+
+	/*
+	 * Use the largest chunks which are readily available.  Like
+	 * kmem_alloc() a KM_SLEEP allocation retries order-0 pages
+	 * until it succeeds.
+	 */
+	while (kmem_sg_alloc_chunks(sg, order, flags, lflags) != 0) {
+		if (order > 0) {
+			order--;
+			continue;
+		}
+
+		if (flags & KM_NOSLEEP) {
+			kmem_free(sg, sizeof (kmem_sg_t));
+			return (NULL);
+		}
+
+		cond_resched();
+	}
+
+	return (sg);
+}
+
+kmem_sg_t *
+kmem_sg_alloc(size_t size, int flags)
+{
+	ASSERT0(flags & ~KM_PUBLIC_MASK);
+
+	return (kmem_sg_alloc_impl(size, flags));
+}
+EXPORT_SYMBOL(kmem_sg_alloc);
+
+kmem_sg_t *
+kmem_sg_zalloc(size_t size, int flags)
+{
+	ASSERT0(flags & ~KM_PUBLIC_MASK);
+
+	return (kmem_sg_alloc_impl(size, flags | KM_ZERO));
+}
+EXPORT_SYMBOL(kmem_sg_zalloc);
+
+void
+kmem_sg_free(kmem_sg_t *sg)
+{
+	int i;
+
+	for (i = 0; i < sg->ksg_nchunks; i++)
+		kmem_sg_free_chunk(sg->ksg_chunks[i], sg->ksg_order);
+
+	vmem_free(sg->ksg_chunks, sg->ksg_nchunks * sizeof (struct page *));
+	kmem_free(sg, sizeof (kmem_sg_t));
+}
+EXPORT_SYMBOL(kmem_sg_free);
+
+/*
+ * Invoke the callback for each chunk segment covering the byte range.
+ */
+int
+kmem_sg_iterate(kmem_sg_t *sg, size_t off, size_t len,
+    kmem_sg_func_t func, void *priv)
+{
+	size_t chunk_size = kmem_sg_chunk_size(sg);
+	size_t chunk_off, seg;
+	uint_t chunk;
+	int rc;
+
+	ASSERT3U(off + len, <=, sg->ksg_size);
+
+	chunk = off >> (PAGE_SHIFT + sg->ksg_order);
+	chunk_off = off & (chunk_size - 1);
+
+	while (len > 0) {
+		seg = MIN(len, chunk_size - chunk_off);
+		rc = func(page_address(sg->ksg_chunks[chunk]) + chunk_off,
+		    seg, priv);
+		if (rc)
+			return (rc);
+
+		len -= seg;
+		chunk_off = 0;
+		chunk++;
+	}
+
+	return (0);
+}
+EXPORT_SYMBOL(kmem_sg_iterate);
+
+static int
+kmem_sg_zero_cb(void *buf, size_t len, void *priv)
+{
+	memset(buf, 0, len);
+	return (0);
+}
+
+void
+kmem_sg_zero(kmem_sg_t *sg, size_t off, size_t len)
+{
+	(void) kmem_sg_iterate(sg, off, len, kmem_sg_zero_cb, NULL);
+}
+EXPORT_SYMBOL(kmem_sg_zero);
+
+static int
+kmem_sg_copy_from_cb(void *buf, size_t len, void *priv)
+{
+	const void **src = (const void **)priv;
+
+	memcpy(buf, *src, len);
+	*src += len;
+
+	return (0);
+}
+
+void
+kmem_sg_copy_from_buf(kmem_sg_t *sg, size_t off, const void *buf, size_t len)
+{
+	(void) kmem_sg_iterate(sg, off, len, kmem_sg_copy_from_cb, &buf);
+}
+EXPORT_SYMBOL(kmem_sg_copy_from_buf);
+
+static int
+kmem_sg_copy_to_cb(void *buf, size_t len, void *priv)
+{
+	void **dst = (void **)priv;
+
+	memcpy(*dst, buf, len);
+	*dst += len;
+
+	return (0);
+}
+
+void
+kmem_sg_copy_to_buf(void *buf, kmem_sg_t *sg, size_t off, size_t len)
+{
+	(void) kmem_sg_iterate(sg, off, len, kmem_sg_copy_to_cb, &buf);
+}
+EXPORT_SYMBOL(kmem_sg_copy_to_buf);
+
+typedef struct kmem_sg_copy_arg {
+	kmem_sg_t	*ksca_dst;
+	size_t		ksca_off;
+} kmem_sg_copy_arg_t;
+
+static int
+kmem_sg_copy_cb(void *buf, size_t len, void *priv)
+{
+	kmem_sg_copy_arg_t *ksca = (kmem_sg_copy_arg_t *)priv;
+
+	kmem_sg_copy_from_buf(ksca->ksca_dst, ksca->ksca_off, buf, len);
+	ksca->ksca_off += len;
+
+	return (0);
+}
+
+void
+kmem_sg_copy(kmem_sg_t *dst, size_t doff, kmem_sg_t *src, size_t soff,
+    size_t len)
+{
+	kmem_sg_copy_arg_t ksca = { dst, doff };
+
+	(void) kmem_sg_iterate(src, soff, len, kmem_sg_copy_cb, &ksca);
+}
+EXPORT_SYMBOL(kmem_sg_copy);
+
+static int
+kmem_sg_cmp_cb(void *buf, size_t len, void *priv)
+{
+	const void **cmp = (const void **)priv;
+	int rc;
+
+	rc = memcmp(buf, *cmp, len);
+	*cmp += len;
+
+	return (rc);
+}
+
+/*
+ * Compare a range of the scatter-list with a linear buffer, returns zero
+ * when they are identical.
+ */
+int
+kmem_sg_cmp(kmem_sg_t *sg, size_t off, const void *buf, size_t len)
+{
+	return (kmem_sg_iterate(sg, off, len, kmem_sg_cmp_cb, &buf));
+}
+EXPORT_SYMBOL(kmem_sg_cmp);
+
+static int
+kmem_sg_fletcher_4_cb(void *buf, size_t len, void *priv)
+{
+	uint64_t *cksum = (uint64_t *)priv;
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (len / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+
+	a = cksum[0];
+	b = cksum[1];
+	c = cksum[2];
+	d = cksum[3];
+
+	for (; ip < ipend; ip++) {
+		a += ip[0];
+		b += a;
+		c += b;
+		d += c;
+	}
+
+	cksum[0] = a;
+	cksum[1] = b;
+	cksum[2] = c;
+	cksum[3] = d;
+
+	return (0);
+}
+
+/*
+ * Native byte order Fletcher-4 checksum of a range of the scatter-list.
+ * The result is identical to checksumming the same data stored in a
+ * single linear buffer.  The offset and length must be multiples of
+ * four bytes.
+ */
+void
+kmem_sg_fletcher_4(kmem_sg_t *sg, size_t off, size_t len, uint64_t *cksum)
+{
+	ASSERT(IS_P2ALIGNED(off, sizeof (uint32_t)));
+	ASSERT(IS_P2ALIGNED(len, sizeof (uint32_t)));
+
+	cksum[0] = cksum[1] = cksum[2] = cksum[3] = 0;
+	(void) kmem_sg_iterate(sg, off, len, kmem_sg_fletcher_4_cb, cksum);
+}
+EXPORT_SYMBOL(kmem_sg_fletcher_4);
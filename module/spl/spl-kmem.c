@@ -26,6 +26,8 @@
 #include <sys/sysmacros.h>
 #include <sys/kmem.h>
 #include <sys/vmem.h>
+#include <sys/taskq.h>
+#include <sys/timer.h>
 #include <linux/mm.h>
 #include <linux/ratelimit.h>
 
@@ -65,6 +67,21 @@ MODULE_PARM_DESC(spl_kmem_alloc_max,
 	"Maximum size in bytes for a kmem_alloc()");
 EXPORT_SYMBOL(spl_kmem_alloc_max);
 
+/*
+ * Zeroing large kmem_zalloc() and vmem_zalloc() allocations inline adds
+ * the cost of clearing the buffer to the allocating thread.  When enabled
+ * each cpu maintains a small pool of already zeroed buffers for each size
+ * from PAGE_SIZE to SPL_KMEM_ZERO_ORDERS pages which is refilled by a low
+ * priority thread.  Zeroing allocations are served from this pool first
+ * and fall back to zeroing inline when it is empty.  This value sets the
+ * number of buffers of each size kept per cpu, zero disables the pool.
+ */
+unsigned int spl_kmem_zero_pool = 0;
+module_param(spl_kmem_zero_pool, uint, 0644);
+MODULE_PARM_DESC(spl_kmem_zero_pool,
+	"Pre-zeroed buffers of each size kept per cpu");
+EXPORT_SYMBOL(spl_kmem_zero_pool);
+
 int
 kmem_debugging(void)
 {
@@ -138,6 +155,264 @@ EXPORT_SYMBOL(strfree);
  */
 DEFINE_RATELIMIT_STATE(kmem_alloc_ratelimit_state, 60 * HZ, 5);
 
+#define	SPL_KMEM_ZERO_ORDERS	4	/* PAGE_SIZE to 8 * PAGE_SIZE */
+#define	SPL_KMEM_ZERO_DEPTH	64	/* Maximum buffers per size per cpu */
+#define	SPL_KMEM_ZERO_TRIM	5	/* Seconds between pool rechecks */
+
+typedef struct spl_kmem_zero {
+	spinlock_t	skz_lock;
+	uint32_t	skz_avail[SPL_KMEM_ZERO_ORDERS];
+	void		*skz_objs[SPL_KMEM_ZERO_ORDERS][SPL_KMEM_ZERO_DEPTH];
+	uint64_t	skz_hits;	/* Served from the pool */
+	uint64_t	skz_misses;	/* Zeroed inline */
+	uint64_t	skz_refills;	/* Buffers zeroed by the worker */
+} spl_kmem_zero_t;
+
+static spl_kmem_zero_t *spl_kmem_zero[NR_CPUS];
+static taskq_t *spl_kmem_zero_taskq;
+static unsigned long spl_kmem_zero_pending;
+static taskqid_t spl_kmem_zero_trim_id;
+static int spl_kmem_zero_stop;
+
+static inline uint32_t
+spl_kmem_zero_target(void)
+{
+	return (MIN(spl_kmem_zero_pool, SPL_KMEM_ZERO_DEPTH));
+}
+
+static void spl_kmem_zero_refill(void *arg);
+
+/*
+ * While any pool holds buffers the refill is repeated every
+ * SPL_KMEM_ZERO_TRIM seconds.  This trims the pools after
+ * spl_kmem_zero_pool is reduced, or set to zero, even though no
+ * further zeroing allocations request a refill.
+ */
+static void
+spl_kmem_zero_trim(void)
+{
+	spl_kmem_zero_t *skz;
+	int cpu, order, populated = 0;
+
+	for_each_possible_cpu(cpu) {
+		skz = spl_kmem_zero[cpu];
+		if (skz == NULL)
+			continue;
+
+		for (order = 0; order < SPL_KMEM_ZERO_ORDERS; order++)
+			populated |= (ACCESS_ONCE(skz->skz_avail[order]) > 0);
+	}
+
+	if (!populated || ACCESS_ONCE(spl_kmem_zero_stop) ||
+	    test_and_set_bit(1, &spl_kmem_zero_pending))
+		return;
+
+	spl_kmem_zero_trim_id = taskq_dispatch_delay(spl_kmem_zero_taskq,
+	    spl_kmem_zero_refill, (void *)1, TQ_NOSLEEP,
+	    ddi_get_lbolt() + SPL_KMEM_ZERO_TRIM * HZ);
+	if (spl_kmem_zero_trim_id == 0)
+		clear_bit(1, &spl_kmem_zero_pending);
+}
+
+/*
+ * Refill the per-cpu pools with zeroed buffers.  Pools are allocated on
+ * first use and trimmed when spl_kmem_zero_pool is reduced, see
+ * spl_kmem_zero_trim().  Buffers are zeroed by kmalloc_node() on the
+ * node of the cpu which will use them.
+ */
+static void
+spl_kmem_zero_refill(void *arg)
+{
+	spl_kmem_zero_t *skz;
+	gfp_t lflags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN | __GFP_NORETRY;
+	void *ptr;
+	int cpu, order, full;
+
+	/* Bit 0 is a refill requested by an allocation, bit 1 a trim */
+	clear_bit(arg != NULL, &spl_kmem_zero_pending);
+	smp_mb__after_atomic();
+
+	for_each_online_cpu(cpu) {
+		skz = spl_kmem_zero[cpu];
+		if (skz == NULL) {
+			if (spl_kmem_zero_target() == 0)
+				continue;
+
+			skz = kmalloc_node(sizeof (*skz), lflags,
+			    cpu_to_node(cpu));
+			if (skz == NULL)
+				goto out;
+
+			spin_lock_init(&skz->skz_lock);
+			smp_wmb();
+			spl_kmem_zero[cpu] = skz;
+		}
+
+		for (order = 0; order < SPL_KMEM_ZERO_ORDERS; order++) {
+			do {
+				ptr = NULL;
+				spin_lock_irq(&skz->skz_lock);
+				if (skz->skz_avail[order] > spl_kmem_zero_target())
+					ptr = skz->skz_objs[order]
+					    [--skz->skz_avail[order]];
+				full = (skz->skz_avail[order] >=
+				    spl_kmem_zero_target());
+				spin_unlock_irq(&skz->skz_lock);
+
+				if (ptr) {
+					kfree(ptr);
+					continue;
+				}
+
+				if (full)
+					break;
+
+				ptr = kmalloc_node(PAGE_SIZE << order, lflags,
+				    cpu_to_node(cpu));
+				if (ptr == NULL)
+					goto out;
+
+				spin_lock_irq(&skz->skz_lock);
+				if (skz->skz_avail[order] <
+				    spl_kmem_zero_target()) {
+					skz->skz_objs[order]
+					    [skz->skz_avail[order]++] = ptr;
+					skz->skz_refills++;
+					ptr = NULL;
+				}
+				spin_unlock_irq(&skz->skz_lock);
+
+				if (ptr)
+					kfree(ptr);
+
+				cond_resched();
+			} while (1);
+		}
+	}
+out:
+	spl_kmem_zero_trim();
+}
+
+/*
+ * Take a zeroed buffer for a kmalloc() sized allocation from the local
+ * cpu pool.  The pool buffer is of the power-of-two size kmalloc() would
+ * have used to satisfy the request so it may be released with kfree().
+ * Refilling is requested once the pool is half empty.
+ */
+static void *
+spl_kmem_zero_get(size_t size)
+{
+	spl_kmem_zero_t *skz;
+	unsigned long irq_flags;
+	void *ptr = NULL;
+	int order, refill = 1;
+
+	if (size <= (PAGE_SIZE >> 1))
+		return (NULL);
+
+	order = get_order(size);
+	if (order >= SPL_KMEM_ZERO_ORDERS)
+		return (NULL);
+
+	local_irq_save(irq_flags);
+	skz = spl_kmem_zero[smp_processor_id()];
+	if (skz != NULL) {
+		spin_lock(&skz->skz_lock);
+		if (skz->skz_avail[order] > 0) {
+			ptr = skz->skz_objs[order][--skz->skz_avail[order]];
+			skz->skz_hits++;
+		} else {
+			skz->skz_misses++;
+		}
+		refill = (skz->skz_avail[order] <= spl_kmem_zero_target() / 2);
+		spin_unlock(&skz->skz_lock);
+	}
+	local_irq_restore(irq_flags);
+
+	if (refill && spl_kmem_zero_taskq != NULL &&
+	    !test_and_set_bit(0, &spl_kmem_zero_pending)) {
+		if (taskq_dispatch(spl_kmem_zero_taskq, spl_kmem_zero_refill,
+		    NULL, TQ_NOSLEEP) == 0)
+			clear_bit(0, &spl_kmem_zero_pending);
+	}
+
+	return (ptr);
+}
+
+/*
+ * Sum a zero pool statistic over all cpus for /proc/sys/kernel/spl/kmem/.
+ */
+uint64_t
+spl_kmem_zero_stat(int stat)
+{
+	spl_kmem_zero_t *skz;
+	unsigned long irq_flags;
+	uint64_t val = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		skz = spl_kmem_zero[cpu];
+		if (skz == NULL)
+			continue;
+
+		spin_lock_irqsave(&skz->skz_lock, irq_flags);
+		switch (stat) {
+		case SPL_KMEM_ZERO_HITS:
+			val += skz->skz_hits;
+			break;
+		case SPL_KMEM_ZERO_MISSES:
+			val += skz->skz_misses;
+			break;
+		case SPL_KMEM_ZERO_REFILLS:
+			val += skz->skz_refills;
+			break;
+		}
+		spin_unlock_irqrestore(&skz->skz_lock, irq_flags);
+	}
+
+	return (val);
+}
+EXPORT_SYMBOL(spl_kmem_zero_stat);
+
+static int
+spl_kmem_zero_init(void)
+{
+	spl_kmem_zero_stop = 0;
+	spl_kmem_zero_taskq = taskq_create("spl_kmem_zero", 1, minclsyspri,
+	    1, INT_MAX, TASKQ_PREPOPULATE);
+	if (spl_kmem_zero_taskq == NULL)
+		return (-ENOMEM);
+
+	return (0);
+}
+
+static void
+spl_kmem_zero_fini(void)
+{
+	spl_kmem_zero_t *skz;
+	int cpu, order;
+
+	spl_kmem_zero_stop = 1;
+	smp_mb();
+	taskq_cancel_id(spl_kmem_zero_taskq, spl_kmem_zero_trim_id);
+	taskq_destroy(spl_kmem_zero_taskq);
+	spl_kmem_zero_taskq = NULL;
+
+	for_each_possible_cpu(cpu) {
+		skz = spl_kmem_zero[cpu];
+		if (skz == NULL)
+			continue;
+
+		for (order = 0; order < SPL_KMEM_ZERO_ORDERS; order++)
+			while (skz->skz_avail[order] > 0)
+				kfree(skz->skz_objs[order]
+				    [--skz->skz_avail[order]]);
+
+		spl_kmem_zero[cpu] = NULL;
+		kfree(skz);
+	}
+}
+
 /*
  * General purpose unified implementation of kmem_alloc(). It is an
  * amalgamation of Linux and Illumos allocator design. It should never be
@@ -166,6 +441,16 @@ spl_kmem_alloc_impl(size_t size, int flags, int node)
 		dump_stack();
 	}
 
+	/*
+	 * Prefer an already zeroed buffer from the per-cpu pool.
+	 */
+	if ((flags & KM_ZERO) && spl_kmem_zero_pool && node == NUMA_NO_NODE &&
+	    size <= spl_kmem_alloc_max) {
+		ptr = spl_kmem_zero_get(size);
+		if (ptr)
+			return (ptr);
+	}
+
 	/*
 	 * Use a loop because kmalloc_node() can fail when GFP_KERNEL is used
 	 * unlike kmem_alloc() with KM_SLEEP on Illumos.
@@ -528,6 +813,8 @@ spl_kmem_fini_tracking(struct list_head *list, spinlock_t *lock)
 int
 spl_kmem_init(void)
 {
+	int rc;
+
 #ifdef DEBUG_KMEM
 	kmem_alloc_used_set(0);
 
@@ -536,12 +823,16 @@ spl_kmem_init(void)
 #endif /* DEBUG_KMEM_TRACKING */
 #endif /* DEBUG_KMEM */
 
-	return (0);
+	rc = spl_kmem_zero_init();
+
+	return (rc);
 }
 
 void
 spl_kmem_fini(void)
 {
+	spl_kmem_zero_fini();
+
 #ifdef DEBUG_KMEM
 	/*
 	 * Display all unreclaimed memory addresses, including the
@@ -25,6 +25,7 @@
 \*****************************************************************************/
 
 #include <linux/seq_file.h>
+#include <linux/poll.h>
 #include <sys/kstat.h>
 #include <sys/vmem.h>
 
@@ -36,6 +37,26 @@ static kmutex_t kstat_module_lock;
 static struct list_head kstat_module_list;
 static kid_t kstat_id;
 
+/*
+ * All pollers of all kstats share a single wait queue.  A kstat may be
+ * deleted while a poller is still registered, a global wait queue cannot
+ * be freed out from under it.  Pollers only need to wake up rarely so
+ * the occasional spurious wake up is inconsequential.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(kstat_poll_waitq);
+
+/* Per-open state, f->private of the seq_file */
+typedef struct kstat_open {
+	kstat_t		*kso_ksp;		/* kstat being read */
+	int		kso_event;		/* last event seen by reader */
+} kstat_open_t;
+
+static inline kstat_t *
+kstat_seq_ksp(struct seq_file *f)
+{
+	return (((kstat_open_t *)f->private)->kso_ksp);
+}
+
 static int
 kstat_resize_raw(kstat_t *ksp)
 {
@@ -118,7 +139,7 @@ EXPORT_SYMBOL(kstat_runq_exit);
 static int
 kstat_seq_show_headers(struct seq_file *f)
 {
-        kstat_t *ksp = (kstat_t *)f->private;
+        kstat_t *ksp = kstat_seq_ksp(f);
 	int rc = 0;
 
         ASSERT(ksp->ks_magic == KS_MAGIC);
@@ -284,7 +305,7 @@ kstat_seq_show_timer(struct seq_file *f, kstat_timer_t *ktp)
 static int
 kstat_seq_show(struct seq_file *f, void *p)
 {
-        kstat_t *ksp = (kstat_t *)f->private;
+        kstat_t *ksp = kstat_seq_ksp(f);
         int rc = 0;
 
         ASSERT(ksp->ks_magic == KS_MAGIC);
@@ -338,8 +359,12 @@ kstat_default_update(kstat_t *ksp, int rw)
 static void *
 kstat_seq_data_addr(kstat_t *ksp, loff_t n)
 {
+        void *data = ksp->ks_data;
         void *rc = NULL;
 
+	if (ksp->ks_flags & KSTAT_FLAG_SEQCOUNT)
+		data = ksp->ks_snap_buf;
+
 	switch (ksp->ks_type) {
                 case KSTAT_TYPE_RAW:
                         if (ksp->ks_raw_ops.addr)
@@ -348,16 +373,16 @@ kstat_seq_data_addr(kstat_t *ksp, loff_t n)
                                 rc = ksp->ks_data;
                         break;
                 case KSTAT_TYPE_NAMED:
-                        rc = ksp->ks_data + n * sizeof(kstat_named_t);
+                        rc = data + n * sizeof(kstat_named_t);
                         break;
                 case KSTAT_TYPE_INTR:
-                        rc = ksp->ks_data + n * sizeof(kstat_intr_t);
+                        rc = data + n * sizeof(kstat_intr_t);
                         break;
                 case KSTAT_TYPE_IO:
-                        rc = ksp->ks_data + n * sizeof(kstat_io_t);
+                        rc = data + n * sizeof(kstat_io_t);
                         break;
                 case KSTAT_TYPE_TIMER:
-                        rc = ksp->ks_data + n * sizeof(kstat_timer_t);
+                        rc = data + n * sizeof(kstat_timer_t);
                         break;
                 default:
                         PANIC("Undefined kstat type %d\n", ksp->ks_type);
@@ -370,21 +395,39 @@ static void *
 kstat_seq_start(struct seq_file *f, loff_t *pos)
 {
         loff_t n = *pos;
-        kstat_t *ksp = (kstat_t *)f->private;
+        kstat_t *ksp = kstat_seq_ksp(f);
         ASSERT(ksp->ks_magic == KS_MAGIC);
 
-	mutex_enter(ksp->ks_lock);
-
-        if (ksp->ks_type == KSTAT_TYPE_RAW) {
-                ksp->ks_raw_bufsize = PAGE_SIZE;
-                ksp->ks_raw_buf = vmem_alloc(ksp->ks_raw_bufsize, KM_SLEEP);
-        }
-
-        /* Dynamically update kstat, on error existing kstats are used */
-        (void) ksp->ks_update(ksp, KSTAT_READ);
+	/*
+	 * Seqcount kstats are formatted from a private snapshot so ks_lock
+	 * is never held while user space consumes the data.  Only other
+	 * readers are serialized against each other by ks_snap_lock.
+	 */
+	if (ksp->ks_flags & KSTAT_FLAG_SEQCOUNT) {
+		mutex_enter(&ksp->ks_snap_lock);
+		ksp->ks_snap_buf = vmem_alloc(ksp->ks_data_size, KM_SLEEP);
+		(void) ksp->ks_update(ksp, KSTAT_READ);
+		__kstat_snapshot(ksp, ksp->ks_snap_buf);
+	} else {
+		mutex_enter(ksp->ks_lock);
+
+		if (ksp->ks_type == KSTAT_TYPE_RAW) {
+			ksp->ks_raw_bufsize = PAGE_SIZE;
+			ksp->ks_raw_buf = vmem_alloc(ksp->ks_raw_bufsize,
+			    KM_SLEEP);
+		}
+
+		/* Dynamically update kstat, on error existing kstats are used */
+		(void) ksp->ks_update(ksp, KSTAT_READ);
+	}
 
 	ksp->ks_snaptime = gethrtime();
 
+	/* Reading from the start consumes any pending change event */
+	if (!n)
+		((kstat_open_t *)f->private)->kso_event =
+		    atomic_read(&ksp->ks_event);
+
         if (!n && kstat_seq_show_headers(f))
 		return (NULL);
 
@@ -397,7 +440,7 @@ kstat_seq_start(struct seq_file *f, loff_t *pos)
 static void *
 kstat_seq_next(struct seq_file *f, void *p, loff_t *pos)
 {
-        kstat_t *ksp = (kstat_t *)f->private;
+        kstat_t *ksp = kstat_seq_ksp(f);
         ASSERT(ksp->ks_magic == KS_MAGIC);
 
         ++*pos;
@@ -410,9 +453,16 @@ kstat_seq_next(struct seq_file *f, void *p, loff_t *pos)
 static void
 kstat_seq_stop(struct seq_file *f, void *v)
 {
-	kstat_t *ksp = (kstat_t *)f->private;
+	kstat_t *ksp = kstat_seq_ksp(f);
 	ASSERT(ksp->ks_magic == KS_MAGIC);
 
+	if (ksp->ks_flags & KSTAT_FLAG_SEQCOUNT) {
+		vmem_free(ksp->ks_snap_buf, ksp->ks_data_size);
+		ksp->ks_snap_buf = NULL;
+		mutex_exit(&ksp->ks_snap_lock);
+		return;
+	}
+
 	if (ksp->ks_type == KSTAT_TYPE_RAW)
 		vmem_free(ksp->ks_raw_buf, ksp->ks_raw_bufsize);
 
@@ -470,17 +520,40 @@ kstat_delete_module(kstat_module_t *module)
 static int
 proc_kstat_open(struct inode *inode, struct file *filp)
 {
-        struct seq_file *f;
-        int rc;
+        kstat_open_t *kso;
+        kstat_t *ksp = PDE_DATA(inode);
+
+        kso = __seq_open_private(filp, &kstat_seq_ops, sizeof (*kso));
+        if (kso == NULL)
+                return (-ENOMEM);
+
+        kso->kso_ksp = ksp;
+        kso->kso_event = atomic_read(&ksp->ks_event);
+
+        return (0);
+}
+
+/*
+ * The kstat is always readable.  POLLPRI and POLLERR are additionally
+ * reported, as for /proc/mounts, once kstat_changed() has been called
+ * since this file was opened or last read from the beginning.
+ */
+static unsigned int
+proc_kstat_poll(struct file *filp, struct poll_table_struct *wait)
+{
+	struct seq_file *f = filp->private_data;
+	kstat_open_t *kso = f->private;
+	kstat_t *ksp = kso->kso_ksp;
+	unsigned int mask = POLLIN | POLLRDNORM;
 
-        rc = seq_open(filp, &kstat_seq_ops);
-        if (rc)
-                return rc;
+	ASSERT(ksp->ks_magic == KS_MAGIC);
 
-        f = filp->private_data;
-        f->private = PDE_DATA(inode);
+	poll_wait(filp, &kstat_poll_waitq, wait);
 
-        return rc;
+	if (atomic_read(&ksp->ks_event) != kso->kso_event)
+		mask |= POLLERR | POLLPRI;
+
+	return (mask);
 }
 
 static ssize_t
@@ -488,7 +561,7 @@ proc_kstat_write(struct file *filp, const char __user *buf,
 		 size_t len, loff_t *ppos)
 {
 	struct seq_file *f = filp->private_data;
-	kstat_t *ksp = f->private;
+	kstat_t *ksp = kstat_seq_ksp(f);
 	int rc;
 
 	ASSERT(ksp->ks_magic == KS_MAGIC);
@@ -509,9 +582,28 @@ static struct file_operations proc_kstat_operations = {
 	.write		= proc_kstat_write,
 	.read		= seq_read,
 	.llseek		= seq_lseek,
-	.release	= seq_release,
+	.poll		= proc_kstat_poll,
+	.release	= seq_release_private,
 };
 
+/*
+ * Signal that the kstat has changed, or that a consumer defined threshold
+ * was crossed, and wake up any user space pollers.  This is cheap when
+ * nobody is polling and may be called from any context.
+ */
+void
+__kstat_changed(kstat_t *ksp)
+{
+	ASSERT(ksp->ks_magic == KS_MAGIC);
+
+	atomic_inc(&ksp->ks_event);
+	smp_mb();
+
+	if (waitqueue_active(&kstat_poll_waitq))
+		wake_up_interruptible(&kstat_poll_waitq);
+}
+EXPORT_SYMBOL(__kstat_changed);
+
 void
 __kstat_set_raw_ops(kstat_t *ksp,
 		    int (*headers)(char *buf, size_t size),
@@ -524,6 +616,26 @@ __kstat_set_raw_ops(kstat_t *ksp,
 }
 EXPORT_SYMBOL(__kstat_set_raw_ops);
 
+/*
+ * Copy the data of a KSTAT_FLAG_SEQCOUNT kstat in to buf without blocking
+ * updaters.  The copy is retried until it completes without a concurrent
+ * kstat_update_enter()/kstat_update_exit() section.
+ */
+void
+__kstat_snapshot(kstat_t *ksp, void *buf)
+{
+	unsigned int seq;
+
+	ASSERT(ksp->ks_magic == KS_MAGIC);
+	ASSERT(ksp->ks_flags & KSTAT_FLAG_SEQCOUNT);
+
+	do {
+		seq = read_seqcount_begin(&ksp->ks_seq);
+		memcpy(buf, ksp->ks_data, ksp->ks_data_size);
+	} while (read_seqcount_retry(&ksp->ks_seq, seq));
+}
+EXPORT_SYMBOL(__kstat_snapshot);
+
 kstat_t *
 __kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
              const char *ks_class, uchar_t ks_type, uint_t ks_ndata,
@@ -539,6 +651,10 @@ __kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
 	if ((ks_type == KSTAT_TYPE_INTR) || (ks_type == KSTAT_TYPE_IO))
                 ASSERT(ks_ndata == 1);
 
+	/* Raw kstats are formatted by the consumer and cannot be snapshot */
+	if (ks_flags & KSTAT_FLAG_SEQCOUNT)
+		ASSERT(ks_type != KSTAT_TYPE_RAW);
+
 	ksp = kmem_zalloc(sizeof(*ksp), KM_SLEEP);
 	if (ksp == NULL)
 		return ksp;
@@ -551,6 +667,9 @@ __kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
         ksp->ks_magic = KS_MAGIC;
 	mutex_init(&ksp->ks_private_lock, NULL, MUTEX_DEFAULT, NULL);
 	ksp->ks_lock = &ksp->ks_private_lock;
+	mutex_init(&ksp->ks_snap_lock, NULL, MUTEX_DEFAULT, NULL);
+	seqcount_init(&ksp->ks_seq);
+	atomic_set(&ksp->ks_event, 0);
 	INIT_LIST_HEAD(&ksp->ks_list);
 
 	ksp->ks_crtime = gethrtime();
@@ -671,6 +790,7 @@ __kstat_delete(kstat_t *ksp)
 		kmem_free(ksp->ks_data, ksp->ks_data_size);
 
 	ksp->ks_lock = NULL;
+	mutex_destroy(&ksp->ks_snap_lock);
 	mutex_destroy(&ksp->ks_private_lock);
 	kmem_free(ksp, sizeof(*ksp));
 
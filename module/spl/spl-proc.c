@@ -28,6 +28,8 @@
 #include <sys/kstat.h>
 #include <sys/kmem.h>
 #include <sys/kmem_cache.h>
+#include <sys/kmem_page.h>
+#include <sys/taskq.h>
 #include <sys/vmem.h>
 #include <linux/ctype.h>
 #include <linux/kmod.h>
@@ -49,6 +51,7 @@ static struct ctl_table_header *spl_header = NULL;
 static struct proc_dir_entry *proc_spl = NULL;
 static struct proc_dir_entry *proc_spl_kmem = NULL;
 static struct proc_dir_entry *proc_spl_kmem_slab = NULL;
+static struct proc_dir_entry *proc_spl_taskq = NULL;
 struct proc_dir_entry *proc_spl_kstat = NULL;
 
 static int
@@ -180,6 +183,36 @@ proc_doslab(struct ctl_table *table, int write,
         return (rc);
 }
 
+/*
+ * Report a statistic maintained by another subsystem.  The table data
+ * selects the statistic which is returned by the function in extra1.
+ */
+typedef uint64_t (*proc_stat_func_t)(int);
+
+static int
+proc_dostat(struct ctl_table *table, int write,
+    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+        int rc = 0;
+        unsigned long min = 0, max = ~0, val;
+        proc_stat_func_t func = (proc_stat_func_t)table->extra1;
+        spl_ctl_table dummy = *table;
+
+        dummy.data = &val;
+        dummy.proc_handler = &proc_dointvec;
+        dummy.extra1 = &min;
+        dummy.extra2 = &max;
+
+        if (write) {
+                *ppos += *lenp;
+        } else {
+                val = func((int)(unsigned long)table->data);
+                rc = proc_doulongvec_minmax(&dummy, write, buffer, lenp, ppos);
+        }
+
+        return (rc);
+}
+
 static int
 proc_dohostid(struct ctl_table *table, int write,
     void __user *buffer, size_t *lenp, loff_t *ppos)
@@ -223,48 +256,108 @@ slab_seq_show_headers(struct seq_file *f)
             "---------------------------------------------  "
             "----- slab ------  "
             "---- object -----  "
-            "--- emergency ---\n");
+            "--- emergency ---  "
+            "--- magazine ---  "
+            "--- backend ---\n");
         seq_printf(f,
             "name                                  "
             "  flags      size     alloc slabsize  objsize  "
             "total alloc   max  "
             "total alloc   max  "
-            "dlock alloc   max\n");
+            "dlock alloc   max  "
+            "  max      size  "
+            "   rate reason\n");
 }
 
-static int
-slab_seq_show(struct seq_file *f, void *p)
+static void
+slab_seq_show_footer(struct seq_file *f)
 {
-        spl_kmem_cache_t *skc = p;
+	uint64_t total, limit;
 
-        ASSERT(skc->skc_magic == SKC_MAGIC);
+	total = spl_kmem_cache_magazine_total(&limit);
+	seq_printf(f, "total magazine %llu bytes, limit %llu bytes\n",
+	    (unsigned long long)total, (unsigned long long)limit);
+}
+
+static void
+slab_seq_show_cache(struct seq_file *f, spl_kmem_cache_t *skc)
+{
+        uint64_t mag_bytes;
+	unsigned long linux_alloc, linux_max;
 
 	/*
-	 * Backed by Linux slab see /proc/slabinfo.
+	 * Objects allocated from the Linux slab are only counted, their
+	 * slabs are reported in /proc/slabinfo.
 	 */
-	if (skc->skc_flags & KMC_SLAB)
-		return (0);
+        mag_bytes = spl_kmem_cache_magazine_bytes(skc);
+	linux_alloc = spl_kmem_cache_linux_alloc(skc);
+	linux_max = skc->skc_linux_max;
 
         spin_lock(&skc->skc_lock);
         seq_printf(f, "%-36s  ", skc->skc_name);
         seq_printf(f, "0x%05lx %9lu %9lu %8u %8u  "
-            "%5lu %5lu %5lu  %5lu %5lu %5lu  %5lu %5lu %5lu\n",
+            "%5lu %5lu %5lu  %5lu %5lu %5lu  %5lu %5lu %5lu  %5u %9lu  "
+            "%7lu %-6s\n",
             (long unsigned)skc->skc_flags,
             (long unsigned)(skc->skc_slab_size * skc->skc_slab_total),
-            (long unsigned)(skc->skc_obj_size * skc->skc_obj_alloc),
+            (long unsigned)(skc->skc_obj_size *
+            (skc->skc_obj_alloc + linux_alloc)),
             (unsigned)skc->skc_slab_size,
             (unsigned)skc->skc_obj_size,
             (long unsigned)skc->skc_slab_total,
             (long unsigned)skc->skc_slab_alloc,
             (long unsigned)skc->skc_slab_max,
-            (long unsigned)skc->skc_obj_total,
-            (long unsigned)skc->skc_obj_alloc,
-            (long unsigned)skc->skc_obj_max,
+            (long unsigned)(skc->skc_obj_total + linux_alloc),
+            (long unsigned)(skc->skc_obj_alloc + linux_alloc),
+            (long unsigned)(skc->skc_obj_max + linux_max),
             (long unsigned)skc->skc_obj_deadlock,
             (long unsigned)skc->skc_obj_emergency,
-            (long unsigned)skc->skc_obj_emergency_max);
+            (long unsigned)skc->skc_obj_emergency_max,
+            (unsigned)skc->skc_mag_target,
+            (long unsigned)mag_bytes,
+            (long unsigned)skc->skc_auto_rate,
+            spl_kmem_cache_reason(skc));
+
+	/*
+	 * Caches merged on to this backing cache only track the number
+	 * of objects they have allocated.  These bytes are already included
+	 * in the backing cache row, the "merge" reason identifies the alias
+	 * rows so they are not counted twice when summing all caches.
+	 */
+	if (skc->skc_flags & KMC_MERGE) {
+		spl_kmem_cache_t *mskc;
+		unsigned long alloc;
+
+		list_for_each_entry(mskc, &skc->skc_merge_list,
+		    skc_merge_list) {
+			alloc = atomic_long_read(&mskc->skc_merge_alloc);
+			seq_printf(f, "  %-34s  ", mskc->skc_name);
+			seq_printf(f, "0x%05lx %9lu %9lu %8u %8u  "
+			    "%5lu %5lu %5lu  %5lu %5lu %5lu  %5lu %5lu %5lu  "
+			    "%5u %9lu  %7lu %-6s\n",
+			    (long unsigned)mskc->skc_flags, 0UL,
+			    (long unsigned)(mskc->skc_obj_size * alloc),
+			    0U, (unsigned)mskc->skc_obj_size,
+			    0UL, 0UL, 0UL, 0UL, alloc, 0UL, 0UL, 0UL, 0UL,
+			    0U, 0UL, 0UL, spl_kmem_cache_reason(mskc));
+		}
+	}
 
         spin_unlock(&skc->skc_lock);
+}
+
+static int
+slab_seq_show(struct seq_file *f, void *p)
+{
+        spl_kmem_cache_t *skc = p;
+
+        ASSERT(skc->skc_magic == SKC_MAGIC);
+
+	slab_seq_show_cache(f, skc);
+
+	/* Summarize all caches after the last one */
+	if (skc->skc_list.next == &spl_kmem_cache_list)
+		slab_seq_show_footer(f);
 
         return 0;
 }
@@ -325,6 +418,93 @@ static struct file_operations proc_slab_operations = {
         .release        = seq_release,
 };
 
+static void
+taskq_seq_show_headers(struct seq_file *f)
+{
+	seq_printf(f, "%-31s %5s %5s %5s %8s %8s %10s %10s %12s %10s\n",
+	    "taskq", "act", "nthr", "maxt", "queued", "limit",
+	    "throttled", "failed", "throttle_ms", "coalesced");
+}
+
+static int
+taskq_seq_show(struct seq_file *f, void *p)
+{
+	taskq_t *tq = p;
+	unsigned long flags;
+
+	spin_lock_irqsave_nested(&tq->tq_lock, flags, tq->tq_lock_class);
+	seq_printf(f, "%-31s %5d %5d %5d %8d %8d "
+	    "%10llu %10llu %12llu %10llu\n",
+	    tq->tq_name, tq->tq_nactive, tq->tq_nthreads, tq->tq_maxthreads,
+	    tq->tq_nqueued, tq->tq_limit,
+	    (unsigned long long)tq->tq_throttle_count,
+	    (unsigned long long)tq->tq_throttle_fail,
+	    (unsigned long long)NSEC2MSEC(tq->tq_throttle_time),
+	    (unsigned long long)tq->tq_coalesced);
+	spin_unlock_irqrestore(&tq->tq_lock, flags);
+
+	return (0);
+}
+
+static void *
+taskq_seq_start(struct seq_file *f, loff_t *pos)
+{
+	struct list_head *p;
+	loff_t n = *pos;
+
+	down_read(&spl_taskq_sem);
+	if (!n)
+		taskq_seq_show_headers(f);
+
+	p = spl_taskq_list.next;
+	while (n--) {
+		p = p->next;
+		if (p == &spl_taskq_list)
+			return (NULL);
+	}
+
+	if (p == &spl_taskq_list)
+		return (NULL);
+
+	return (list_entry(p, taskq_t, tq_taskqs));
+}
+
+static void *
+taskq_seq_next(struct seq_file *f, void *p, loff_t *pos)
+{
+	taskq_t *tq = p;
+
+	++*pos;
+	return ((tq->tq_taskqs.next == &spl_taskq_list) ?
+	    NULL : list_entry(tq->tq_taskqs.next, taskq_t, tq_taskqs));
+}
+
+static void
+taskq_seq_stop(struct seq_file *f, void *v)
+{
+	up_read(&spl_taskq_sem);
+}
+
+static struct seq_operations taskq_seq_ops = {
+	.show  = taskq_seq_show,
+	.start = taskq_seq_start,
+	.next  = taskq_seq_next,
+	.stop  = taskq_seq_stop,
+};
+
+static int
+proc_taskq_open(struct inode *inode, struct file *filp)
+{
+	return (seq_open(filp, &taskq_seq_ops));
+}
+
+static struct file_operations proc_taskq_operations = {
+	.open		= proc_taskq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 static struct ctl_table spl_kmem_table[] = {
 #ifdef DEBUG_KMEM
         {
@@ -402,6 +582,86 @@ static struct ctl_table spl_kmem_table[] = {
                 .mode     = 0444,
                 .proc_handler = &proc_doslab,
         },
+        {
+                .procname = "zero_pool_hits",
+		.data     = (void *)SPL_KMEM_ZERO_HITS,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_zero_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "zero_pool_misses",
+		.data     = (void *)SPL_KMEM_ZERO_MISSES,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_zero_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "zero_pool_refills",
+		.data     = (void *)SPL_KMEM_ZERO_REFILLS,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_zero_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "reap_wakeups",
+		.data     = (void *)SPL_KMEM_REAP_WAKEUPS,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_reap_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "reap_active",
+		.data     = (void *)SPL_KMEM_REAP_ACTIVE,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_reap_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "reap_caches",
+		.data     = (void *)SPL_KMEM_REAP_CACHES,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_reap_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "reap_bytes",
+		.data     = (void *)SPL_KMEM_REAP_BYTES,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&spl_kmem_reap_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "page_pool_hits",
+		.data     = (void *)SPL_KMEM_PAGE_HITS,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&kmem_page_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "page_pool_misses",
+		.data     = (void *)SPL_KMEM_PAGE_MISSES,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&kmem_page_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
+        {
+                .procname = "page_pool_pages",
+		.data     = (void *)SPL_KMEM_PAGE_POOLED,
+                .maxlen   = sizeof(unsigned long),
+                .extra1   = (void *)&kmem_page_stat,
+                .mode     = 0444,
+                .proc_handler = &proc_dostat,
+        },
 	{0},
 };
 
@@ -489,6 +749,13 @@ spl_proc_init(void)
 		goto out;
 	}
 
+	proc_spl_taskq = proc_create_data("taskq", 0444,
+		proc_spl, &proc_taskq_operations, NULL);
+	if (proc_spl_taskq == NULL) {
+		rc = -EUNATCH;
+		goto out;
+	}
+
         proc_spl_kstat = proc_mkdir("kstat", proc_spl);
         if (proc_spl_kstat == NULL) {
                 rc = -EUNATCH;
@@ -497,6 +764,7 @@ spl_proc_init(void)
 out:
 	if (rc) {
 		remove_proc_entry("kstat", proc_spl);
+		remove_proc_entry("taskq", proc_spl);
 	        remove_proc_entry("slab", proc_spl_kmem);
 		remove_proc_entry("kmem", proc_spl);
 		remove_proc_entry("spl", NULL);
@@ -510,6 +778,7 @@ void
 spl_proc_fini(void)
 {
 	remove_proc_entry("kstat", proc_spl);
+	remove_proc_entry("taskq", proc_spl);
         remove_proc_entry("slab", proc_spl_kmem);
 	remove_proc_entry("kmem", proc_spl);
 	remove_proc_entry("spl", NULL);
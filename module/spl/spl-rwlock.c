@@ -25,6 +25,7 @@
 \*****************************************************************************/
 
 #include <sys/rwlock.h>
+#include <sys/kmem.h>
 
 #ifdef DEBUG_SUBSYSTEM
 #undef DEBUG_SUBSYSTEM
@@ -92,5 +93,308 @@ EXPORT_SYMBOL(__down_write_trylock_locked);
 
 #endif
 
+/*
+ * State for a krwlock_t initialized with a policy other than the default.
+ * The native rw_semaphore embedded in the krwlock_t is unused in this case
+ * and all waiters sleep on a single wait queue which is woken when the lock
+ * state changes in a way which may allow them to proceed.
+ */
+typedef struct spl_rw_policy {
+	spinlock_t		rwp_lock;
+	krw_policy_t		rwp_policy;
+	kthread_t		*rwp_owner;	/* Writer holding the lock */
+	int			rwp_readers;	/* Active readers */
+	int			rwp_rwait;	/* Waiting readers */
+	int			rwp_wwait;	/* Waiting writers */
+	uint64_t		rwp_phase;	/* Completed write phases */
+	uint64_t		rwp_ticket;	/* Next writer ticket */
+	uint64_t		rwp_serving;	/* Writer ticket being served */
+	wait_queue_head_t	rwp_waitq;
+} spl_rw_policy_t;
+
+void
+spl_rw_policy_init(krwlock_t *rwp, krw_policy_t policy)
+{
+	spl_rw_policy_t *rwpp;
+
+	ASSERT(policy == RW_POLICY_WRITER || policy == RW_POLICY_READER ||
+	    policy == RW_POLICY_FAIR);
+
+	rwpp = kmem_zalloc(sizeof (spl_rw_policy_t), KM_SLEEP);
+	spin_lock_init(&rwpp->rwp_lock);
+	init_waitqueue_head(&rwpp->rwp_waitq);
+	rwpp->rwp_policy = policy;
+	rwp->rw_policy = rwpp;
+}
+EXPORT_SYMBOL(spl_rw_policy_init);
+
+void
+spl_rw_policy_destroy(krwlock_t *rwp)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+
+	ASSERT0(rwpp->rwp_readers);
+	ASSERT0(rwpp->rwp_rwait);
+	ASSERT0(rwpp->rwp_wwait);
+	ASSERT3P(rwpp->rwp_owner, ==, NULL);
+
+	rwp->rw_policy = NULL;
+	kmem_free(rwpp, sizeof (spl_rw_policy_t));
+}
+EXPORT_SYMBOL(spl_rw_policy_destroy);
+
+int
+spl_rw_policy_held(krwlock_t *rwp, krw_t rw)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+
+	switch (rw) {
+	case RW_READER:
+		return (ACCESS_ONCE(rwpp->rwp_readers) > 0);
+	case RW_WRITER:
+		return (ACCESS_ONCE(rwpp->rwp_owner) == current);
+	default:
+		return (ACCESS_ONCE(rwpp->rwp_readers) > 0 ||
+		    ACCESS_ONCE(rwpp->rwp_owner) != NULL);
+	}
+}
+EXPORT_SYMBOL(spl_rw_policy_held);
+
+/*
+ * NOTE: Must be called with rwp_lock held.  A reader which arrived during
+ * write phase 'phase' may enter when no writer holds the lock and the
+ * policy does not require it to yield to waiting writers.  Under the fair
+ * policy waiting readers are instead admitted as a group by the writer
+ * which ends the phase, see spl_rw_policy_grant().
+ */
+static int
+spl_rw_policy_read_ok(spl_rw_policy_t *rwpp, uint64_t phase)
+{
+	if (rwpp->rwp_owner != NULL)
+		return (0);
+
+	switch (rwpp->rwp_policy) {
+	case RW_POLICY_READER:
+		return (1);
+	case RW_POLICY_FAIR:
+		return (rwpp->rwp_wwait == 0 || rwpp->rwp_phase != phase);
+	default:
+		return (rwpp->rwp_wwait == 0);
+	}
+}
+
+/*
+ * NOTE: Must be called with rwp_lock held.  A writer holding 'ticket' may
+ * enter once the lock is free and the policy does not require it to yield
+ * to readers or to writers which arrived before it.
+ */
+static int
+spl_rw_policy_write_ok(spl_rw_policy_t *rwpp, uint64_t ticket)
+{
+	if (rwpp->rwp_owner != NULL || rwpp->rwp_readers > 0)
+		return (0);
+
+	switch (rwpp->rwp_policy) {
+	case RW_POLICY_READER:
+		return (rwpp->rwp_rwait == 0);
+	case RW_POLICY_FAIR:
+		return (rwpp->rwp_serving == ticket);
+	default:
+		return (1);
+	}
+}
+
+/*
+ * NOTE: Must be called with rwp_lock held.  Ends the current write phase
+ * and under the fair policy hands the lock to every waiting reader before
+ * the next writer can claim it.  Returns non-zero when waiters must be
+ * woken.
+ */
+static int
+spl_rw_policy_grant(spl_rw_policy_t *rwpp)
+{
+	rwpp->rwp_phase++;
+
+	if (rwpp->rwp_policy == RW_POLICY_FAIR) {
+		rwpp->rwp_readers += rwpp->rwp_rwait;
+		rwpp->rwp_rwait = 0;
+	}
+
+	return (rwpp->rwp_readers > 0 || rwpp->rwp_rwait > 0 ||
+	    rwpp->rwp_wwait > 0);
+}
+
+int
+spl_rw_policy_tryenter(krwlock_t *rwp, krw_t rw)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+	int rc = 0;
+
+	spin_lock(&rwpp->rwp_lock);
+	switch (rw) {
+	case RW_READER:
+		if (spl_rw_policy_read_ok(rwpp, rwpp->rwp_phase)) {
+			rwpp->rwp_readers++;
+			rc = 1;
+		}
+		break;
+	case RW_WRITER:
+		if (rwpp->rwp_wwait == 0 &&
+		    spl_rw_policy_write_ok(rwpp, rwpp->rwp_ticket)) {
+			rwpp->rwp_owner = current;
+			rwpp->rwp_ticket++;
+			rwpp->rwp_serving++;
+			rc = 1;
+		}
+		break;
+	default:
+		VERIFY(0);
+	}
+	spin_unlock(&rwpp->rwp_lock);
+
+	return (rc);
+}
+EXPORT_SYMBOL(spl_rw_policy_tryenter);
+
+void
+spl_rw_policy_enter(krwlock_t *rwp, krw_t rw)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+	uint64_t phase, ticket;
+	DEFINE_WAIT(wait);
+
+	spin_lock(&rwpp->rwp_lock);
+	switch (rw) {
+	case RW_READER:
+		phase = rwpp->rwp_phase;
+		if (spl_rw_policy_read_ok(rwpp, phase)) {
+			rwpp->rwp_readers++;
+			break;
+		}
+
+		rwpp->rwp_rwait++;
+		if (rwpp->rwp_policy == RW_POLICY_FAIR) {
+			/* Admitted by spl_rw_policy_grant() */
+			while (rwpp->rwp_phase == phase) {
+				prepare_to_wait(&rwpp->rwp_waitq, &wait,
+				    TASK_UNINTERRUPTIBLE);
+				spin_unlock(&rwpp->rwp_lock);
+				schedule();
+				spin_lock(&rwpp->rwp_lock);
+			}
+			finish_wait(&rwpp->rwp_waitq, &wait);
+			break;
+		}
+
+		do {
+			prepare_to_wait(&rwpp->rwp_waitq, &wait,
+			    TASK_UNINTERRUPTIBLE);
+			spin_unlock(&rwpp->rwp_lock);
+			schedule();
+			spin_lock(&rwpp->rwp_lock);
+		} while (!spl_rw_policy_read_ok(rwpp, phase));
+		finish_wait(&rwpp->rwp_waitq, &wait);
+		rwpp->rwp_rwait--;
+		rwpp->rwp_readers++;
+		break;
+	case RW_WRITER:
+		ticket = rwpp->rwp_ticket++;
+		if (rwpp->rwp_wwait > 0 ||
+		    !spl_rw_policy_write_ok(rwpp, ticket)) {
+			rwpp->rwp_wwait++;
+			do {
+				prepare_to_wait(&rwpp->rwp_waitq, &wait,
+				    TASK_UNINTERRUPTIBLE);
+				spin_unlock(&rwpp->rwp_lock);
+				schedule();
+				spin_lock(&rwpp->rwp_lock);
+			} while (!spl_rw_policy_write_ok(rwpp, ticket));
+			finish_wait(&rwpp->rwp_waitq, &wait);
+			rwpp->rwp_wwait--;
+		}
+
+		rwpp->rwp_owner = current;
+		rwpp->rwp_serving++;
+		break;
+	default:
+		VERIFY(0);
+	}
+	spin_unlock(&rwpp->rwp_lock);
+}
+EXPORT_SYMBOL(spl_rw_policy_enter);
+
+void
+spl_rw_policy_exit(krwlock_t *rwp)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+	int wake = 0;
+
+	spin_lock(&rwpp->rwp_lock);
+	if (rwpp->rwp_owner == current) {
+		rwpp->rwp_owner = NULL;
+		wake = spl_rw_policy_grant(rwpp);
+	} else {
+		ASSERT3S(rwpp->rwp_readers, >, 0);
+		rwpp->rwp_readers--;
+		wake = (rwpp->rwp_readers == 0 && rwpp->rwp_wwait > 0);
+	}
+	spin_unlock(&rwpp->rwp_lock);
+
+	if (wake)
+		wake_up_all(&rwpp->rwp_waitq);
+}
+EXPORT_SYMBOL(spl_rw_policy_exit);
+
+/*
+ * Convert the write lock to a read lock.  This ends the write phase so
+ * waiting readers may join the caller as the policy allows, under the
+ * writer policy that only happens when no writers are waiting.
+ */
+void
+spl_rw_policy_downgrade(krwlock_t *rwp)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+	int wake;
+
+	spin_lock(&rwpp->rwp_lock);
+	ASSERT3P(rwpp->rwp_owner, ==, current);
+	rwpp->rwp_owner = NULL;
+	rwpp->rwp_readers++;
+	(void) spl_rw_policy_grant(rwpp);
+	wake = (rwpp->rwp_readers > 1 || rwpp->rwp_rwait > 0);
+	spin_unlock(&rwpp->rwp_lock);
+
+	if (wake)
+		wake_up_all(&rwpp->rwp_waitq);
+}
+EXPORT_SYMBOL(spl_rw_policy_downgrade);
+
+/*
+ * Convert a read lock to a write lock if the caller is the only reader.
+ * Under the fair policy the upgrade also fails when writers are waiting
+ * since they were queued first.
+ */
+int
+spl_rw_policy_tryupgrade(krwlock_t *rwp)
+{
+	spl_rw_policy_t *rwpp = rwp->rw_policy;
+	int rc = 0;
+
+	spin_lock(&rwpp->rwp_lock);
+	ASSERT3S(rwpp->rwp_readers, >, 0);
+	if (rwpp->rwp_readers == 1 && (rwpp->rwp_policy != RW_POLICY_FAIR ||
+	    rwpp->rwp_wwait == 0)) {
+		rwpp->rwp_readers = 0;
+		rwpp->rwp_owner = current;
+		rwpp->rwp_ticket++;
+		rwpp->rwp_serving++;
+		rc = 1;
+	}
+	spin_unlock(&rwpp->rwp_lock);
+
+	return (rc);
+}
+EXPORT_SYMBOL(spl_rw_policy_tryupgrade);
+
 int spl_rw_init(void) { return 0; }
 void spl_rw_fini(void) { }
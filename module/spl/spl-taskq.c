@@ -26,6 +26,7 @@
 
 #include <sys/taskq.h>
 #include <sys/kmem.h>
+#include <sys/time.h>
 
 int spl_taskq_thread_bind = 0;
 module_param(spl_taskq_thread_bind, int, 0644);
@@ -50,10 +51,25 @@ MODULE_PARM_DESC(spl_taskq_thread_sequential,
 taskq_t *system_taskq;
 EXPORT_SYMBOL(system_taskq);
 
+/* List of all taskqs, reported by /proc/spl/taskq */
+LIST_HEAD(spl_taskq_list);
+DECLARE_RWSEM(spl_taskq_sem);
+
 /* Private dedicated taskq for creating new taskq threads on demand. */
 static taskq_t *dynamic_taskq;
 static taskq_thread_t *taskq_thread_create(taskq_t *);
 
+/*
+ * Timer state for a task dispatched with taskq_dispatch_delay().  It is
+ * owned by the taskq_ent_t while the task sits on the delay list and is
+ * freed by whichever of task_expire() or taskq_cancel_id() detaches it.
+ */
+typedef struct taskq_delay {
+	struct timer_list	tqd_timer;
+	taskq_t			*tqd_taskq;
+	taskq_ent_t		*tqd_ent;
+} taskq_delay_t;
+
 static int
 task_km_flags(uint_t flags)
 {
@@ -85,7 +101,7 @@ retry:
 
 		ASSERT(!(t->tqent_flags & TQENT_FLAG_PREALLOC));
 		ASSERT(!(t->tqent_flags & TQENT_FLAG_CANCEL));
-		ASSERT(!timer_pending(&t->tqent_timer));
+		ASSERT3P(t->tqent_delay, ==, NULL);
 
 		list_del_init(&t->tqent_list);
 		return (t);
@@ -144,7 +160,7 @@ task_free(taskq_t *tq, taskq_ent_t *t)
 	ASSERT(t);
 	ASSERT(spin_is_locked(&tq->tq_lock));
 	ASSERT(list_empty(&t->tqent_list));
-	ASSERT(!timer_pending(&t->tqent_timer));
+	ASSERT3P(t->tqent_delay, ==, NULL);
 
 	kmem_free(t, sizeof (taskq_ent_t));
 	tq->tq_nalloc--;
@@ -161,9 +177,6 @@ task_done(taskq_t *tq, taskq_ent_t *t)
 	ASSERT(t);
 	ASSERT(spin_is_locked(&tq->tq_lock));
 
-	/* Wake tasks blocked in taskq_wait_id() */
-	wake_up_all(&t->tqent_waitq);
-
 	list_del_init(&t->tqent_list);
 
 	if (tq->tq_nalloc <= tq->tq_minalloc) {
@@ -185,19 +198,24 @@ task_done(taskq_t *tq, taskq_ent_t *t)
 static void
 task_expire(unsigned long data)
 {
-	taskq_ent_t *w, *t = (taskq_ent_t *)data;
-	taskq_t *tq = t->tqent_taskq;
+	taskq_delay_t *d = (taskq_delay_t *)data;
+	taskq_ent_t *w, *t = d->tqd_ent;
+	taskq_t *tq = d->tqd_taskq;
 	struct list_head *l;
 	unsigned long flags;
 
 	spin_lock_irqsave_nested(&tq->tq_lock, flags, tq->tq_lock_class);
 
+	/* The canceling thread is responsible for freeing the timer */
 	if (t->tqent_flags & TQENT_FLAG_CANCEL) {
 		ASSERT(list_empty(&t->tqent_list));
 		spin_unlock_irqrestore(&tq->tq_lock, flags);
 		return;
 	}
 
+	ASSERT3P(t->tqent_delay, ==, d);
+	t->tqent_delay = NULL;
+
 	/*
 	 * The priority list must be maintained in strict task id order
 	 * from lowest to highest for lowest_id to be easily calculable.
@@ -216,6 +234,7 @@ task_expire(unsigned long data)
 	spin_unlock_irqrestore(&tq->tq_lock, flags);
 
 	wake_up(&tq->tq_work_waitq);
+	kmem_free(d, sizeof (taskq_delay_t));
 }
 
 /*
@@ -244,6 +263,12 @@ taskq_lowest_id(taskq_t *tq)
 		lowest_id = MIN(lowest_id, t->tqent_id);
 	}
 
+	if (!list_empty(&tq->tq_coalesce_list)) {
+		t = list_entry(tq->tq_coalesce_list.next, taskq_ent_t,
+		    tqent_list);
+		lowest_id = MIN(lowest_id, t->tqent_id);
+	}
+
 	if (!list_empty(&tq->tq_delay_list)) {
 		t = list_entry(tq->tq_delay_list.next, taskq_ent_t, tqent_list);
 		lowest_id = MIN(lowest_id, t->tqent_id);
@@ -336,6 +361,10 @@ taskq_find(taskq_t *tq, taskqid_t id, int *active)
 	if (t)
 		return (t);
 
+	t = taskq_find_list(tq, &tq->tq_coalesce_list, id);
+	if (t)
+		return (t);
+
 	list_for_each(l, &tq->tq_active_list) {
 		tqt = list_entry(l, taskq_thread_t, tqt_active_list);
 		if (tqt->tqt_id == id) {
@@ -348,6 +377,27 @@ taskq_find(taskq_t *tq, taskqid_t id, int *active)
 	return (NULL);
 }
 
+/*
+ * Return the pending task dispatched with TQ_COALESCE for this function
+ * and argument if one exists.  Only tasks which have not yet started are
+ * considered, a task which is already running may have missed the event
+ * the caller is signaling so it must be queued again.
+ */
+static taskq_ent_t *
+taskq_find_coalesce(taskq_t *tq, task_func_t func, void *arg)
+{
+	taskq_ent_t *t;
+
+	ASSERT(spin_is_locked(&tq->tq_lock));
+
+	list_for_each_entry(t, &tq->tq_coalesce_list, tqent_list) {
+		if (t->tqent_func == func && t->tqent_arg == arg)
+			return (t);
+	}
+
+	return (NULL);
+}
+
 /*
  * Theory for the taskq_wait_id(), taskq_wait_outstanding(), and
  * taskq_wait() functions below.
@@ -488,6 +538,100 @@ taskq_member(taskq_t *tq, void *t)
 }
 EXPORT_SYMBOL(taskq_member);
 
+/*
+ * NOTE: Must be called with tq->tq_lock held.  A queued task has been
+ * removed from the pend, prio or delay lists, wake a throttled dispatcher
+ * once the taskq drops back below its limit.
+ */
+static void
+taskq_unthrottle(taskq_t *tq)
+{
+	ASSERT(spin_is_locked(&tq->tq_lock));
+	ASSERT3S(tq->tq_nqueued, >, 0);
+
+	tq->tq_nqueued--;
+
+	/*
+	 * Throttled dispatchers test tq_nqueued without the tq_lock.  Order
+	 * the store above against the waitqueue check or a dispatcher which
+	 * is about to sleep may miss its wakeup.
+	 */
+	smp_mb();
+	if (tq->tq_nqueued < tq->tq_limit &&
+	    waitqueue_active(&tq->tq_throttle_waitq))
+		wake_up(&tq->tq_throttle_waitq);
+}
+
+static int
+taskq_throttle_check(taskq_t *tq)
+{
+	return (ACCESS_ONCE(tq->tq_nqueued) < ACCESS_ONCE(tq->tq_limit) ||
+	    ACCESS_ONCE(tq->tq_limit) == 0 ||
+	    !(ACCESS_ONCE(tq->tq_flags) & TASKQ_ACTIVE));
+}
+
+/*
+ * NOTE: Must be called with tq->tq_lock held.  When the taskq has a limit
+ * and it has been reached TQ_SLEEP dispatchers block until a worker takes
+ * a task off the queue, the time spent waiting is accumulated in
+ * tq_throttle_time.  Other dispatchers fail with ENOSPC.  Threads which
+ * belong to the taskq are never throttled since they are the ones which
+ * must drain it.  Callers must recheck TASKQ_ACTIVE since the lock may
+ * have been dropped.
+ */
+static int
+taskq_throttle(taskq_t *tq, uint_t flags, unsigned long *irqflags)
+{
+	hrtime_t start;
+
+	ASSERT(spin_is_locked(&tq->tq_lock));
+
+	if (taskq_throttle_check(tq))
+		return (0);
+
+	if (flags & (TQ_NOSLEEP | TQ_NOQUEUE)) {
+		tq->tq_throttle_fail++;
+		return (ENOSPC);
+	}
+
+	if (taskq_member_impl(tq, current))
+		return (0);
+
+	start = gethrtime();
+	do {
+		spin_unlock_irqrestore(&tq->tq_lock, *irqflags);
+		wait_event(tq->tq_throttle_waitq, taskq_throttle_check(tq));
+		spin_lock_irqsave_nested(&tq->tq_lock, *irqflags,
+		    tq->tq_lock_class);
+	} while (!taskq_throttle_check(tq));
+
+	tq->tq_throttle_count++;
+	tq->tq_throttle_time += gethrtime() - start;
+
+	return (0);
+}
+
+/*
+ * Limit the number of tasks which may be queued but not yet running on
+ * the taskq.  Dispatchers beyond the limit are throttled as described by
+ * taskq_throttle().  A limit of zero disables throttling.
+ */
+void
+taskq_set_limit(taskq_t *tq, int limit)
+{
+	unsigned long flags;
+
+	ASSERT(tq);
+	ASSERT3S(limit, >=, 0);
+
+	spin_lock_irqsave_nested(&tq->tq_lock, flags, tq->tq_lock_class);
+	tq->tq_limit = limit;
+	spin_unlock_irqrestore(&tq->tq_lock, flags);
+
+	wake_up_all(&tq->tq_throttle_waitq);
+}
+EXPORT_SYMBOL(taskq_set_limit);
+
 /*
  * Cancel an already dispatched task given the task id.  Still pending tasks
  * will be immediately canceled, and if the task is active the function will
@@ -497,6 +641,7 @@ EXPORT_SYMBOL(taskq_member);
 int
 taskq_cancel_id(taskq_t *tq, taskqid_t id)
 {
+	taskq_delay_t *d;
 	taskq_ent_t *t;
 	int active = 0;
 	int rc = ENOENT;
@@ -509,6 +654,7 @@ taskq_cancel_id(taskq_t *tq, taskqid_t id)
 	if (t && !active) {
 		list_del_init(&t->tqent_list);
 		t->tqent_flags |= TQENT_FLAG_CANCEL;
+		taskq_unthrottle(tq);
 
 		/*
 		 * When canceling the lowest outstanding task id we
@@ -522,10 +668,14 @@ taskq_cancel_id(taskq_t *tq, taskqid_t id)
 		/*
 		 * The task_expire() function takes the tq->tq_lock so drop
 		 * drop the lock before synchronously cancelling the timer.
+		 * A concurrently running task_expire() observes the cancel
+		 * flag and leaves the timer for us to free.
 		 */
-		if (timer_pending(&t->tqent_timer)) {
+		if ((d = t->tqent_delay) != NULL) {
+			t->tqent_delay = NULL;
 			spin_unlock_irqrestore(&tq->tq_lock, flags);
-			del_timer_sync(&t->tqent_timer);
+			del_timer_sync(&d->tqd_timer);
+			kmem_free(d, sizeof (taskq_delay_t));
 			spin_lock_irqsave_nested(&tq->tq_lock, flags,
 			    tq->tq_lock_class);
 		}
@@ -560,6 +710,21 @@ taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t flags)
 
 	spin_lock_irqsave_nested(&tq->tq_lock, irqflags, tq->tq_lock_class);
 
+	/*
+	 * Return the id of an identical task which is still pending, this
+	 * adds no work so it is done before any throttling.
+	 */
+	if ((flags & TQ_COALESCE) &&
+	    (t = taskq_find_coalesce(tq, func, arg)) != NULL) {
+		tq->tq_coalesced++;
+		rc = t->tqent_id;
+		goto out;
+	}
+
+	/* Wait for the queue depth to drop below the taskq limit */
+	if (taskq_throttle(tq, flags, &irqflags))
+		goto out;
+
 	/* Taskq being destroyed and all tasks drained */
 	if (!(tq->tq_flags & TASKQ_ACTIVE))
 		goto out;
@@ -572,27 +737,26 @@ taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t flags)
 	if ((t = task_alloc(tq, flags, &irqflags)) == NULL)
 		goto out;
 
-	spin_lock(&t->tqent_lock);
-
-	/* Queue to the priority list instead of the pending list */
+	/*
+	 * Queue to the priority list instead of the pending list.  Tasks
+	 * which may be coalesced are kept on their own list so they can
+	 * be found without walking every pending task.
+	 */
 	if (flags & TQ_FRONT)
 		list_add_tail(&t->tqent_list, &tq->tq_prio_list);
+	else if (flags & TQ_COALESCE)
+		list_add_tail(&t->tqent_list, &tq->tq_coalesce_list);
 	else
 		list_add_tail(&t->tqent_list, &tq->tq_pend_list);
 
 	t->tqent_id = rc = tq->tq_next_id;
 	tq->tq_next_id++;
+	tq->tq_nqueued++;
 	t->tqent_func = func;
 	t->tqent_arg = arg;
-	t->tqent_taskq = tq;
-	t->tqent_timer.data = 0;
-	t->tqent_timer.function = NULL;
-	t->tqent_timer.expires = 0;
 
 	ASSERT(!(t->tqent_flags & TQENT_FLAG_PREALLOC));
 
-	spin_unlock(&t->tqent_lock);
-
 	wake_up(&tq->tq_work_waitq);
 out:
 	/* Spawn additional taskq threads if required. */
@@ -609,14 +773,26 @@ taskq_dispatch_delay(taskq_t *tq, task_func_t func, void *arg,
     uint_t flags, clock_t expire_time)
 {
 	taskqid_t rc = 0;
+	taskq_delay_t *d;
 	taskq_ent_t *t;
 	unsigned long irqflags;
 
 	ASSERT(tq);
 	ASSERT(func);
+	ASSERT0(flags & TQ_COALESCE);
+
+	/* Allocated before taking tq_lock which must not be held to sleep */
+	d = kmem_alloc(sizeof (taskq_delay_t),
+	    (flags & TQ_NOALLOC) ? KM_NOSLEEP : task_km_flags(flags));
+	if (d == NULL)
+		return (0);
 
 	spin_lock_irqsave_nested(&tq->tq_lock, irqflags, tq->tq_lock_class);
 
+	/* Wait for the queue depth to drop below the taskq limit */
+	if (taskq_throttle(tq, flags, &irqflags))
+		goto out;
+
 	/* Taskq being destroyed and all tasks drained */
 	if (!(tq->tq_flags & TASKQ_ACTIVE))
 		goto out;
@@ -624,29 +800,35 @@ taskq_dispatch_delay(taskq_t *tq, task_func_t func, void *arg,
 	if ((t = task_alloc(tq, flags, &irqflags)) == NULL)
 		goto out;
 
-	spin_lock(&t->tqent_lock);
-
 	/* Queue to the delay list for subsequent execution */
 	list_add_tail(&t->tqent_list, &tq->tq_delay_list);
 
 	t->tqent_id = rc = tq->tq_next_id;
 	tq->tq_next_id++;
+	tq->tq_nqueued++;
 	t->tqent_func = func;
 	t->tqent_arg = arg;
-	t->tqent_taskq = tq;
-	t->tqent_timer.data = (unsigned long)t;
-	t->tqent_timer.function = task_expire;
-	t->tqent_timer.expires = (unsigned long)expire_time;
-	add_timer(&t->tqent_timer);
+	t->tqent_delay = d;
 
-	ASSERT(!(t->tqent_flags & TQENT_FLAG_PREALLOC));
+	init_timer(&d->tqd_timer);
+	d->tqd_taskq = tq;
+	d->tqd_ent = t;
+	d->tqd_timer.data = (unsigned long)d;
+	d->tqd_timer.function = task_expire;
+	d->tqd_timer.expires = (unsigned long)expire_time;
+	add_timer(&d->tqd_timer);
+	d = NULL;
 
-	spin_unlock(&t->tqent_lock);
+	ASSERT(!(t->tqent_flags & TQENT_FLAG_PREALLOC));
 out:
 	/* Spawn additional taskq threads if required. */
 	if (tq->tq_nactive == tq->tq_nthreads)
 		(void) taskq_thread_spawn(tq);
 	spin_unlock_irqrestore(&tq->tq_lock, irqflags);
+
+	if (d != NULL)
+		kmem_free(d, sizeof (taskq_delay_t));
+
 	return (rc);
 }
 EXPORT_SYMBOL(taskq_dispatch_delay);
@@ -658,7 +840,13 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 	unsigned long irqflags;
 	ASSERT(tq);
 	ASSERT(func);
+	ASSERT0(flags & TQ_COALESCE);
 
+	/*
+	 * The entry is provided by the caller and this is commonly called
+	 * from atomic context, so it is never throttled.  It is counted
+	 * against the taskq limit which may throttle other dispatchers.
+	 */
 	spin_lock_irqsave_nested(&tq->tq_lock, irqflags,
 	    tq->tq_lock_class);
 
@@ -668,8 +856,6 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 		goto out;
 	}
 
-	spin_lock(&t->tqent_lock);
-
 	/*
 	 * Mark it as a prealloc'd task.  This is important
 	 * to ensure that we don't free it later.
@@ -684,11 +870,9 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 
 	t->tqent_id = tq->tq_next_id;
 	tq->tq_next_id++;
+	tq->tq_nqueued++;
 	t->tqent_func = func;
 	t->tqent_arg = arg;
-	t->tqent_taskq = tq;
-
-	spin_unlock(&t->tqent_lock);
 
 	wake_up(&tq->tq_work_waitq);
 out:
@@ -709,37 +893,43 @@ EXPORT_SYMBOL(taskq_empty_ent);
 void
 taskq_init_ent(taskq_ent_t *t)
 {
-	spin_lock_init(&t->tqent_lock);
-	init_waitqueue_head(&t->tqent_waitq);
-	init_timer(&t->tqent_timer);
 	INIT_LIST_HEAD(&t->tqent_list);
 	t->tqent_id = 0;
 	t->tqent_func = NULL;
 	t->tqent_arg = NULL;
+	t->tqent_delay = NULL;
 	t->tqent_flags = 0;
-	t->tqent_taskq = NULL;
 }
 EXPORT_SYMBOL(taskq_init_ent);
 
 /*
  * Return the next pending task, preference is given to tasks on the
- * priority list which were dispatched with TQ_FRONT.
+ * priority list which were dispatched with TQ_FRONT.  Otherwise the
+ * oldest of the pending and coalescing tasks is returned, both lists
+ * are kept in task id order so only their heads need to be compared.
  */
 static taskq_ent_t *
 taskq_next_ent(taskq_t *tq)
 {
-	struct list_head *list;
+	taskq_ent_t *t = NULL, *c = NULL;
 
 	ASSERT(spin_is_locked(&tq->tq_lock));
 
 	if (!list_empty(&tq->tq_prio_list))
-		list = &tq->tq_prio_list;
-	else if (!list_empty(&tq->tq_pend_list))
-		list = &tq->tq_pend_list;
-	else
-		return (NULL);
+		return (list_entry(tq->tq_prio_list.next, taskq_ent_t,
+		    tqent_list));
+
+	if (!list_empty(&tq->tq_pend_list))
+		t = list_entry(tq->tq_pend_list.next, taskq_ent_t, tqent_list);
+
+	if (!list_empty(&tq->tq_coalesce_list))
+		c = list_entry(tq->tq_coalesce_list.next, taskq_ent_t,
+		    tqent_list);
 
-	return (list_entry(list->next, taskq_ent_t, tqent_list));
+	if (t == NULL || (c != NULL && c->tqent_id < t->tqent_id))
+		return (c);
+
+	return (t);
 }
 
 /*
@@ -850,7 +1040,8 @@ taskq_thread(void *args)
 	while (!kthread_should_stop()) {
 
 		if (list_empty(&tq->tq_pend_list) &&
-		    list_empty(&tq->tq_prio_list)) {
+		    list_empty(&tq->tq_prio_list) &&
+		    list_empty(&tq->tq_coalesce_list)) {
 
 			if (taskq_thread_should_stop(tq, tqt)) {
 				wake_up_all(&tq->tq_wait_waitq);
@@ -872,6 +1063,7 @@ taskq_thread(void *args)
 
 		if ((t = taskq_next_ent(tq)) != NULL) {
 			list_del_init(&t->tqent_list);
+			taskq_unthrottle(tq);
 
 			/*
 			 * In order to support recursively dispatching a
@@ -1020,10 +1212,22 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	INIT_LIST_HEAD(&tq->tq_free_list);
 	INIT_LIST_HEAD(&tq->tq_pend_list);
 	INIT_LIST_HEAD(&tq->tq_prio_list);
+	INIT_LIST_HEAD(&tq->tq_coalesce_list);
 	INIT_LIST_HEAD(&tq->tq_delay_list);
 	init_waitqueue_head(&tq->tq_work_waitq);
 	init_waitqueue_head(&tq->tq_wait_waitq);
+	init_waitqueue_head(&tq->tq_throttle_waitq);
 	tq->tq_lock_class = TQ_LOCK_GENERAL;
+	tq->tq_limit = 0;
+	tq->tq_nqueued = 0;
+	tq->tq_throttle_count = 0;
+	tq->tq_throttle_fail = 0;
+	tq->tq_throttle_time = 0;
+	tq->tq_coalesced = 0;
+
+	down_write(&spl_taskq_sem);
+	list_add_tail(&tq->tq_taskqs, &spl_taskq_list);
+	up_write(&spl_taskq_sem);
 
 	if (flags & TASKQ_PREPOPULATE) {
 		spin_lock_irqsave_nested(&tq->tq_lock, irqflags,
@@ -1072,6 +1276,9 @@ taskq_destroy(taskq_t *tq)
 	tq->tq_flags &= ~TASKQ_ACTIVE;
 	spin_unlock_irqrestore(&tq->tq_lock, flags);
 
+	/* Release throttled dispatchers, they observe !TASKQ_ACTIVE */
+	wake_up_all(&tq->tq_throttle_waitq);
+
 	/*
 	 * When TASKQ_ACTIVE is clear new tasks may not be added nor may
 	 * new worker threads be spawned for dynamic taskq.
@@ -1118,29 +1325,33 @@ taskq_destroy(taskq_t *tq)
 	ASSERT(list_empty(&tq->tq_free_list));
 	ASSERT(list_empty(&tq->tq_pend_list));
 	ASSERT(list_empty(&tq->tq_prio_list));
+	ASSERT(list_empty(&tq->tq_coalesce_list));
 	ASSERT(list_empty(&tq->tq_delay_list));
+	ASSERT0(tq->tq_nqueued);
 
 	spin_unlock_irqrestore(&tq->tq_lock, flags);
 
+	down_write(&spl_taskq_sem);
+	list_del(&tq->tq_taskqs);
+	up_write(&spl_taskq_sem);
+
 	strfree(tq->tq_name);
 	kmem_free(tq, sizeof (taskq_t));
 }
 EXPORT_SYMBOL(taskq_destroy);
 
+/*
+ * The dynamic_taskq is created first since every TASKQ_DYNAMIC taskq
+ * dispatches to it to spawn threads, including those created by other
+ * subsystems while the system_taskq is being created.
+ */
 int
 spl_taskq_init(void)
 {
-	system_taskq = taskq_create("spl_system_taskq", MAX(boot_ncpus, 64),
-	    maxclsyspri, boot_ncpus, INT_MAX, TASKQ_PREPOPULATE|TASKQ_DYNAMIC);
-	if (system_taskq == NULL)
-		return (1);
-
 	dynamic_taskq = taskq_create("spl_dynamic_taskq", 1,
 	    maxclsyspri, boot_ncpus, INT_MAX, TASKQ_PREPOPULATE);
-	if (dynamic_taskq == NULL) {
-		taskq_destroy(system_taskq);
+	if (dynamic_taskq == NULL)
 		return (1);
-	}
 
 	/*
 	 * This is used to annotate tq_lock, so
@@ -1157,7 +1368,22 @@ spl_taskq_fini(void)
 {
 	taskq_destroy(dynamic_taskq);
 	dynamic_taskq = NULL;
+}
+
+int
+spl_taskq_system_init(void)
+{
+	system_taskq = taskq_create("spl_system_taskq", MAX(boot_ncpus, 64),
+	    maxclsyspri, boot_ncpus, INT_MAX, TASKQ_PREPOPULATE|TASKQ_DYNAMIC);
+	if (system_taskq == NULL)
+		return (1);
+
+	return (0);
+}
 
+void
+spl_taskq_system_fini(void)
+{
 	taskq_destroy(system_taskq);
 	system_taskq = NULL;
 }
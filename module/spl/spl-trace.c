@@ -0,0 +1,42 @@
+/*****************************************************************************\
+ *  Copyright (C) 2007-2010 Lawrence Livermore National Security, LLC.
+ *  Copyright (C) 2007 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ *  Solaris Porting Layer (SPL) Static Tracepoints.
+\*****************************************************************************/
+
+#include <linux/module.h>
+
+/*
+ * Instantiate the spl_probe* tracepoints declared in sys/trace.h and
+ * export them so DTRACE_PROBE* sites in dependent modules can fire them.
+ */
+#if defined(HAVE_DECLARE_EVENT_CLASS)
+#define CREATE_TRACE_POINTS
+#include <sys/trace.h>
+
+EXPORT_TRACEPOINT_SYMBOL(spl_probe0);
+EXPORT_TRACEPOINT_SYMBOL(spl_probe1);
+EXPORT_TRACEPOINT_SYMBOL(spl_probe2);
+EXPORT_TRACEPOINT_SYMBOL(spl_probe3);
+EXPORT_TRACEPOINT_SYMBOL(spl_probe4);
+#endif /* HAVE_DECLARE_EVENT_CLASS */
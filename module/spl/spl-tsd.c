@@ -57,6 +57,10 @@
  *  so if your using the Solaris thread API you should not need to call
  *  tsd_exit() directly.
  *
+ *  The hash table itself is not allocated until the first tsd_create()
+ *  so loading the module does not pay for it.  Until then there can be
+ *  no keys and tsd_get(), tsd_destroy() and tsd_exit() return early.
+ *
  */
 
 #include <sys/kmem.h>
@@ -87,6 +91,7 @@ typedef struct tsd_hash_entry {
 } tsd_hash_entry_t;
 
 static tsd_hash_table_t *tsd_hash_table = NULL;
+static kmutex_t tsd_hash_table_lock;
 
 
 /*
@@ -467,7 +472,7 @@ tsd_set(uint_t key, void *value)
 	/* mark remove if value is NULL */
 	boolean_t remove = (value == NULL);
 
-	table = tsd_hash_table;
+	table = ACCESS_ONCE(tsd_hash_table);
 	pid = curthread->pid;
 	ASSERT3P(table, !=, NULL);
 
@@ -512,14 +517,17 @@ EXPORT_SYMBOL(tsd_set);
 void *
 tsd_get(uint_t key)
 {
+	tsd_hash_table_t *table;
 	tsd_hash_entry_t *entry;
 
-	ASSERT3P(tsd_hash_table, !=, NULL);
-
 	if ((key == 0) || (key > TSD_KEYS_MAX))
 		return (NULL);
 
-	entry = tsd_hash_search(tsd_hash_table, key, curthread->pid);
+	table = ACCESS_ONCE(tsd_hash_table);
+	if (table == NULL)
+		return (NULL);
+
+	entry = tsd_hash_search(table, key, curthread->pid);
 	if (entry == NULL)
 		return (NULL);
 
@@ -542,11 +550,28 @@ EXPORT_SYMBOL(tsd_get);
 void
 tsd_create(uint_t *keyp, dtor_func_t dtor)
 {
+	tsd_hash_table_t *table;
+
 	ASSERT3P(keyp, !=, NULL);
 	if (*keyp)
 		return;
 
-	(void) tsd_hash_add_key(tsd_hash_table, keyp, dtor);
+	/* Allocate the hash table on first use */
+	mutex_enter(&tsd_hash_table_lock);
+	table = tsd_hash_table;
+	if (table == NULL) {
+		table = tsd_hash_table_init(TSD_HASH_TABLE_BITS_DEFAULT);
+		if (table == NULL) {
+			mutex_exit(&tsd_hash_table_lock);
+			return;
+		}
+
+		smp_wmb();
+		tsd_hash_table = table;
+	}
+	mutex_exit(&tsd_hash_table_lock);
+
+	(void) tsd_hash_add_key(table, keyp, dtor);
 }
 EXPORT_SYMBOL(tsd_create);
 
@@ -568,8 +593,9 @@ tsd_destroy(uint_t *keyp)
 	tsd_hash_bin_t *dtor_entry_bin, *entry_bin;
 	ulong_t hash;
 
-	table = tsd_hash_table;
-	ASSERT3P(table, !=, NULL);
+	table = ACCESS_ONCE(tsd_hash_table);
+	if (table == NULL)
+		return;
 
 	spin_lock(&table->ht_lock);
 	dtor_entry = tsd_hash_search(table, *keyp, DTOR_PID);
@@ -631,8 +657,9 @@ tsd_exit(void)
 	tsd_hash_bin_t *pid_entry_bin, *entry_bin;
 	ulong_t hash;
 
-	table = tsd_hash_table;
-	ASSERT3P(table, !=, NULL);
+	table = ACCESS_ONCE(tsd_hash_table);
+	if (table == NULL)
+		return;
 
 	spin_lock(&table->ht_lock);
 	pid_entry = tsd_hash_search(table, PID_KEY, curthread->pid);
@@ -679,9 +706,8 @@ EXPORT_SYMBOL(tsd_exit);
 int
 spl_tsd_init(void)
 {
-	tsd_hash_table = tsd_hash_table_init(TSD_HASH_TABLE_BITS_DEFAULT);
-	if (tsd_hash_table == NULL)
-		return (1);
+	mutex_init(&tsd_hash_table_lock, NULL, MUTEX_DEFAULT, NULL);
+	tsd_hash_table = NULL;
 
 	return (0);
 }
@@ -689,6 +715,9 @@ spl_tsd_init(void)
 void
 spl_tsd_fini(void)
 {
-	tsd_hash_table_fini(tsd_hash_table);
+	if (tsd_hash_table != NULL)
+		tsd_hash_table_fini(tsd_hash_table);
+
 	tsd_hash_table = NULL;
+	mutex_destroy(&tsd_hash_table_lock);
 }
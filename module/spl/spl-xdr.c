@@ -126,16 +126,29 @@
  *
  * 8) If a caller passes pointers to non-kernel memory (e.g., pointers to user
  * space or MMIO space), the computer may explode.
+ *
+ * === Native streams ===
+ *
+ * When XDR_NATIVE is passed to xdrmem_create() the same interface produces
+ * a stream which is not XDR.  Values are stored in host byte order at their
+ * natural alignment relative to the start of the buffer, strings and opaque
+ * data are not padded, and arrays of primitive types are copied with a
+ * single memcpy().  Such a stream may only be decoded on the host which
+ * encoded it, e.g. for in-kernel message passing or ioctl payloads shared
+ * with a matching user space.  Padding is not verified when decoding.
  */
 
 static struct xdr_ops xdrmem_encode_ops;
 static struct xdr_ops xdrmem_decode_ops;
+static struct xdr_ops xdrmem_native_ops;
 
 void
 xdrmem_create(XDR *xdrs, const caddr_t addr, const uint_t size,
     const enum xdr_op op)
 {
-	switch (op) {
+	enum xdr_op dir = op & ~XDR_NATIVE;
+
+	switch (dir) {
 		case XDR_ENCODE:
 			xdrs->x_ops = &xdrmem_encode_ops;
 			break;
@@ -147,9 +160,19 @@ xdrmem_create(XDR *xdrs, const caddr_t addr, const uint_t size,
 			return;
 	}
 
-	xdrs->x_op = op;
+	/* Integers of XDR memory streams are coded inline by rpc/xdr.h */
+	xdrs->x_inline = TRUE;
+	if (op & XDR_NATIVE) {
+		xdrs->x_ops = &xdrmem_native_ops;
+		xdrs->x_inline = FALSE;
+	}
+
+	xdrs->x_op = dir;
 	xdrs->x_addr = addr;
+	xdrs->x_addr_start = addr;
 	xdrs->x_addr_end = addr + size;
+	xdrs->x_last = NULL;
+	xdrs->x_last_size = 0;
 
 	if (xdrs->x_addr_end < xdrs->x_addr) {
 		xdrs->x_ops = NULL;
@@ -512,3 +535,229 @@ static struct xdr_ops xdrmem_decode_ops = {
 	.xdr_array        = xdr_dec_array
 };
 
+
+/*
+ * Reserve size bytes in a native stream at the given alignment, relative to
+ * the start of the buffer, and return their address.  Alignment padding is
+ * zeroed when encoding.
+ */
+static caddr_t
+xdrnat_reserve(XDR *xdrs, const uint_t align, const uint_t size)
+{
+	uintptr_t off = xdrs->x_addr - xdrs->x_addr_start;
+	uintptr_t pad = P2ROUNDUP(off, (uintptr_t)align) - off;
+	caddr_t addr;
+
+	if (xdrs->x_addr > xdrs->x_addr_end)
+		return NULL;
+
+	if (xdrs->x_addr_end - xdrs->x_addr < pad + size)
+		return NULL;
+
+	if (pad > 0 && xdrs->x_op == XDR_ENCODE)
+		memset(xdrs->x_addr, 0, pad);
+
+	addr = xdrs->x_addr + pad;
+	xdrs->x_addr = addr + size;
+
+	return addr;
+}
+
+/*
+ * Code a primitive value of its natural size.  The value coded is recorded
+ * so xdrnat_array() can tell when an element procedure is a primitive.
+ */
+static bool_t
+xdrnat_value(XDR *xdrs, void *ptr, const uint_t size)
+{
+	caddr_t addr;
+
+	addr = xdrnat_reserve(xdrs, size, size);
+	if (addr == NULL)
+		return FALSE;
+
+	if (xdrs->x_op == XDR_ENCODE)
+		memcpy(addr, ptr, size);
+	else
+		memcpy(ptr, addr, size);
+
+	xdrs->x_last = ptr;
+	xdrs->x_last_size = size;
+
+	return TRUE;
+}
+
+static bool_t
+xdrnat_char(XDR *xdrs, char *cp)
+{
+	return xdrnat_value(xdrs, cp, sizeof(char));
+}
+
+static bool_t
+xdrnat_ushort(XDR *xdrs, unsigned short *usp)
+{
+	return xdrnat_value(xdrs, usp, sizeof(unsigned short));
+}
+
+static bool_t
+xdrnat_uint(XDR *xdrs, unsigned *up)
+{
+	return xdrnat_value(xdrs, up, sizeof(unsigned));
+}
+
+static bool_t
+xdrnat_ulonglong(XDR *xdrs, u_longlong_t *ullp)
+{
+	return xdrnat_value(xdrs, ullp, sizeof(u_longlong_t));
+}
+
+static bool_t
+xdrnat_bytes(XDR *xdrs, caddr_t cp, const uint_t cnt)
+{
+	caddr_t addr;
+
+	addr = xdrnat_reserve(xdrs, 1, cnt);
+	if (addr == NULL)
+		return FALSE;
+
+	if (xdrs->x_op == XDR_ENCODE)
+		memcpy(addr, cp, cnt);
+	else
+		memcpy(cp, addr, cnt);
+
+	return TRUE;
+}
+
+static bool_t
+xdrnat_string(XDR *xdrs, char **sp, const uint_t maxsize)
+{
+	size_t slen;
+	uint_t size;
+	bool_t alloc = FALSE;
+
+	if (xdrs->x_op == XDR_ENCODE) {
+		slen = strlen(*sp);
+		if (slen > maxsize)
+			return FALSE;
+
+		size = slen;
+		if (!xdrnat_uint(xdrs, &size))
+			return FALSE;
+
+		return xdrnat_bytes(xdrs, *sp, size);
+	}
+
+	if (!xdrnat_uint(xdrs, &size))
+		return FALSE;
+
+	if (size > maxsize || size > UINT_MAX - 1)
+		return FALSE;
+
+	if (*sp == NULL) {
+		*sp = kmem_alloc(size + 1, KM_NOSLEEP);
+		if (*sp == NULL)
+			return FALSE;
+
+		alloc = TRUE;
+	}
+
+	if (!xdrnat_bytes(xdrs, *sp, size))
+		goto fail;
+
+	if (memchr(*sp, 0, size) != NULL)
+		goto fail;
+
+	(*sp)[size] = '\0';
+
+	return TRUE;
+
+fail:
+	if (alloc)
+		kmem_free(*sp, size + 1);
+
+	return FALSE;
+}
+
+/*
+ * The first element is always coded by elproc.  When that turns out to be
+ * a single primitive of elsize bytes coded from the element itself, the
+ * stream layout of the remaining elements matches their memory layout and
+ * they are copied in one go.  Otherwise each element is coded by elproc.
+ */
+static bool_t
+xdrnat_array(XDR *xdrs, caddr_t *arrp, uint_t *sizep, const uint_t maxsize,
+    const uint_t elsize, const xdrproc_t elproc)
+{
+	uint_t i, size;
+	uintptr_t off;
+	bool_t alloc = FALSE;
+	caddr_t addr, start;
+
+	if (xdrs->x_op == XDR_ENCODE &&
+	    (*sizep > maxsize || *sizep > UINT_MAX / elsize))
+		return FALSE;
+
+	if (!xdrnat_uint(xdrs, sizep))
+		return FALSE;
+
+	size = *sizep;
+
+	if (size > maxsize || size > UINT_MAX / elsize)
+		return FALSE;
+
+	if (size == 0)
+		return TRUE;
+
+	if (*arrp == NULL) {
+		if (xdrs->x_op == XDR_ENCODE)
+			return FALSE;
+
+		*arrp = kmem_alloc(size * elsize, KM_NOSLEEP);
+		if (*arrp == NULL)
+			return FALSE;
+
+		alloc = TRUE;
+	}
+
+	addr = *arrp;
+	start = xdrs->x_addr;
+	xdrs->x_last = NULL;
+
+	if (!elproc(xdrs, addr))
+		goto fail;
+
+	off = start - xdrs->x_addr_start;
+	if (xdrs->x_last == addr && xdrs->x_last_size == elsize &&
+	    xdrs->x_addr == xdrs->x_addr_start +
+	    P2ROUNDUP(off, (uintptr_t)elsize) + elsize) {
+		if (!xdrnat_bytes(xdrs, addr + elsize, (size - 1) * elsize))
+			goto fail;
+
+		return TRUE;
+	}
+
+	for (i = 1; i < size; i++) {
+		addr += elsize;
+		if (!elproc(xdrs, addr))
+			goto fail;
+	}
+
+	return TRUE;
+
+fail:
+	if (alloc)
+		kmem_free(*arrp, size * elsize);
+
+	return FALSE;
+}
+
+static struct xdr_ops xdrmem_native_ops = {
+	.xdr_control      = xdrmem_control,
+	.xdr_char         = xdrnat_char,
+	.xdr_u_short      = xdrnat_ushort,
+	.xdr_u_int        = xdrnat_uint,
+	.xdr_u_longlong_t = xdrnat_ulonglong,
+	.xdr_opaque       = xdrnat_bytes,
+	.xdr_string       = xdrnat_string,
+	.xdr_array        = xdrnat_array
+};
@@ -55,10 +55,34 @@
 
 #include <sys/kmem.h>
 #include <sys/kmem_cache.h>
+#include <sys/vmem.h>
+#include <sys/rwlock.h>
 #include <sys/zmod.h>
 #include <linux/zlib_compat.h>
 
 static spl_kmem_cache_t *zlib_workspace_cache;
+static kmutex_t zlib_workspace_lock;
+
+/*
+ * Registered preset dictionaries.  The kernel zlib does not provide
+ * deflateSetDictionary() or inflateSetDictionary() so a dictionary is
+ * emulated with raw deflate streams.  The compressor runs the dictionary
+ * through the deflater and sync flushes it, discarding the output, before
+ * compressing the caller's data.  Only the data is kept.  The decompressor
+ * first inflates zd_prefix, the dictionary as stored blocks prepared when
+ * it was added, which leaves the same history in the inflater's window.
+ */
+typedef struct z_dict {
+	struct list_head	zd_list;
+	uint32_t		zd_id;
+	void			*zd_dict;
+	size_t			zd_len;
+	void			*zd_prefix;
+	size_t			zd_prefix_len;
+} z_dict_t;
+
+static LIST_HEAD(zlib_dict_list);
+static krwlock_t zlib_dict_lock;
 
 /*
  * A kmem_cache is used for the zlib workspaces to avoid having to vmalloc
@@ -69,10 +93,47 @@ static spl_kmem_cache_t *zlib_workspace_cache;
  * must disable preemption around the critical section, and verify that
  * zlib_deflate* and zlib_inflate* never internally call schedule().
  */
+static spl_kmem_cache_t *
+zlib_workspace_cache_create(void)
+{
+	spl_kmem_cache_t *cache;
+	int size;
+
+	mutex_enter(&zlib_workspace_lock);
+	cache = zlib_workspace_cache;
+	if (cache == NULL) {
+		size = MAX(spl_zlib_deflate_workspacesize(MAX_WBITS,
+		    MAX_MEM_LEVEL), zlib_inflate_workspacesize());
+
+		cache = kmem_cache_create("spl_zlib_workspace_cache",
+		    size, 0, NULL, NULL, NULL, NULL, NULL,
+		    KMC_VMEM | KMC_NOEMERGENCY);
+		if (cache != NULL) {
+			smp_wmb();
+			zlib_workspace_cache = cache;
+		}
+	}
+	mutex_exit(&zlib_workspace_lock);
+
+	return (cache);
+}
+
+/*
+ * The workspace cache is created by the first caller rather than when
+ * the module is loaded, most consumers never compress anything.
+ */
 static void *
 zlib_workspace_alloc(int flags)
 {
-	return kmem_cache_alloc(zlib_workspace_cache, flags & ~(__GFP_FS));
+	spl_kmem_cache_t *cache = ACCESS_ONCE(zlib_workspace_cache);
+
+	if (unlikely(cache == NULL)) {
+		cache = zlib_workspace_cache_create();
+		if (cache == NULL)
+			return (NULL);
+	}
+
+	return kmem_cache_alloc(cache, flags & ~(__GFP_FS));
 }
 
 static void
@@ -191,20 +252,288 @@ z_uncompress(void *dest, size_t *destLen, const void *source, size_t sourceLen)
 }
 EXPORT_SYMBOL(z_uncompress);
 
+/* Caller must hold zlib_dict_lock */
+static z_dict_t *
+z_dict_find(uint32_t id)
+{
+	z_dict_t *zd;
+
+	list_for_each_entry(zd, &zlib_dict_list, zd_list)
+		if (zd->zd_id == id)
+			return (zd);
+
+	return (NULL);
+}
+
+static void
+z_dict_free(z_dict_t *zd)
+{
+	if (zd->zd_prefix)
+		vmem_free(zd->zd_prefix, zd->zd_len + Z_DICT_PREFIX_OVERHEAD);
+
+	if (zd->zd_dict)
+		vmem_free(zd->zd_dict, zd->zd_len);
+
+	kmem_free(zd, sizeof (z_dict_t));
+}
+
+/*
+ * Encode the dictionary as uncompressed stored blocks terminated by a sync
+ * flush.  Inflating this leaves the inflater at a block boundary with the
+ * dictionary as its history, exactly as a deflater which was sync flushed
+ * after consuming the dictionary.
+ */
+static int
+z_dict_prepare(z_dict_t *zd)
+{
+	z_stream stream;
+	int err;
+
+	zd->zd_prefix = vmem_alloc(zd->zd_len + Z_DICT_PREFIX_OVERHEAD,
+	    KM_SLEEP);
+
+	stream.next_in = zd->zd_dict;
+	stream.avail_in = zd->zd_len;
+	stream.next_out = zd->zd_prefix;
+	stream.avail_out = zd->zd_len + Z_DICT_PREFIX_OVERHEAD;
+
+	stream.workspace = zlib_workspace_alloc(KM_SLEEP);
+	if (!stream.workspace)
+		return Z_MEM_ERROR;
+
+	err = zlib_deflateInit2(&stream, Z_NO_COMPRESSION, Z_DEFLATED,
+	    -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+	if (err != Z_OK) {
+		zlib_workspace_free(stream.workspace);
+		return err;
+	}
+
+	err = zlib_deflate(&stream, Z_SYNC_FLUSH);
+	if (err == Z_OK && (stream.avail_in != 0 || stream.avail_out == 0))
+		err = Z_BUF_ERROR;
+
+	zd->zd_prefix_len = stream.total_out;
+
+	zlib_deflateEnd(&stream);
+	zlib_workspace_free(stream.workspace);
+
+	return err;
+}
+
+/*
+ * Register a preset dictionary under the given id.  The dictionary is
+ * copied and may be at most Z_DICT_MAX bytes, the deflate window size.
+ * Returns Z_STREAM_ERROR if the id is already in use or the dictionary
+ * is empty or too large.
+ */
 int
-spl_zlib_init(void)
+z_dict_add(uint32_t id, const void *dict, size_t dictLen)
 {
-	int size;
+	z_dict_t *zd;
+	int err;
+
+	if (dictLen == 0 || dictLen > Z_DICT_MAX)
+		return Z_STREAM_ERROR;
+
+	zd = kmem_zalloc(sizeof (z_dict_t), KM_SLEEP);
+	zd->zd_id = id;
+	zd->zd_len = dictLen;
+	zd->zd_dict = vmem_alloc(dictLen, KM_SLEEP);
+	memcpy(zd->zd_dict, dict, dictLen);
+
+	err = z_dict_prepare(zd);
+	if (err != Z_OK) {
+		z_dict_free(zd);
+		return err;
+	}
+
+	rw_enter(&zlib_dict_lock, RW_WRITER);
+	if (z_dict_find(id) != NULL) {
+		rw_exit(&zlib_dict_lock);
+		z_dict_free(zd);
+		return Z_STREAM_ERROR;
+	}
+
+	list_add_tail(&zd->zd_list, &zlib_dict_list);
+	rw_exit(&zlib_dict_lock);
+
+	return Z_OK;
+}
+EXPORT_SYMBOL(z_dict_add);
+
+/*
+ * Unregister a preset dictionary, waiting for any callers using it.
+ */
+int
+z_dict_remove(uint32_t id)
+{
+	z_dict_t *zd;
+
+	rw_enter(&zlib_dict_lock, RW_WRITER);
+	zd = z_dict_find(id);
+	if (zd == NULL) {
+		rw_exit(&zlib_dict_lock);
+		return Z_STREAM_ERROR;
+	}
+
+	list_del(&zd->zd_list);
+	rw_exit(&zlib_dict_lock);
+
+	z_dict_free(zd);
+
+	return Z_OK;
+}
+EXPORT_SYMBOL(z_dict_remove);
+
+/*
+ * Identical to z_compress_level() except the data is compressed with the
+ * preset dictionary registered under id as its history.  The result is a
+ * raw deflate stream, without a zlib header or checksum, which can only be
+ * decompressed by z_uncompress_dict() with the same dictionary.  Returns
+ * Z_STREAM_ERROR when no dictionary is registered under id.
+ */
+int
+z_compress_dict(void *dest, size_t *destLen, const void *source,
+    size_t sourceLen, int level, uint32_t id)
+{
+	z_stream stream;
+	z_dict_t *zd;
+	int err;
+
+	if ((size_t)(uInt)*destLen != *destLen || *destLen == 0 ||
+	    (size_t)(uInt)sourceLen != sourceLen)
+		return Z_BUF_ERROR;
+
+	stream.workspace = zlib_workspace_alloc(KM_SLEEP);
+	if (!stream.workspace)
+		return Z_MEM_ERROR;
+
+	rw_enter(&zlib_dict_lock, RW_READER);
+	zd = z_dict_find(id);
+	if (zd == NULL) {
+		err = Z_STREAM_ERROR;
+		goto out;
+	}
+
+	err = zlib_deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS,
+	    MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+	if (err != Z_OK)
+		goto out;
+
+	/* Prime the history, dest is used as scratch for the output */
+	stream.next_in = zd->zd_dict;
+	stream.avail_in = zd->zd_len;
+	do {
+		stream.next_out = dest;
+		stream.avail_out = (uInt)*destLen;
+		err = zlib_deflate(&stream, Z_SYNC_FLUSH);
+	} while (err == Z_OK && stream.avail_out == 0);
+
+	if (err != Z_OK) {
+		zlib_deflateEnd(&stream);
+		goto out;
+	}
+
+	stream.next_in = (Byte *)source;
+	stream.avail_in = (uInt)sourceLen;
+	stream.next_out = dest;
+	stream.avail_out = (uInt)*destLen;
+
+	err = zlib_deflate(&stream, Z_FINISH);
+	if (err != Z_STREAM_END) {
+		zlib_deflateEnd(&stream);
+		err = (err == Z_OK ? Z_BUF_ERROR : err);
+		goto out;
+	}
+	*destLen -= stream.avail_out;
+
+	err = zlib_deflateEnd(&stream);
+out:
+	rw_exit(&zlib_dict_lock);
+	zlib_workspace_free(stream.workspace);
+
+	return err;
+}
+EXPORT_SYMBOL(z_compress_dict);
+
+/*
+ * Decompress a buffer compressed by z_compress_dict() with the preset
+ * dictionary registered under id.  Otherwise identical to z_uncompress().
+ */
+int
+z_uncompress_dict(void *dest, size_t *destLen, const void *source,
+    size_t sourceLen, uint32_t id)
+{
+	z_stream stream;
+	z_dict_t *zd;
+	int err;
 
-	size = MAX(spl_zlib_deflate_workspacesize(MAX_WBITS, MAX_MEM_LEVEL),
-	    zlib_inflate_workspacesize());
+	if ((size_t)(uInt)*destLen != *destLen || *destLen == 0 ||
+	    (size_t)(uInt)sourceLen != sourceLen)
+		return Z_BUF_ERROR;
+
+	stream.workspace = zlib_workspace_alloc(KM_SLEEP);
+	if (!stream.workspace)
+		return Z_MEM_ERROR;
 
-	zlib_workspace_cache = kmem_cache_create(
-	    "spl_zlib_workspace_cache",
-	    size, 0, NULL, NULL, NULL, NULL, NULL,
-	    KMC_VMEM | KMC_NOEMERGENCY);
-        if (!zlib_workspace_cache)
-		return (1);
+	rw_enter(&zlib_dict_lock, RW_READER);
+	zd = z_dict_find(id);
+	if (zd == NULL) {
+		err = Z_STREAM_ERROR;
+		goto out;
+	}
+
+	stream.next_in = zd->zd_prefix;
+	stream.avail_in = zd->zd_prefix_len;
+
+	err = zlib_inflateInit2(&stream, -MAX_WBITS);
+	if (err != Z_OK)
+		goto out;
+
+	/* Load the history, dest is used as scratch for the output */
+	do {
+		stream.next_out = dest;
+		stream.avail_out = (uInt)*destLen;
+		err = zlib_inflate(&stream, Z_SYNC_FLUSH);
+	} while (err == Z_OK && stream.avail_in != 0);
+
+	if (err != Z_OK) {
+		zlib_inflateEnd(&stream);
+		goto out;
+	}
+
+	stream.next_in = (Byte *)source;
+	stream.avail_in = (uInt)sourceLen;
+	stream.next_out = dest;
+	stream.avail_out = (uInt)*destLen;
+
+	err = zlib_inflate(&stream, Z_FINISH);
+	if (err != Z_STREAM_END) {
+		zlib_inflateEnd(&stream);
+
+		if (err == Z_NEED_DICT ||
+		   (err == Z_BUF_ERROR && stream.avail_in == 0))
+			err = Z_DATA_ERROR;
+
+		goto out;
+	}
+	*destLen -= stream.avail_out;
+
+	err = zlib_inflateEnd(&stream);
+out:
+	rw_exit(&zlib_dict_lock);
+	zlib_workspace_free(stream.workspace);
+
+	return err;
+}
+EXPORT_SYMBOL(z_uncompress_dict);
+
+int
+spl_zlib_init(void)
+{
+	mutex_init(&zlib_workspace_lock, NULL, MUTEX_DEFAULT, NULL);
+	rw_init(&zlib_dict_lock, NULL, RW_DEFAULT, NULL);
+	zlib_workspace_cache = NULL;
 
         return (0);
 }
@@ -212,6 +541,18 @@ spl_zlib_init(void)
 void
 spl_zlib_fini(void)
 {
-	kmem_cache_destroy(zlib_workspace_cache);
+	z_dict_t *zd;
+
+	while (!list_empty(&zlib_dict_list)) {
+		zd = list_entry(zlib_dict_list.next, z_dict_t, zd_list);
+		list_del(&zd->zd_list);
+		z_dict_free(zd);
+	}
+	rw_destroy(&zlib_dict_lock);
+
+	if (zlib_workspace_cache != NULL)
+		kmem_cache_destroy(zlib_workspace_cache);
+
         zlib_workspace_cache = NULL;
+	mutex_destroy(&zlib_workspace_lock);
 }
@@ -623,6 +623,7 @@ splat_init(void)
 	SPLAT_SUBSYSTEM_INIT(cred);
 	SPLAT_SUBSYSTEM_INIT(zlib);
 	SPLAT_SUBSYSTEM_INIT(linux);
+	SPLAT_SUBSYSTEM_INIT(kstat);
 
 	error = misc_register(&splat_misc);
 	if (error) {
@@ -640,6 +641,7 @@ splat_fini(void)
 {
 	misc_deregister(&splat_misc);
 
+	SPLAT_SUBSYSTEM_FINI(kstat);
 	SPLAT_SUBSYSTEM_FINI(linux);
 	SPLAT_SUBSYSTEM_FINI(zlib);
 	SPLAT_SUBSYSTEM_FINI(cred);
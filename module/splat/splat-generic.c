@@ -25,7 +25,11 @@
 \*****************************************************************************/
 
 #include <sys/sunddi.h>
+#include <sys/vmem.h>
+#include <sys/time.h>
 #include <linux/math64_compat.h>
+#include <linux/kallsyms.h>
+#include <rpc/xdr.h>
 #include "splat-internal.h"
 
 #define SPLAT_GENERIC_NAME		"generic"
@@ -55,6 +59,18 @@
 # define SPLAT_GENERIC_TEST6_NAME	"divdi3"
 # define SPLAT_GENERIC_TEST6_DESC	"Signed Div-64 Test"
 
+#define SPLAT_GENERIC_TEST7_ID		0x0d07
+#define SPLAT_GENERIC_TEST7_NAME	"verify"
+#define SPLAT_GENERIC_TEST7_DESC	"VERIFY Size/Speed Test"
+
+#define SPLAT_GENERIC_TEST8_ID		0x0d08
+#define SPLAT_GENERIC_TEST8_NAME	"xdr_native"
+#define SPLAT_GENERIC_TEST8_DESC	"XDR and Native Stream Test"
+
+#define SPLAT_GENERIC_TEST9_ID		0x0d09
+#define SPLAT_GENERIC_TEST9_NAME	"xdr_perf"
+#define SPLAT_GENERIC_TEST9_DESC	"XDR Inline Field Speed Test"
+
 #define STR_POS				"123456789"
 #define STR_NEG				"-123456789"
 #define STR_BASE			"0xabcdef"
@@ -312,6 +328,402 @@ splat_generic_test_divdi3(struct file *file, void *arg)
 	return 0;
 }
 
+/*
+ * Reference copy of the historical VERIFY3() implementation which expands
+ * the complete spl_panic() call inline at every site.  It is only used to
+ * compare the generated code size and speed against the current
+ * out-of-line implementation.
+ */
+#define	SPLAT_VERIFY3_INLINE(LEFT, OP, RIGHT, TYPE, FMT, CAST)		\
+	(void)((!((TYPE)(LEFT) OP (TYPE)(RIGHT))) &&			\
+	    spl_panic(__FILE__, __FUNCTION__, __LINE__,			\
+	    "VERIFY3(" #LEFT " " #OP " " #RIGHT ") "			\
+	    "failed (" FMT " " #OP " " FMT ")\n",			\
+	    CAST (LEFT), CAST (RIGHT)))
+#define	SPLAT_VERIFY3S_INLINE(x, y, z)					\
+	SPLAT_VERIFY3_INLINE(x, y, z, int64_t, "%lld", (long long))
+#define	SPLAT_VERIFY3U_INLINE(x, y, z)					\
+	SPLAT_VERIFY3_INLINE(x, y, z, uint64_t, "%llu", (unsigned long long))
+#define	SPLAT_VERIFY3P_INLINE(x, y, z)					\
+	SPLAT_VERIFY3_INLINE(x, y, z, uintptr_t, "%p", (void *))
+#define	SPLAT_VERIFY0_INLINE(x)						\
+	SPLAT_VERIFY3_INLINE(0, ==, x, int64_t, "%lld", (long long))
+
+#define	SPLAT_VERIFY_VALUES		256
+#define	SPLAT_VERIFY_PASSES		20000
+
+static noinline uint64_t
+splat_generic_verify_inline(const uint64_t *vals, int n)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		SPLAT_VERIFY3P_INLINE(&vals[i], !=, NULL);
+		SPLAT_VERIFY3U_INLINE(vals[i], <, SPLAT_VERIFY_VALUES);
+		SPLAT_VERIFY3U_INLINE(vals[i], ==, i);
+		SPLAT_VERIFY3S_INLINE(vals[i] - i, >=, 0);
+		SPLAT_VERIFY0_INLINE(vals[i] & ~(SPLAT_VERIFY_VALUES - 1));
+		sum += vals[i];
+	}
+
+	return (sum);
+}
+
+static noinline uint64_t
+splat_generic_verify_outline(const uint64_t *vals, int n)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		VERIFY3P(&vals[i], !=, NULL);
+		VERIFY3U(vals[i], <, SPLAT_VERIFY_VALUES);
+		VERIFY3U(vals[i], ==, i);
+		VERIFY3S(vals[i] - i, >=, 0);
+		VERIFY0(vals[i] & ~(SPLAT_VERIFY_VALUES - 1));
+		sum += vals[i];
+	}
+
+	return (sum);
+}
+
+/*
+ * Determine the size of a function from its kallsyms entry which is
+ * formatted as "name+offset/size [module]".  Zero is returned when the
+ * kernel was built without CONFIG_KALLSYMS.
+ */
+static unsigned long
+splat_generic_text_size(void *func)
+{
+	char buf[KSYM_SYMBOL_LEN];
+	char *size;
+
+	sprint_symbol(buf, (unsigned long)func);
+	size = strchr(buf, '/');
+	if (size == NULL)
+		return (0);
+
+	return (simple_strtoul(size + 1, NULL, 16));
+}
+
+/*
+ * Compare the out-of-line VERIFY() implementation with the historical
+ * fully inlined one.  Both functions perform identical checks, the text
+ * size of each is reported along with the number of checks per second.
+ */
+static int
+splat_generic_test_verify(struct file *file, void *arg)
+{
+	uint64_t *vals, sum_inline = 0, sum_outline = 0;
+	struct timespec start, stop, d_inline, d_outline;
+	uint64_t checks, ns_inline, ns_outline;
+	int i;
+
+	vals = vmem_alloc(SPLAT_VERIFY_VALUES * sizeof (uint64_t), KM_SLEEP);
+	for (i = 0; i < SPLAT_VERIFY_VALUES; i++)
+		vals[i] = i;
+
+	getnstimeofday(&start);
+	for (i = 0; i < SPLAT_VERIFY_PASSES; i++)
+		sum_inline += splat_generic_verify_inline(vals,
+		    SPLAT_VERIFY_VALUES);
+	getnstimeofday(&stop);
+	d_inline = timespec_sub(stop, start);
+
+	getnstimeofday(&start);
+	for (i = 0; i < SPLAT_VERIFY_PASSES; i++)
+		sum_outline += splat_generic_verify_outline(vals,
+		    SPLAT_VERIFY_VALUES);
+	getnstimeofday(&stop);
+	d_outline = timespec_sub(stop, start);
+
+	vmem_free(vals, SPLAT_VERIFY_VALUES * sizeof (uint64_t));
+
+	checks = 5ULL * SPLAT_VERIFY_VALUES * SPLAT_VERIFY_PASSES;
+	ns_inline = MAX(timespec_to_ns(&d_inline), 1);
+	ns_outline = MAX(timespec_to_ns(&d_outline), 1);
+
+	splat_vprint(file, SPLAT_GENERIC_TEST7_NAME,
+	    "inline:  %lu bytes, %lld.%09ld secs, %llu checks/sec\n",
+	    splat_generic_text_size(splat_generic_verify_inline),
+	    (long long)d_inline.tv_sec, d_inline.tv_nsec,
+	    div64_u64(checks * NSEC_PER_SEC, ns_inline));
+	splat_vprint(file, SPLAT_GENERIC_TEST7_NAME,
+	    "outline: %lu bytes, %lld.%09ld secs, %llu checks/sec\n",
+	    splat_generic_text_size(splat_generic_verify_outline),
+	    (long long)d_outline.tv_sec, d_outline.tv_nsec,
+	    div64_u64(checks * NSEC_PER_SEC, ns_outline));
+
+	if (sum_inline != sum_outline) {
+		splat_vprint(file, SPLAT_GENERIC_TEST7_NAME,
+		    "Sum mismatch %llu != %llu\n", sum_inline, sum_outline);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+#define SPLAT_XDR_BUFSIZE	1024
+#define SPLAT_XDR_STRLEN	64
+#define SPLAT_XDR_NVALS		16
+
+typedef struct splat_xdr_rec {
+	char		sxr_char;
+	short		sxr_short;
+	int		sxr_int;
+	u_longlong_t	sxr_ull;
+	char		*sxr_str;
+	char		sxr_opaque[5];
+	uint_t		sxr_nvals;
+	u_longlong_t	*sxr_vals;
+	uint_t		sxr_nints;
+	int		*sxr_ints;
+} splat_xdr_rec_t;
+
+/* Code every supported type, the same routine encodes and decodes */
+static bool_t
+splat_generic_xdr_rec(XDR *xdrs, splat_xdr_rec_t *r)
+{
+	return (xdr_char(xdrs, &r->sxr_char) &&
+	    xdr_short(xdrs, &r->sxr_short) &&
+	    xdr_int(xdrs, &r->sxr_int) &&
+	    xdr_u_longlong_t(xdrs, &r->sxr_ull) &&
+	    xdr_string(xdrs, &r->sxr_str, SPLAT_XDR_STRLEN) &&
+	    xdr_opaque(xdrs, r->sxr_opaque, sizeof (r->sxr_opaque)) &&
+	    xdr_array(xdrs, (caddr_t *)&r->sxr_vals, &r->sxr_nvals,
+	    SPLAT_XDR_NVALS, sizeof (u_longlong_t),
+	    (xdrproc_t)xdr_u_longlong_t) &&
+	    xdr_array(xdrs, (caddr_t *)&r->sxr_ints, &r->sxr_nints,
+	    SPLAT_XDR_NVALS, sizeof (int), (xdrproc_t)xdr_int));
+}
+
+static int
+splat_generic_xdr_roundtrip(struct file *file, splat_xdr_rec_t *src,
+    caddr_t buf, int native)
+{
+	const char *type = native ? "native" : "xdr";
+	struct xdr_bytesrec rec;
+	splat_xdr_rec_t dst;
+	XDR xdrs;
+	int rc = 0;
+
+	memset(buf, 0xff, SPLAT_XDR_BUFSIZE);
+	xdrmem_create(&xdrs, buf, SPLAT_XDR_BUFSIZE,
+	    XDR_ENCODE | (native ? XDR_NATIVE : 0));
+	if (xdrs.x_ops == NULL || !splat_generic_xdr_rec(&xdrs, src)) {
+		splat_vprint(file, SPLAT_GENERIC_TEST8_NAME,
+		    "Failed to encode %s stream\n", type);
+		return -EINVAL;
+	}
+
+	(void) xdr_control(&xdrs, XDR_GET_BYTES_AVAIL, &rec);
+	splat_vprint(file, SPLAT_GENERIC_TEST8_NAME,
+	    "Encoded %s stream in %d bytes\n", type,
+	    SPLAT_XDR_BUFSIZE - (int)rec.xc_num_avail);
+
+	memset(&dst, 0, sizeof (dst));
+	xdrmem_create(&xdrs, buf, SPLAT_XDR_BUFSIZE,
+	    XDR_DECODE | (native ? XDR_NATIVE : 0));
+	if (xdrs.x_ops == NULL || !splat_generic_xdr_rec(&xdrs, &dst)) {
+		splat_vprint(file, SPLAT_GENERIC_TEST8_NAME,
+		    "Failed to decode %s stream\n", type);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (dst.sxr_char != src->sxr_char ||
+	    dst.sxr_short != src->sxr_short ||
+	    dst.sxr_int != src->sxr_int ||
+	    dst.sxr_ull != src->sxr_ull ||
+	    strcmp(dst.sxr_str, src->sxr_str) != 0 ||
+	    memcmp(dst.sxr_opaque, src->sxr_opaque,
+	    sizeof (src->sxr_opaque)) != 0 ||
+	    dst.sxr_nvals != src->sxr_nvals ||
+	    memcmp(dst.sxr_vals, src->sxr_vals,
+	    src->sxr_nvals * sizeof (u_longlong_t)) != 0 ||
+	    dst.sxr_nints != src->sxr_nints ||
+	    memcmp(dst.sxr_ints, src->sxr_ints,
+	    src->sxr_nints * sizeof (int)) != 0) {
+		splat_vprint(file, SPLAT_GENERIC_TEST8_NAME,
+		    "Decoded %s stream does not match\n", type);
+		rc = -EINVAL;
+	}
+out:
+	if (dst.sxr_str)
+		kmem_free(dst.sxr_str, strlen(dst.sxr_str) + 1);
+	if (dst.sxr_vals)
+		kmem_free(dst.sxr_vals, dst.sxr_nvals * sizeof (u_longlong_t));
+	if (dst.sxr_ints)
+		kmem_free(dst.sxr_ints, dst.sxr_nints * sizeof (int));
+
+	return rc;
+}
+
+/*
+ * Encode and decode a record containing every supported type using both
+ * a standard XDR memory stream and a native stream.  The leading char
+ * forces alignment padding in to the native stream.
+ */
+static int
+splat_generic_test_xdr_native(struct file *file, void *arg)
+{
+	u_longlong_t vals[SPLAT_XDR_NVALS];
+	int ints[SPLAT_XDR_NVALS];
+	char str[] = "splat xdr string";
+	splat_xdr_rec_t src;
+	caddr_t buf;
+	int i, rc;
+
+	for (i = 0; i < SPLAT_XDR_NVALS; i++) {
+		vals[i] = 0x0102030405060708ULL * (i + 1);
+		ints[i] = -i;
+	}
+
+	src.sxr_char = 'z';
+	src.sxr_short = -2;
+	src.sxr_int = 0x7eadbeef;
+	src.sxr_ull = 0xfedcba9876543210ULL;
+	src.sxr_str = str;
+	memcpy(src.sxr_opaque, "\x01\x02\x03\x04\x05", 5);
+	src.sxr_nvals = SPLAT_XDR_NVALS;
+	src.sxr_vals = vals;
+	src.sxr_nints = SPLAT_XDR_NVALS;
+	src.sxr_ints = ints;
+
+	buf = kmem_alloc(SPLAT_XDR_BUFSIZE, KM_SLEEP);
+
+	rc = splat_generic_xdr_roundtrip(file, &src, buf, 0);
+	if (rc == 0)
+		rc = splat_generic_xdr_roundtrip(file, &src, buf, 1);
+
+	kmem_free(buf, SPLAT_XDR_BUFSIZE);
+
+	return rc;
+}
+
+#define SPLAT_XDR_PERF_RECS	1024
+#define SPLAT_XDR_PERF_RECSIZE	16	/* u_int + u_longlong_t + char */
+#define SPLAT_XDR_PERF_PASSES	1000
+
+/*
+ * Encode or decode SPLAT_XDR_PERF_RECS records of three fields each, either
+ * through the inline xdr_*() functions or by calling through x_ops as every
+ * field used to.  Decoded values are summed in to *sum.
+ */
+static bool_t
+splat_generic_xdr_perf_pass(caddr_t buf, enum xdr_op op, int indirect,
+    uint64_t *sum)
+{
+	unsigned u;
+	u_longlong_t ull;
+	char c;
+	XDR xdrs;
+	int i;
+
+	xdrmem_create(&xdrs, buf, SPLAT_XDR_PERF_RECS * SPLAT_XDR_PERF_RECSIZE,
+	    op);
+
+	for (i = 0; i < SPLAT_XDR_PERF_RECS; i++) {
+		u = i;
+		ull = (u_longlong_t)i << 32;
+		c = i & 0x7f;
+
+		if (indirect) {
+			if (!xdrs.x_ops->xdr_u_int(&xdrs, &u) ||
+			    !xdrs.x_ops->xdr_u_longlong_t(&xdrs, &ull) ||
+			    !xdrs.x_ops->xdr_char(&xdrs, &c))
+				return FALSE;
+		} else {
+			if (!xdr_u_int(&xdrs, &u) ||
+			    !xdr_u_longlong_t(&xdrs, &ull) ||
+			    !xdr_char(&xdrs, &c))
+				return FALSE;
+		}
+
+		*sum += u + ull + c;
+	}
+
+	return TRUE;
+}
+
+static int
+splat_generic_xdr_perf(struct file *file, caddr_t buf, enum xdr_op op,
+    int indirect, uint64_t *sum)
+{
+	uint64_t fields, ns;
+	hrtime_t start;
+	int i;
+
+	start = gethrtime();
+	for (i = 0; i < SPLAT_XDR_PERF_PASSES; i++) {
+		if (!splat_generic_xdr_perf_pass(buf, op, indirect, sum)) {
+			splat_vprint(file, SPLAT_GENERIC_TEST9_NAME,
+			    "Failed to %s field\n",
+			    op == XDR_ENCODE ? "encode" : "decode");
+			return -EINVAL;
+		}
+	}
+	ns = MAX(gethrtime() - start, 1);
+
+	fields = 3ULL * SPLAT_XDR_PERF_RECS * SPLAT_XDR_PERF_PASSES;
+	splat_vprint(file, SPLAT_GENERIC_TEST9_NAME,
+	    "%s %s: %llu fields in %llu ns, %llu fields/sec\n",
+	    op == XDR_ENCODE ? "encode" : "decode",
+	    indirect ? "x_ops " : "inline", fields, ns,
+	    div64_u64(fields * NSEC_PER_SEC, ns));
+
+	return 0;
+}
+
+/*
+ * Compare the rate at which XDR memory stream fields are coded inline with
+ * the previous indirect call through x_ops for every field.  Both must
+ * produce identical streams and decode to identical values.
+ */
+static int
+splat_generic_test_xdr_perf(struct file *file, void *arg)
+{
+	uint64_t sum_inline = 0, sum_indirect = 0;
+	size_t size = SPLAT_XDR_PERF_RECS * SPLAT_XDR_PERF_RECSIZE;
+	caddr_t buf_inline, buf_indirect;
+	int rc;
+
+	buf_inline = vmem_alloc(size, KM_SLEEP);
+	buf_indirect = vmem_alloc(size, KM_SLEEP);
+
+	rc = splat_generic_xdr_perf(file, buf_indirect, XDR_ENCODE, 1,
+	    &sum_indirect);
+	if (rc == 0)
+		rc = splat_generic_xdr_perf(file, buf_inline, XDR_ENCODE, 0,
+		    &sum_inline);
+
+	if (rc == 0 && memcmp(buf_inline, buf_indirect, size) != 0) {
+		splat_vprint(file, SPLAT_GENERIC_TEST9_NAME, "%s",
+		    "Inline and x_ops encoded streams differ\n");
+		rc = -EINVAL;
+	}
+
+	sum_inline = sum_indirect = 0;
+	if (rc == 0)
+		rc = splat_generic_xdr_perf(file, buf_indirect, XDR_DECODE, 1,
+		    &sum_indirect);
+	if (rc == 0)
+		rc = splat_generic_xdr_perf(file, buf_inline, XDR_DECODE, 0,
+		    &sum_inline);
+
+	if (rc == 0 && sum_inline != sum_indirect) {
+		splat_vprint(file, SPLAT_GENERIC_TEST9_NAME,
+		    "Sum mismatch %llu != %llu\n", sum_inline, sum_indirect);
+		rc = -EINVAL;
+	}
+
+	vmem_free(buf_indirect, size);
+	vmem_free(buf_inline, size);
+
+	return rc;
+}
+
 splat_subsystem_t *
 splat_generic_init(void)
 {
@@ -341,6 +753,12 @@ splat_generic_init(void)
 	                SPLAT_GENERIC_TEST5_ID, splat_generic_test_udivdi3);
         SPLAT_TEST_INIT(sub, SPLAT_GENERIC_TEST6_NAME, SPLAT_GENERIC_TEST6_DESC,
 	                SPLAT_GENERIC_TEST6_ID, splat_generic_test_divdi3);
+        SPLAT_TEST_INIT(sub, SPLAT_GENERIC_TEST7_NAME, SPLAT_GENERIC_TEST7_DESC,
+	                SPLAT_GENERIC_TEST7_ID, splat_generic_test_verify);
+        SPLAT_TEST_INIT(sub, SPLAT_GENERIC_TEST8_NAME, SPLAT_GENERIC_TEST8_DESC,
+	                SPLAT_GENERIC_TEST8_ID, splat_generic_test_xdr_native);
+        SPLAT_TEST_INIT(sub, SPLAT_GENERIC_TEST9_NAME, SPLAT_GENERIC_TEST9_DESC,
+	                SPLAT_GENERIC_TEST9_ID, splat_generic_test_xdr_perf);
 
         return sub;
 }
@@ -350,6 +768,9 @@ splat_generic_fini(splat_subsystem_t *sub)
 {
         ASSERT(sub);
 
+        SPLAT_TEST_FINI(sub, SPLAT_GENERIC_TEST9_ID);
+        SPLAT_TEST_FINI(sub, SPLAT_GENERIC_TEST8_ID);
+        SPLAT_TEST_FINI(sub, SPLAT_GENERIC_TEST7_ID);
         SPLAT_TEST_FINI(sub, SPLAT_GENERIC_TEST6_ID);
         SPLAT_TEST_FINI(sub, SPLAT_GENERIC_TEST5_ID);
         SPLAT_TEST_FINI(sub, SPLAT_GENERIC_TEST4_ID);
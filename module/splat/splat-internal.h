@@ -181,6 +181,7 @@ splat_subsystem_t *splat_generic_init(void);
 splat_subsystem_t *splat_cred_init(void);
 splat_subsystem_t *splat_zlib_init(void);
 splat_subsystem_t *splat_linux_init(void);
+splat_subsystem_t *splat_kstat_init(void);
 
 void splat_condvar_fini(splat_subsystem_t *);
 void splat_kmem_fini(splat_subsystem_t *);
@@ -198,6 +199,7 @@ void splat_generic_fini(splat_subsystem_t *);
 void splat_cred_fini(splat_subsystem_t *);
 void splat_zlib_fini(splat_subsystem_t *);
 void splat_linux_fini(splat_subsystem_t *);
+void splat_kstat_fini(splat_subsystem_t *);
 
 int splat_condvar_id(void);
 int splat_kmem_id(void);
@@ -215,5 +217,6 @@ int splat_generic_id(void);
 int splat_cred_id(void);
 int splat_zlib_id(void);
 int splat_linux_id(void);
+int splat_kstat_id(void);
 
 #endif /* _SPLAT_INTERNAL_H */
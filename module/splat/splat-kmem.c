@@ -26,10 +26,15 @@
 
 #include <sys/kmem.h>
 #include <sys/kmem_cache.h>
+#include <sys/kmem_sg.h>
+#include <sys/kmem_page.h>
 #include <sys/vmem.h>
 #include <sys/random.h>
 #include <sys/thread.h>
 #include <sys/vmsystm.h>
+#include <linux/math64_compat.h>
+#include <linux/compiler_compat.h>
+#include <linux/delay.h>
 #include "splat-internal.h"
 
 #define SPLAT_KMEM_NAME			"kmem"
@@ -85,6 +90,42 @@
 #define SPLAT_KMEM_TEST13_NAME		"slab_reclaim"
 #define SPLAT_KMEM_TEST13_DESC		"Slab direct memory reclaim test"
 
+#define SPLAT_KMEM_TEST14_ID		0x010e
+#define SPLAT_KMEM_TEST14_NAME		"slab_color"
+#define SPLAT_KMEM_TEST14_DESC		"Slab coloring strided walk test"
+
+#define SPLAT_KMEM_TEST15_ID		0x010f
+#define SPLAT_KMEM_TEST15_NAME		"slab_merge"
+#define SPLAT_KMEM_TEST15_DESC		"Slab cache merging test"
+
+#define SPLAT_KMEM_TEST16_ID		0x0110
+#define SPLAT_KMEM_TEST16_NAME		"slab_rcu"
+#define SPLAT_KMEM_TEST16_DESC		"Slab type-safe-by-RCU test"
+
+#define SPLAT_KMEM_TEST17_ID		0x0111
+#define SPLAT_KMEM_TEST17_NAME		"zero_pool"
+#define SPLAT_KMEM_TEST17_DESC		"Pre-zeroed kmem_zalloc() pool test"
+
+#define SPLAT_KMEM_TEST18_ID		0x0112
+#define SPLAT_KMEM_TEST18_NAME		"sg"
+#define SPLAT_KMEM_TEST18_DESC		"Scatter-list allocation test"
+
+#define SPLAT_KMEM_TEST19_ID		0x0113
+#define SPLAT_KMEM_TEST19_NAME		"reap"
+#define SPLAT_KMEM_TEST19_DESC		"Background reaper test"
+
+#define SPLAT_KMEM_TEST20_ID		0x0114
+#define SPLAT_KMEM_TEST20_NAME		"slab_auto"
+#define SPLAT_KMEM_TEST20_DESC		"Slab backend migration test"
+
+#define SPLAT_KMEM_TEST21_ID		0x0115
+#define SPLAT_KMEM_TEST21_NAME		"page_pool"
+#define SPLAT_KMEM_TEST21_DESC		"Per-cpu page pool test"
+
+#define SPLAT_KMEM_TEST22_ID		0x0116
+#define SPLAT_KMEM_TEST22_NAME		"mag_limit"
+#define SPLAT_KMEM_TEST22_DESC		"Magazine budget test"
+
 #define SPLAT_KMEM_ALLOC_COUNT		10
 #define SPLAT_VMEM_ALLOC_COUNT		10
 
@@ -1326,6 +1367,803 @@ out:
 	return rc;
 }
 
+/*
+ * Objects are sized and aligned such that including the spl_kmem_obj_t
+ * they occupy exactly one page.  Without coloring the first cache line of
+ * every object therefore lands at the same page offset and maps to the
+ * same cache sets.
+ */
+#define SPLAT_KMEM_COLOR_ALIGN		64
+#define SPLAT_KMEM_COLOR_SIZE		(PAGE_SIZE - SPLAT_KMEM_COLOR_ALIGN)
+#define SPLAT_KMEM_COLOR_OBJS		8192
+#define SPLAT_KMEM_COLOR_PASSES		64
+
+static int
+splat_kmem_color_walk(struct file *file, uint64_t *nsec, uint32_t *colors)
+{
+	kmem_cache_t *cache;
+	struct timespec start, stop, delta;
+	uint64_t **objs, sum = 0;
+	int i, j, rc = 0;
+
+	objs = vmem_zalloc(SPLAT_KMEM_COLOR_OBJS * sizeof (uint64_t *),
+	    KM_SLEEP);
+
+	cache = kmem_cache_create(SPLAT_KMEM_CACHE_NAME,
+	    SPLAT_KMEM_COLOR_SIZE, SPLAT_KMEM_COLOR_ALIGN,
+	    NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
+	if (cache == NULL) {
+		splat_vprint(file, SPLAT_KMEM_TEST14_NAME,
+		    "Unable to create '%s'\n", SPLAT_KMEM_CACHE_NAME);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Colors advance by the object alignment or a cache line */
+	*colors = cache->skc_slab_color_max /
+	    MAX(cache->skc_obj_align, L1_CACHE_BYTES) + 1;
+
+	for (i = 0; i < SPLAT_KMEM_COLOR_OBJS; i++) {
+		objs[i] = kmem_cache_alloc(cache, KM_SLEEP);
+		*objs[i] = i;
+	}
+
+	getnstimeofday(&start);
+	for (j = 0; j < SPLAT_KMEM_COLOR_PASSES; j++)
+		for (i = 0; i < SPLAT_KMEM_COLOR_OBJS; i++)
+			sum += ACCESS_ONCE(*objs[i]);
+	getnstimeofday(&stop);
+	delta = timespec_sub(stop, start);
+	*nsec = timespec_to_ns(&delta);
+
+	for (i = 0; i < SPLAT_KMEM_COLOR_OBJS; i++)
+		kmem_cache_free(cache, objs[i]);
+
+	kmem_cache_destroy(cache);
+
+	if (sum != (uint64_t)SPLAT_KMEM_COLOR_PASSES *
+	    SPLAT_KMEM_COLOR_OBJS * (SPLAT_KMEM_COLOR_OBJS - 1) / 2) {
+		splat_vprint(file, SPLAT_KMEM_TEST14_NAME,
+		    "Walk checksum mismatch %llu\n", sum);
+		rc = -EINVAL;
+	}
+out:
+	vmem_free(objs, SPLAT_KMEM_COLOR_OBJS * sizeof (uint64_t *));
+
+	return rc;
+}
+
+/*
+ * Measure the effect of slab coloring by repeatedly walking the first
+ * word of a large number of page sized objects, once with coloring
+ * disabled and once with it enabled.  The walk time is used as a proxy
+ * for the cache miss rate, conflict misses make the uncolored walk slower.
+ */
+static int
+splat_kmem_test14(struct file *file, void *arg)
+{
+	unsigned int spl_kmem_cache_color_old;
+	uint64_t nsec_plain = 0, nsec_color = 0;
+	uint64_t accesses;
+	uint32_t colors_plain = 0, colors_color = 0;
+	int rc;
+
+	spl_kmem_cache_color_old = spl_kmem_cache_color;
+
+	spl_kmem_cache_color = 0;
+	rc = splat_kmem_color_walk(file, &nsec_plain, &colors_plain);
+	if (rc)
+		goto out;
+
+	spl_kmem_cache_color = 1;
+	rc = splat_kmem_color_walk(file, &nsec_color, &colors_color);
+	if (rc)
+		goto out;
+
+	accesses = (uint64_t)SPLAT_KMEM_COLOR_PASSES * SPLAT_KMEM_COLOR_OBJS;
+	splat_vprint(file, SPLAT_KMEM_TEST14_NAME,
+	    "uncolored: %u color(s), %llu ns, %llu ps/access\n",
+	    colors_plain, nsec_plain,
+	    div64_u64(nsec_plain * 1000, accesses));
+	splat_vprint(file, SPLAT_KMEM_TEST14_NAME,
+	    "colored:   %u color(s), %llu ns, %llu ps/access\n",
+	    colors_color, nsec_color,
+	    div64_u64(nsec_color * 1000, accesses));
+out:
+	spl_kmem_cache_color = spl_kmem_cache_color_old;
+
+	return rc;
+}
+
+/*
+ * Verify that two identically shaped caches are merged on to the same
+ * backing cache while each keeps an accurate count of its own objects,
+ * and that caches with a constructor are never merged.
+ */
+static int
+splat_kmem_test15(struct file *file, void *arg)
+{
+	kmem_cache_t *cache1, *cache2, *cache3;
+	void *obj1, *obj2, *obj3;
+	unsigned int spl_kmem_cache_merge_old;
+	int rc = 0;
+
+	/* Merging is decided when a cache is created */
+	spl_kmem_cache_merge_old = spl_kmem_cache_merge;
+	spl_kmem_cache_merge = 1;
+
+	cache1 = kmem_cache_create("kmem_test_merge1", 4096, 0,
+	    NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
+	cache2 = kmem_cache_create("kmem_test_merge2", 4096, 0,
+	    NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
+	cache3 = kmem_cache_create("kmem_test_merge3", 4096, 0,
+	    splat_kmem_cache_test_constructor, NULL, NULL, NULL, NULL,
+	    KMC_KMEM);
+
+	spl_kmem_cache_merge = spl_kmem_cache_merge_old;
+	if (!cache1 || !cache2 || !cache3) {
+		splat_vprint(file, SPLAT_KMEM_TEST15_NAME, "%s",
+		    "Unable to create caches\n");
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (cache1->skc_merge == NULL ||
+	    cache1->skc_merge != cache2->skc_merge) {
+		splat_vprint(file, SPLAT_KMEM_TEST15_NAME,
+		    "Caches not merged %p != %p\n",
+		    cache1->skc_merge, cache2->skc_merge);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (cache3->skc_merge != NULL) {
+		splat_vprint(file, SPLAT_KMEM_TEST15_NAME, "%s",
+		    "Cache with constructor was merged\n");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	obj1 = kmem_cache_alloc(cache1, KM_SLEEP);
+	obj2 = kmem_cache_alloc(cache2, KM_SLEEP);
+	obj3 = kmem_cache_alloc(cache2, KM_SLEEP);
+
+	if (atomic_long_read(&cache1->skc_merge_alloc) != 1 ||
+	    atomic_long_read(&cache2->skc_merge_alloc) != 2) {
+		splat_vprint(file, SPLAT_KMEM_TEST15_NAME,
+		    "Incorrect accounting %ld/1 %ld/2\n",
+		    atomic_long_read(&cache1->skc_merge_alloc),
+		    atomic_long_read(&cache2->skc_merge_alloc));
+		rc = -EINVAL;
+	}
+
+	kmem_cache_free(cache1, obj1);
+	kmem_cache_free(cache2, obj2);
+	kmem_cache_free(cache2, obj3);
+
+	if (rc == 0)
+		splat_vprint(file, SPLAT_KMEM_TEST15_NAME,
+		    "Merged '%s' and '%s' on to '%s'\n", cache1->skc_name,
+		    cache2->skc_name, cache1->skc_merge->skc_name);
+out:
+	if (cache3)
+		kmem_cache_destroy(cache3);
+	if (cache2)
+		kmem_cache_destroy(cache2);
+	if (cache1)
+		kmem_cache_destroy(cache1);
+
+	return rc;
+}
+
+/*
+ * Repeatedly populate and reap a KMC_TYPESAFE_BY_RCU cache so slabs are
+ * released through the deferred RCU path, then verify the cache can be
+ * cleanly destroyed while deferred slab frees are still outstanding.
+ */
+#define	SPLAT_KMEM_RCU_OBJS	1024
+#define	SPLAT_KMEM_RCU_PASSES	16
+
+static int
+splat_kmem_test16(struct file *file, void *arg)
+{
+	kmem_cache_t *cache;
+	void **objs;
+	unsigned long slabs = 0;
+	int i, j, rc = 0;
+
+	objs = vmem_zalloc(SPLAT_KMEM_RCU_OBJS * sizeof (void *), KM_SLEEP);
+
+	cache = kmem_cache_create(SPLAT_KMEM_CACHE_NAME, PAGE_SIZE / 4, 0,
+	    NULL, NULL, NULL, NULL, NULL, KMC_KMEM | KMC_TYPESAFE_BY_RCU);
+	if (cache == NULL) {
+		splat_vprint(file, SPLAT_KMEM_TEST16_NAME, "%s",
+		    "Unable to create cache\n");
+		vmem_free(objs, SPLAT_KMEM_RCU_OBJS * sizeof (void *));
+		return (-ENOMEM);
+	}
+
+	for (i = 0; i < SPLAT_KMEM_RCU_PASSES; i++) {
+		for (j = 0; j < SPLAT_KMEM_RCU_OBJS; j++) {
+			objs[j] = kmem_cache_alloc(cache, KM_SLEEP);
+			memset(objs[j], 0x5a, PAGE_SIZE / 4);
+		}
+
+		slabs += cache->skc_slab_total;
+
+		for (j = 0; j < SPLAT_KMEM_RCU_OBJS; j++)
+			kmem_cache_free(cache, objs[j]);
+
+		kmem_cache_reap_now(cache);
+	}
+
+	splat_vprint(file, SPLAT_KMEM_TEST16_NAME,
+	    "Cycled %lu slabs over %d passes, %lu slabs remain\n",
+	    slabs, SPLAT_KMEM_RCU_PASSES, (unsigned long)cache->skc_slab_total);
+
+	/* Destroy must wait for all deferred slab frees to complete */
+	kmem_cache_destroy(cache);
+	vmem_free(objs, SPLAT_KMEM_RCU_OBJS * sizeof (void *));
+
+	return (rc);
+}
+
+/*
+ * Enable the pre-zeroed buffer pool and verify kmem_zalloc() continues
+ * to return zeroed memory while being served from the pool.
+ */
+#define	SPLAT_KMEM_ZERO_POOL	8
+#define	SPLAT_KMEM_ZERO_PASSES	64
+
+static int
+splat_kmem_test17(struct file *file, void *arg)
+{
+	unsigned int zero_pool = spl_kmem_zero_pool;
+	uint64_t hits, misses;
+	size_t size = 2 * PAGE_SIZE;
+	char *ptr;
+	int i, j, rc = 0;
+
+	hits = spl_kmem_zero_stat(SPL_KMEM_ZERO_HITS);
+	misses = spl_kmem_zero_stat(SPL_KMEM_ZERO_MISSES);
+	spl_kmem_zero_pool = SPLAT_KMEM_ZERO_POOL;
+
+	for (i = 0; i < SPLAT_KMEM_ZERO_PASSES && rc == 0; i++) {
+		ptr = kmem_zalloc(size, KM_SLEEP);
+
+		for (j = 0; j < size; j++) {
+			if (ptr[j] != 0) {
+				splat_vprint(file, SPLAT_KMEM_TEST17_NAME,
+				    "Buffer %p not zeroed at offset %d\n",
+				    ptr, j);
+				rc = -EFAULT;
+				break;
+			}
+		}
+
+		/* Dirty the buffer to catch it being returned to the pool */
+		memset(ptr, 0xaa, size);
+		kmem_free(ptr, size);
+
+		/* Allow the background thread to refill the pool */
+		if ((i % SPLAT_KMEM_ZERO_POOL) == 0)
+			msleep(10);
+	}
+
+	spl_kmem_zero_pool = zero_pool;
+	hits = spl_kmem_zero_stat(SPL_KMEM_ZERO_HITS) - hits;
+	misses = spl_kmem_zero_stat(SPL_KMEM_ZERO_MISSES) - misses;
+
+	if (rc == 0 && hits == 0) {
+		splat_vprint(file, SPLAT_KMEM_TEST17_NAME, "%s",
+		    "No allocations served from the pool\n");
+		rc = -EINVAL;
+	}
+
+	if (rc == 0)
+		splat_vprint(file, SPLAT_KMEM_TEST17_NAME,
+		    "%d allocations, %llu pool hits, %llu misses\n",
+		    SPLAT_KMEM_ZERO_PASSES, (unsigned long long)hits,
+		    (unsigned long long)misses);
+
+	return (rc);
+}
+
+/*
+ * Validate the scatter-list copy, compare, and checksum helpers against
+ * the same operations performed on a linear buffer.  The ranges used
+ * deliberately start and end in the middle of chunks.
+ */
+#define	SPLAT_KMEM_SG_SIZE	((4 * 1024 * 1024) + 12)
+
+static void
+splat_kmem_fletcher_4(const void *buf, size_t len, uint64_t *cksum)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (len / sizeof (uint32_t));
+	uint64_t a = 0, b = 0, c = 0, d = 0;
+
+	for (; ip < ipend; ip++) {
+		a += ip[0];
+		b += a;
+		c += b;
+		d += c;
+	}
+
+	cksum[0] = a;
+	cksum[1] = b;
+	cksum[2] = c;
+	cksum[3] = d;
+}
+
+static int
+splat_kmem_test18(struct file *file, void *arg)
+{
+	kmem_sg_t *sg1, *sg2;
+	uint64_t cksum1[4], cksum2[4];
+	size_t size = SPLAT_KMEM_SG_SIZE, off = PAGE_SIZE + 12;
+	char *buf;
+	int i, rc = 0;
+
+	buf = vmem_alloc(size, KM_SLEEP);
+	for (i = 0; i < size; i++)
+		buf[i] = (char)(i * 7);
+
+	sg1 = kmem_sg_zalloc(size, KM_SLEEP);
+	sg2 = kmem_sg_alloc(size, KM_SLEEP);
+
+	splat_vprint(file, SPLAT_KMEM_TEST18_NAME,
+	    "Allocated %lu bytes as %u order-%u chunks\n",
+	    (unsigned long)size, sg1->ksg_nchunks, sg1->ksg_order);
+
+	kmem_sg_copy_from_buf(sg1, 0, buf, size);
+	if (kmem_sg_cmp(sg1, 0, buf, size) != 0) {
+		splat_vprint(file, SPLAT_KMEM_TEST18_NAME, "%s",
+		    "Linear copy mismatch\n");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	kmem_sg_zero(sg2, 0, size);
+	kmem_sg_copy(sg2, off, sg1, off, size - 2 * off);
+	if (kmem_sg_cmp(sg2, off, buf + off, size - 2 * off) != 0) {
+		splat_vprint(file, SPLAT_KMEM_TEST18_NAME, "%s",
+		    "Scatter-list copy mismatch\n");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	memset(buf, 0, off);
+	kmem_sg_copy_to_buf(buf, sg2, 0, off);
+	for (i = 0; i < off; i++) {
+		if (buf[i] != 0) {
+			splat_vprint(file, SPLAT_KMEM_TEST18_NAME,
+			    "Unexpected data at offset %d\n", i);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	kmem_sg_copy_to_buf(buf, sg1, 0, off);
+	kmem_sg_fletcher_4(sg1, off, size - off, cksum1);
+	splat_kmem_fletcher_4(buf + off, size - off, cksum2);
+	if (memcmp(cksum1, cksum2, sizeof (cksum1)) != 0) {
+		splat_vprint(file, SPLAT_KMEM_TEST18_NAME,
+		    "Checksum mismatch %llx/%llx\n",
+		    (unsigned long long)cksum1[3],
+		    (unsigned long long)cksum2[3]);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	splat_vprint(file, SPLAT_KMEM_TEST18_NAME,
+	    "Copy, compare, and checksum of %lu bytes verified\n",
+	    (unsigned long)size);
+out:
+	kmem_sg_free(sg2);
+	kmem_sg_free(sg1);
+	vmem_free(buf, size);
+
+	return (rc);
+}
+
+/*
+ * Force the background reaper to run by raising the watermark to all of
+ * memory.  A cache with only free slabs is expected to either have its
+ * slabs released or its reclaim callback invoked within a few passes.
+ */
+#define	SPLAT_KMEM_REAP_OBJS		1024
+#define	SPLAT_KMEM_REAP_SIZE		1024
+#define	SPLAT_KMEM_REAP_INTERVAL	10	/* Milliseconds */
+#define	SPLAT_KMEM_REAP_TRIES		50
+
+static void
+splat_kmem_test19_reclaim(void *priv)
+{
+	atomic_inc((atomic_t *)priv);
+}
+
+static int
+splat_kmem_test19(struct file *file, void *arg)
+{
+	unsigned int interval = spl_kmem_reap_interval;
+	unsigned int watermark = spl_kmem_reap_watermark;
+	kmem_cache_t *cache;
+	atomic_t reclaims;
+	uint64_t active, bytes;
+	uint64_t slabs;
+	void **objs;
+	int i, rc = 0;
+
+	objs = vmem_zalloc(SPLAT_KMEM_REAP_OBJS * sizeof (void *), KM_SLEEP);
+	atomic_set(&reclaims, 0);
+
+	cache = kmem_cache_create(SPLAT_KMEM_CACHE_NAME,
+	    SPLAT_KMEM_REAP_SIZE, 0, NULL, NULL, splat_kmem_test19_reclaim,
+	    &reclaims, NULL, KMC_KMEM);
+	if (cache == NULL) {
+		splat_vprint(file, SPLAT_KMEM_TEST19_NAME,
+		    "Unable to create '%s'\n", SPLAT_KMEM_CACHE_NAME);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < SPLAT_KMEM_REAP_OBJS; i++)
+		objs[i] = kmem_cache_alloc(cache, KM_SLEEP);
+
+	for (i = 0; i < SPLAT_KMEM_REAP_OBJS; i++)
+		kmem_cache_free(cache, objs[i]);
+
+	slabs = cache->skc_slab_total;
+	active = spl_kmem_reap_stat(SPL_KMEM_REAP_ACTIVE);
+	bytes = spl_kmem_reap_stat(SPL_KMEM_REAP_BYTES);
+
+	spl_kmem_reap_interval = SPLAT_KMEM_REAP_INTERVAL;
+	spl_kmem_reap_watermark = 100;
+	spl_kmem_reap_schedule();
+
+	for (i = 0; i < SPLAT_KMEM_REAP_TRIES; i++) {
+		msleep(100);
+
+		if (cache->skc_slab_total < slabs ||
+		    atomic_read(&reclaims) > 0)
+			break;
+	}
+
+	spl_kmem_reap_watermark = watermark;
+	spl_kmem_reap_interval = interval;
+
+	active = spl_kmem_reap_stat(SPL_KMEM_REAP_ACTIVE) - active;
+	bytes = spl_kmem_reap_stat(SPL_KMEM_REAP_BYTES) - bytes;
+
+	if (i == SPLAT_KMEM_REAP_TRIES) {
+		splat_vprint(file, SPLAT_KMEM_TEST19_NAME,
+		    "Cache not reaped, %llu of %llu slabs remain\n",
+		    (unsigned long long)cache->skc_slab_total,
+		    (unsigned long long)slabs);
+		rc = -EINVAL;
+	} else {
+		splat_vprint(file, SPLAT_KMEM_TEST19_NAME,
+		    "Reaped %llu to %llu slabs, %d reclaims, %llu active "
+		    "passes, %llu bytes released\n", (unsigned long long)slabs,
+		    (unsigned long long)cache->skc_slab_total,
+		    atomic_read(&reclaims), (unsigned long long)active,
+		    (unsigned long long)bytes);
+	}
+
+	kmem_cache_destroy(cache);
+out:
+	vmem_free(objs, SPLAT_KMEM_REAP_OBJS * sizeof (void *));
+
+	return (rc);
+}
+
+/*
+ * Drive a KMC_AUTO cache from the Linux slab to the SPL slab by allocating
+ * at a high rate, then back to the Linux slab by leaving it idle.  Objects
+ * allocated before each migration are freed after it to verify they are
+ * returned to the backend they were allocated from.
+ */
+#define	SPLAT_KMEM_AUTO_OBJS		256
+#define	SPLAT_KMEM_AUTO_SIZE		256
+#define	SPLAT_KMEM_AUTO_TRIES		600	/* 100ms each */
+
+static int
+splat_kmem_test20_constructor(void *ptr, void *priv, int flags)
+{
+	memset(ptr, 0, SPLAT_KMEM_AUTO_SIZE);
+	return (0);
+}
+
+static int
+splat_kmem_test20_migrate(struct file *file, kmem_cache_t *cache,
+    void **objs, int slab)
+{
+	void *obj;
+	int i, j;
+
+	for (i = 0; i < SPLAT_KMEM_AUTO_TRIES; i++) {
+		if (!!(cache->skc_flags & KMC_SLAB) == slab)
+			break;
+
+		/* Churn objects while waiting to move to the SPL slab */
+		for (j = 0; !slab && j < SPLAT_KMEM_AUTO_OBJS; j++) {
+			obj = kmem_cache_alloc(cache, KM_SLEEP);
+			kmem_cache_free(cache, obj);
+		}
+
+		msleep(100);
+	}
+
+	if (i == SPLAT_KMEM_AUTO_TRIES) {
+		splat_vprint(file, SPLAT_KMEM_TEST20_NAME,
+		    "Cache did not move to the %s slab, flags 0x%lx\n",
+		    slab ? "Linux" : "SPL", cache->skc_flags);
+		return (-ETIMEDOUT);
+	}
+
+	splat_vprint(file, SPLAT_KMEM_TEST20_NAME,
+	    "Moved to the %s slab at %llu allocs/s (%s)\n",
+	    slab ? "Linux" : "SPL", (unsigned long long)cache->skc_auto_rate,
+	    spl_kmem_cache_reason(cache));
+
+	/* Free the objects allocated before the migration */
+	for (i = 0; i < SPLAT_KMEM_AUTO_OBJS; i++) {
+		if (objs[i] != NULL)
+			kmem_cache_free(cache, objs[i]);
+
+		objs[i] = NULL;
+	}
+
+	return (0);
+}
+
+static int
+splat_kmem_test20(struct file *file, void *arg)
+{
+	unsigned int auto_rate = spl_kmem_cache_auto_rate;
+	kmem_cache_t *cache;
+	uint64_t alloc;
+	void **objs;
+	int i, rc = 0;
+
+	objs = vmem_zalloc(SPLAT_KMEM_AUTO_OBJS * sizeof (void *), KM_SLEEP);
+	spl_kmem_cache_auto_rate = 1;
+
+	cache = kmem_cache_create(SPLAT_KMEM_CACHE_NAME,
+	    SPLAT_KMEM_AUTO_SIZE, 0, splat_kmem_test20_constructor, NULL,
+	    NULL, NULL, NULL, 0);
+	if (cache == NULL) {
+		splat_vprint(file, SPLAT_KMEM_TEST20_NAME,
+		    "Unable to create '%s'\n", SPLAT_KMEM_CACHE_NAME);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (!(cache->skc_flags & KMC_AUTO)) {
+		splat_vprint(file, SPLAT_KMEM_TEST20_NAME,
+		    "Cache '%s' not created with KMC_AUTO, flags 0x%lx\n",
+		    SPLAT_KMEM_CACHE_NAME, cache->skc_flags);
+		rc = -EINVAL;
+		goto out_cache;
+	}
+
+	for (i = 0; i < SPLAT_KMEM_AUTO_OBJS; i++)
+		objs[i] = kmem_cache_alloc(cache, KM_SLEEP);
+
+	rc = splat_kmem_test20_migrate(file, cache, objs, 0);
+	if (rc)
+		goto out_objs;
+
+	/* An idle cache with little in use returns to the Linux slab */
+	objs[0] = kmem_cache_alloc(cache, KM_SLEEP);
+	spl_kmem_cache_auto_rate = INT_MAX;
+	rc = splat_kmem_test20_migrate(file, cache, objs, 1);
+	if (rc)
+		goto out_objs;
+
+	/* Objects left in magazines are counted as allocated */
+	down_read(&spl_kmem_cache_sem);
+	alloc = cache->skc_obj_alloc -
+	    spl_kmem_cache_magazine_bytes(cache) / cache->skc_obj_size;
+	up_read(&spl_kmem_cache_sem);
+	if (spl_kmem_cache_linux_alloc(cache) != 0 || alloc != 0) {
+		splat_vprint(file, SPLAT_KMEM_TEST20_NAME,
+		    "Objects leaked, %lu Linux slab, %llu SPL slab\n",
+		    spl_kmem_cache_linux_alloc(cache),
+		    (unsigned long long)alloc);
+		rc = -EINVAL;
+	}
+out_objs:
+	for (i = 0; i < SPLAT_KMEM_AUTO_OBJS; i++)
+		if (objs[i] != NULL)
+			kmem_cache_free(cache, objs[i]);
+out_cache:
+	kmem_cache_destroy(cache);
+out:
+	spl_kmem_cache_auto_rate = auto_rate;
+	vmem_free(objs, SPLAT_KMEM_AUTO_OBJS * sizeof (void *));
+
+	return (rc);
+}
+
+/*
+ * Dirty and free a set of pool pages, then verify reallocated KM_ZERO
+ * pages are zeroed and that pages were recycled through the pool.
+ */
+#define	SPLAT_KMEM_PAGE_COUNT		128
+#define	SPLAT_KMEM_PAGE_POOL		256
+
+static int
+splat_kmem_test21(struct file *file, void *arg)
+{
+	unsigned int page_pool = spl_kmem_page_pool;
+	struct page **pages;
+	uint64_t hits, misses;
+	char *ptr;
+	int i, j, rc = 0;
+
+	pages = vmem_zalloc(SPLAT_KMEM_PAGE_COUNT * sizeof (struct page *),
+	    KM_SLEEP);
+	if (spl_kmem_page_pool == 0)
+		spl_kmem_page_pool = SPLAT_KMEM_PAGE_POOL;
+
+	for (i = 0; i < SPLAT_KMEM_PAGE_COUNT; i++) {
+		pages[i] = kmem_page_alloc(KM_SLEEP);
+		memset(page_address(pages[i]), 0xaa, PAGE_SIZE);
+	}
+
+	for (i = 0; i < SPLAT_KMEM_PAGE_COUNT; i++)
+		kmem_page_free(pages[i]);
+
+	hits = kmem_page_stat(SPL_KMEM_PAGE_HITS);
+	misses = kmem_page_stat(SPL_KMEM_PAGE_MISSES);
+
+	for (i = 0; i < SPLAT_KMEM_PAGE_COUNT; i++)
+		pages[i] = kmem_page_alloc(KM_SLEEP | KM_ZERO);
+
+	hits = kmem_page_stat(SPL_KMEM_PAGE_HITS) - hits;
+	misses = kmem_page_stat(SPL_KMEM_PAGE_MISSES) - misses;
+
+	for (i = 0; i < SPLAT_KMEM_PAGE_COUNT && rc == 0; i++) {
+		ptr = page_address(pages[i]);
+		for (j = 0; j < PAGE_SIZE; j++) {
+			if (ptr[j] != 0) {
+				splat_vprint(file, SPLAT_KMEM_TEST21_NAME,
+				    "Page %d not zeroed at offset %d\n", i, j);
+				rc = -EFAULT;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < SPLAT_KMEM_PAGE_COUNT; i++)
+		kmem_page_free(pages[i]);
+
+	spl_kmem_page_pool = page_pool;
+	vmem_free(pages, SPLAT_KMEM_PAGE_COUNT * sizeof (struct page *));
+
+	if (rc == 0 && hits == 0) {
+		splat_vprint(file, SPLAT_KMEM_TEST21_NAME, "%s",
+		    "No pages served from the pool\n");
+		rc = -EINVAL;
+	}
+
+	if (rc == 0)
+		splat_vprint(file, SPLAT_KMEM_TEST21_NAME,
+		    "%d pages, %llu pool hits, %llu misses\n",
+		    SPLAT_KMEM_PAGE_COUNT, (unsigned long long)hits,
+		    (unsigned long long)misses);
+
+	return (rc);
+}
+
+/*
+ * Memory held by all magazines, and the most the magazines may hold when
+ * every cache is reduced to the minimum magazine size regardless of the
+ * budget.
+ */
+static uint64_t
+splat_kmem_test22_total(uint64_t *floor)
+{
+	spl_kmem_cache_t *skc;
+	uint64_t total;
+
+	down_read(&spl_kmem_cache_sem);
+	total = spl_kmem_cache_magazine_total(NULL);
+	*floor = 0;
+	list_for_each_entry(skc, &spl_kmem_cache_list, skc_list) {
+		if (skc->skc_flags & KMC_NOMAGAZINE)
+			continue;
+
+		*floor += (uint64_t)MIN(SPL_MAGAZINE_MIN, skc->skc_mag_size) *
+		    num_online_cpus() * skc->skc_obj_size;
+	}
+	up_read(&spl_kmem_cache_sem);
+
+	return (total);
+}
+
+/*
+ * Fill the magazines of a cache, then halve the magazine budget and force
+ * a rebalance.  The memory held by all magazines must fall within the
+ * budget, allowing for caches which are already at the minimum magazine
+ * size, and the magazines must return to full size once it is restored.
+ */
+#define	SPLAT_KMEM_MAG_OBJS		1024
+#define	SPLAT_KMEM_MAG_SIZE		1024
+#define	SPLAT_KMEM_MAG_PASSES		4
+
+static int
+splat_kmem_test22(struct file *file, void *arg)
+{
+	unsigned long limit_old = spl_kmem_cache_magazine_limit;
+	uint64_t before, after, floor, limit;
+	kmem_cache_t *cache;
+	void **objs;
+	int i, rc = 0;
+
+	objs = vmem_zalloc(SPLAT_KMEM_MAG_OBJS * sizeof (void *), KM_SLEEP);
+
+	cache = kmem_cache_create(SPLAT_KMEM_CACHE_NAME, SPLAT_KMEM_MAG_SIZE,
+	    0, NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
+	if (cache == NULL) {
+		splat_vprint(file, SPLAT_KMEM_TEST22_NAME,
+		    "Unable to create '%s'\n", SPLAT_KMEM_CACHE_NAME);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Objects freed on this cpu fill its magazine */
+	for (i = 0; i < SPLAT_KMEM_MAG_OBJS; i++)
+		objs[i] = kmem_cache_alloc(cache, KM_SLEEP);
+
+	for (i = 0; i < SPLAT_KMEM_MAG_OBJS; i++)
+		kmem_cache_free(cache, objs[i]);
+
+	before = splat_kmem_test22_total(&floor);
+	limit = MAX(before / 2, 1);
+	spl_kmem_cache_magazine_limit = limit;
+
+	/* A contended cache lock leaves a magazine to the next pass */
+	for (i = 0; i < SPLAT_KMEM_MAG_PASSES; i++) {
+		spl_kmem_cache_magazine_balance();
+		after = splat_kmem_test22_total(&floor);
+		if (after <= limit + floor)
+			break;
+	}
+
+	splat_vprint(file, SPLAT_KMEM_TEST22_NAME,
+	    "Magazines held %llu bytes, %llu bytes with a %llu byte limit "
+	    "and %llu byte minimum, magazine size %u/%u\n",
+	    (unsigned long long)before, (unsigned long long)after,
+	    (unsigned long long)limit, (unsigned long long)floor,
+	    cache->skc_mag_target, cache->skc_mag_size);
+
+	if (after > limit + floor) {
+		splat_vprint(file, SPLAT_KMEM_TEST22_NAME, "%s",
+		    "Magazines exceed the limit\n");
+		rc = -EINVAL;
+	}
+
+	spl_kmem_cache_magazine_limit = limit_old;
+	spl_kmem_cache_magazine_balance();
+
+	if (rc == 0 && cache->skc_mag_target != cache->skc_mag_size) {
+		splat_vprint(file, SPLAT_KMEM_TEST22_NAME,
+		    "Magazine size %u not restored to %u\n",
+		    cache->skc_mag_target, cache->skc_mag_size);
+		rc = -EINVAL;
+	}
+
+	kmem_cache_destroy(cache);
+out:
+	spl_kmem_cache_magazine_limit = limit_old;
+	vmem_free(objs, SPLAT_KMEM_MAG_OBJS * sizeof (void *));
+
+	return (rc);
+}
+
 splat_subsystem_t *
 splat_kmem_init(void)
 {
@@ -1369,6 +2207,24 @@ splat_kmem_init(void)
 #endif
 	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST13_NAME, SPLAT_KMEM_TEST13_DESC,
 			SPLAT_KMEM_TEST13_ID, splat_kmem_test13);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST14_NAME, SPLAT_KMEM_TEST14_DESC,
+			SPLAT_KMEM_TEST14_ID, splat_kmem_test14);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST15_NAME, SPLAT_KMEM_TEST15_DESC,
+			SPLAT_KMEM_TEST15_ID, splat_kmem_test15);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST16_NAME, SPLAT_KMEM_TEST16_DESC,
+			SPLAT_KMEM_TEST16_ID, splat_kmem_test16);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST17_NAME, SPLAT_KMEM_TEST17_DESC,
+			SPLAT_KMEM_TEST17_ID, splat_kmem_test17);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST18_NAME, SPLAT_KMEM_TEST18_DESC,
+			SPLAT_KMEM_TEST18_ID, splat_kmem_test18);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST19_NAME, SPLAT_KMEM_TEST19_DESC,
+			SPLAT_KMEM_TEST19_ID, splat_kmem_test19);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST20_NAME, SPLAT_KMEM_TEST20_DESC,
+			SPLAT_KMEM_TEST20_ID, splat_kmem_test20);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST21_NAME, SPLAT_KMEM_TEST21_DESC,
+			SPLAT_KMEM_TEST21_ID, splat_kmem_test21);
+	SPLAT_TEST_INIT(sub, SPLAT_KMEM_TEST22_NAME, SPLAT_KMEM_TEST22_DESC,
+			SPLAT_KMEM_TEST22_ID, splat_kmem_test22);
 
 	return sub;
 }
@@ -1377,6 +2233,15 @@ void
 splat_kmem_fini(splat_subsystem_t *sub)
 {
 	ASSERT(sub);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST22_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST21_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST20_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST19_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST18_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST17_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST16_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST15_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST14_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST13_ID);
 #if 0
 	SPLAT_TEST_FINI(sub, SPLAT_KMEM_TEST11_ID);
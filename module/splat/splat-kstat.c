@@ -0,0 +1,291 @@
+/*****************************************************************************\
+ *  Copyright (C) 2011 Lawrence Livermore National Security, LLC.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Brian Behlendorf <behlendorf1@llnl.gov>.
+ *  UCRL-CODE-235197
+ *
+ *  This file is part of the SPL, Solaris Porting Layer.
+ *  For details, see <http://zfsonlinux.org/>.
+ *
+ *  The SPL is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  The SPL is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with the SPL.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************
+ *  Solaris Porting LAyer Tests (SPLAT) Kstat Tests.
+\*****************************************************************************/
+
+#include <sys/kstat.h>
+#include <sys/thread.h>
+#include <linux/mm_compat.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include "splat-internal.h"
+
+#define SPLAT_KSTAT_NAME		"kstat"
+#define SPLAT_KSTAT_DESC		"Kernel Kstat Tests"
+
+#define SPLAT_KSTAT_TEST1_ID		0x1101
+#define SPLAT_KSTAT_TEST1_NAME		"seqcount"
+#define SPLAT_KSTAT_TEST1_DESC		"Seqcount named kstat snapshot"
+
+#define SPLAT_KSTAT_TEST2_ID		0x1102
+#define SPLAT_KSTAT_TEST2_NAME		"poll"
+#define SPLAT_KSTAT_TEST2_DESC		"Kstat change notification"
+
+#define SPLAT_KSTAT_TEST_MODULE		"splat"
+#define SPLAT_KSTAT_TEST_RUNTIME	(HZ / 2)
+
+typedef struct splat_kstat_seq {
+	kstat_t			*sks_ksp;
+	wait_queue_head_t	sks_waitq;
+	volatile int		sks_stop;
+	int			sks_done;
+	uint64_t		sks_updates;
+} splat_kstat_seq_t;
+
+/*
+ * Updater thread, both counters are always advanced together under
+ * ks_lock so a consistent snapshot must always observe them equal.
+ */
+static int
+splat_kstat_test1_thr(void *arg)
+{
+	splat_kstat_seq_t *sks = (splat_kstat_seq_t *)arg;
+	kstat_t *ksp = sks->sks_ksp;
+	kstat_named_t *knp = ksp->ks_data;
+
+	while (!sks->sks_stop) {
+		mutex_enter(ksp->ks_lock);
+		kstat_update_enter(ksp);
+		knp[0].value.ui64++;
+		knp[1].value.ui64++;
+		kstat_update_exit(ksp);
+		mutex_exit(ksp->ks_lock);
+
+		sks->sks_updates++;
+		if ((sks->sks_updates & 1023) == 0)
+			cond_resched();
+	}
+
+	sks->sks_done = 1;
+	wake_up(&sks->sks_waitq);
+
+	return (0);
+}
+
+static int
+splat_kstat_test1(struct file *file, void *arg)
+{
+	splat_kstat_seq_t sks;
+	struct task_struct *thr;
+	kstat_named_t *knp, snap[2];
+	uint64_t reads = 0;
+	clock_t stop;
+	int rc = 0;
+
+	sks.sks_ksp = kstat_create(SPLAT_KSTAT_TEST_MODULE, 0,
+	    SPLAT_KSTAT_TEST1_NAME, "misc", KSTAT_TYPE_NAMED, 2,
+	    KSTAT_FLAG_SEQCOUNT);
+	if (sks.sks_ksp == NULL)
+		return (-ENOMEM);
+
+	knp = sks.sks_ksp->ks_data;
+	strlcpy(knp[0].name, "a", KSTAT_STRLEN);
+	knp[0].data_type = KSTAT_DATA_UINT64;
+	strlcpy(knp[1].name, "b", KSTAT_STRLEN);
+	knp[1].data_type = KSTAT_DATA_UINT64;
+
+	init_waitqueue_head(&sks.sks_waitq);
+	sks.sks_stop = 0;
+	sks.sks_done = 0;
+	sks.sks_updates = 0;
+
+	/* Snapshots must not depend on ks_lock */
+	mutex_enter(sks.sks_ksp->ks_lock);
+	kstat_snapshot(sks.sks_ksp, snap);
+	mutex_exit(sks.sks_ksp->ks_lock);
+
+	thr = spl_kthread_create(splat_kstat_test1_thr, &sks, "%s",
+	    SPLAT_KSTAT_TEST1_NAME);
+	if (IS_ERR(thr)) {
+		kstat_delete(sks.sks_ksp);
+		return (-ESRCH);
+	}
+	wake_up_process(thr);
+
+	stop = jiffies + SPLAT_KSTAT_TEST_RUNTIME;
+	while (time_before(jiffies, stop)) {
+		kstat_snapshot(sks.sks_ksp, snap);
+		reads++;
+
+		if (snap[0].value.ui64 != snap[1].value.ui64) {
+			splat_vprint(file, SPLAT_KSTAT_TEST1_NAME,
+			    "Torn snapshot a=%llu b=%llu\n",
+			    (unsigned long long)snap[0].value.ui64,
+			    (unsigned long long)snap[1].value.ui64);
+			rc = -EINVAL;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	sks.sks_stop = 1;
+	wait_event(sks.sks_waitq, sks.sks_done);
+
+	splat_vprint(file, SPLAT_KSTAT_TEST1_NAME,
+	    "%llu consistent snapshots, %llu updates\n",
+	    (unsigned long long)reads, (unsigned long long)sks.sks_updates);
+
+	if (rc == 0 && (reads == 0 || sks.sks_updates == 0)) {
+		splat_vprint(file, SPLAT_KSTAT_TEST1_NAME, "%s",
+		    "Failed to make progress\n");
+		rc = -EINVAL;
+	}
+
+	kstat_delete(sks.sks_ksp);
+
+	return (rc);
+}
+
+static unsigned int
+splat_kstat_test2_poll(struct file *filp)
+{
+	return (filp->f_op->poll(filp, NULL));
+}
+
+/*
+ * Open the installed kstat through /proc and verify poll only reports
+ * a change event after kstat_changed(), or once a threshold is crossed
+ * by kstat_named_add_threshold().
+ */
+static int
+splat_kstat_test2(struct file *file, void *arg)
+{
+	kstat_t *ksp;
+	kstat_named_t *knp;
+	struct file *filp;
+	unsigned int mask;
+	int rc = 0;
+
+	ksp = kstat_create(SPLAT_KSTAT_TEST_MODULE, 0,
+	    SPLAT_KSTAT_TEST2_NAME, "misc", KSTAT_TYPE_NAMED, 1, 0);
+	if (ksp == NULL)
+		return (-ENOMEM);
+
+	knp = ksp->ks_data;
+	strlcpy(knp->name, "count", KSTAT_STRLEN);
+	knp->data_type = KSTAT_DATA_UINT64;
+	kstat_install(ksp);
+
+	filp = filp_open("/proc/spl/kstat/" SPLAT_KSTAT_TEST_MODULE "/"
+	    SPLAT_KSTAT_TEST2_NAME, O_RDONLY, 0);
+	if (IS_ERR(filp)) {
+		rc = PTR_ERR(filp);
+		splat_vprint(file, SPLAT_KSTAT_TEST2_NAME,
+		    "Failed to open kstat: %d\n", rc);
+		goto out;
+	}
+
+	mask = splat_kstat_test2_poll(filp);
+	if (!(mask & POLLIN) || (mask & POLLPRI)) {
+		splat_vprint(file, SPLAT_KSTAT_TEST2_NAME,
+		    "Unexpected initial poll mask 0x%x\n", mask);
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	kstat_changed(ksp);
+	mask = splat_kstat_test2_poll(filp);
+	if (!(mask & POLLPRI)) {
+		splat_vprint(file, SPLAT_KSTAT_TEST2_NAME,
+		    "Change not reported, poll mask 0x%x\n", mask);
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	/* Reopen to consume the event, then approach a threshold */
+	filp_close(filp, NULL);
+	filp = filp_open("/proc/spl/kstat/" SPLAT_KSTAT_TEST_MODULE "/"
+	    SPLAT_KSTAT_TEST2_NAME, O_RDONLY, 0);
+	if (IS_ERR(filp)) {
+		rc = PTR_ERR(filp);
+		goto out;
+	}
+
+	kstat_named_add_threshold(ksp, knp, 9, 10);
+	mask = splat_kstat_test2_poll(filp);
+	if (mask & POLLPRI) {
+		splat_vprint(file, SPLAT_KSTAT_TEST2_NAME,
+		    "Threshold reported early, poll mask 0x%x\n", mask);
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	kstat_named_add_threshold(ksp, knp, 1, 10);
+	mask = splat_kstat_test2_poll(filp);
+	if (!(mask & POLLPRI)) {
+		splat_vprint(file, SPLAT_KSTAT_TEST2_NAME,
+		    "Threshold not reported, poll mask 0x%x\n", mask);
+		rc = -EINVAL;
+		goto out_close;
+	}
+
+	splat_vprint(file, SPLAT_KSTAT_TEST2_NAME, "%s",
+	    "Change and threshold events reported by poll\n");
+out_close:
+	filp_close(filp, NULL);
+out:
+	kstat_delete(ksp);
+
+	return (rc);
+}
+
+splat_subsystem_t *
+splat_kstat_init(void)
+{
+	splat_subsystem_t *sub;
+
+	sub = kmalloc(sizeof(*sub), GFP_KERNEL);
+	if (sub == NULL)
+		return NULL;
+
+	memset(sub, 0, sizeof(*sub));
+	strncpy(sub->desc.name, SPLAT_KSTAT_NAME, SPLAT_NAME_SIZE);
+	strncpy(sub->desc.desc, SPLAT_KSTAT_DESC, SPLAT_DESC_SIZE);
+	INIT_LIST_HEAD(&sub->subsystem_list);
+	INIT_LIST_HEAD(&sub->test_list);
+	spin_lock_init(&sub->test_lock);
+	sub->desc.id = SPLAT_SUBSYSTEM_KSTAT;
+
+	SPLAT_TEST_INIT(sub, SPLAT_KSTAT_TEST1_NAME, SPLAT_KSTAT_TEST1_DESC,
+			SPLAT_KSTAT_TEST1_ID, splat_kstat_test1);
+	SPLAT_TEST_INIT(sub, SPLAT_KSTAT_TEST2_NAME, SPLAT_KSTAT_TEST2_DESC,
+			SPLAT_KSTAT_TEST2_ID, splat_kstat_test2);
+
+	return sub;
+}
+
+void
+splat_kstat_fini(splat_subsystem_t *sub)
+{
+	ASSERT(sub);
+	SPLAT_TEST_FINI(sub, SPLAT_KSTAT_TEST2_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_KSTAT_TEST1_ID);
+
+	kfree(sub);
+}
+
+int
+splat_kstat_id(void) {
+	return SPLAT_SUBSYSTEM_KSTAT;
+}
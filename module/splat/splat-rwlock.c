@@ -24,9 +24,11 @@
  *  Solaris Porting LAyer Tests (SPLAT) Read/Writer Lock Tests.
 \*****************************************************************************/
 
+#include <sys/kmem.h>
 #include <sys/random.h>
 #include <sys/rwlock.h>
 #include <sys/taskq.h>
+#include <sys/time.h>
 #include <linux/delay.h>
 #include <linux/mm_compat.h>
 #include "splat-internal.h"
@@ -58,6 +60,10 @@
 #define SPLAT_RWLOCK_TEST6_NAME		"rw_tryupgrade"
 #define SPLAT_RWLOCK_TEST6_DESC		"Read upgrade"
 
+#define SPLAT_RWLOCK_TEST7_ID		0x0707
+#define SPLAT_RWLOCK_TEST7_NAME		"policy"
+#define SPLAT_RWLOCK_TEST7_DESC		"Fairness policy wait times"
+
 #define SPLAT_RWLOCK_TEST_MAGIC		0x115599DDUL
 #define SPLAT_RWLOCK_TEST_NAME		"rwlock_test"
 #define SPLAT_RWLOCK_TEST_TASKQ		"rwlock_taskq"
@@ -623,6 +629,230 @@ out:
 	return rc;
 }
 
+/*
+ * Run a mixed load of readers and writers against a lock of each policy
+ * and report the distribution of time spent waiting in rw_enter() for
+ * each class.  Wait times are collected in power of two nanosecond
+ * buckets.  Each policy is also checked for correct RW_*_HELD behavior
+ * across rw_tryupgrade() and rw_downgrade().  The benchmark portion of
+ * this test always passes, the results are informational.
+ */
+#define	TEST7_READERS			6
+#define	TEST7_WRITERS			2
+#define	TEST7_RUNTIME			(HZ)
+#define	TEST7_BUCKETS			28
+#define	TEST7_RD_HOLD_US		2
+#define	TEST7_WR_HOLD_US		20
+#define	TEST7_WR_IDLE_US		200
+
+typedef struct rw_bench_class {
+	uint64_t		rbc_hist[TEST7_BUCKETS];
+	uint64_t		rbc_count;
+	uint64_t		rbc_total;
+	uint64_t		rbc_max;
+} rw_bench_class_t;
+
+typedef struct rw_bench {
+	krwlock_t		rwb_rwlock;
+	spinlock_t		rwb_lock;
+	wait_queue_head_t	rwb_waitq;
+	atomic_t		rwb_threads;
+	clock_t			rwb_stop;
+	rw_bench_class_t	rwb_class[2];	/* [0] readers, [1] writers */
+} rw_bench_t;
+
+typedef struct rw_bench_thr {
+	rw_bench_t		*rbt_rwb;
+	krw_t			rbt_type;
+	rw_bench_class_t	rbt_class;
+} rw_bench_thr_t;
+
+static int
+splat_rwlock_test7_thr(void *arg)
+{
+	rw_bench_thr_t *rbt = (rw_bench_thr_t *)arg;
+	rw_bench_t *rwb = rbt->rbt_rwb;
+	rw_bench_class_t *rbc = &rbt->rbt_class;
+	rw_bench_class_t *dst;
+	hrtime_t start, wait;
+	int i;
+
+	while (time_before(jiffies, rwb->rwb_stop)) {
+		start = gethrtime();
+		rw_enter(&rwb->rwb_rwlock, rbt->rbt_type);
+		wait = gethrtime() - start;
+
+		if (rbt->rbt_type == RW_WRITER)
+			udelay(TEST7_WR_HOLD_US);
+		else
+			udelay(TEST7_RD_HOLD_US);
+
+		rw_exit(&rwb->rwb_rwlock);
+
+		rbc->rbc_hist[MIN(highbit64(wait), TEST7_BUCKETS - 1)]++;
+		rbc->rbc_count++;
+		rbc->rbc_total += wait;
+		rbc->rbc_max = MAX(rbc->rbc_max, wait);
+
+		if (rbt->rbt_type == RW_WRITER)
+			udelay(TEST7_WR_IDLE_US);
+
+		cond_resched();
+	}
+
+	dst = &rwb->rwb_class[rbt->rbt_type == RW_WRITER];
+	spin_lock(&rwb->rwb_lock);
+	for (i = 0; i < TEST7_BUCKETS; i++)
+		dst->rbc_hist[i] += rbc->rbc_hist[i];
+	dst->rbc_count += rbc->rbc_count;
+	dst->rbc_total += rbc->rbc_total;
+	dst->rbc_max = MAX(dst->rbc_max, rbc->rbc_max);
+	spin_unlock(&rwb->rwb_lock);
+
+	if (atomic_dec_and_test(&rwb->rwb_threads))
+		wake_up(&rwb->rwb_waitq);
+
+	return (0);
+}
+
+/* Return the upper bound in nanoseconds of the bucket holding percentile */
+static uint64_t
+splat_rwlock_test7_pct(rw_bench_class_t *rbc, int pct)
+{
+	uint64_t target, sum = 0;
+	int i;
+
+	target = div64_u64(rbc->rbc_count * pct + 99, 100);
+	for (i = 0; i < TEST7_BUCKETS; i++) {
+		sum += rbc->rbc_hist[i];
+		if (sum >= target)
+			break;
+	}
+
+	return (i == 0 ? 0 : (1ULL << i) - 1);
+}
+
+static void
+splat_rwlock_test7_report(struct file *file, const char *policy,
+    const char *type, rw_bench_class_t *rbc)
+{
+	splat_vprint(file, SPLAT_RWLOCK_TEST7_NAME,
+	    "%-7s %-6s %8llu acquisitions, wait ns mean %llu p50 <%llu "
+	    "p90 <%llu p99 <%llu max %llu\n", policy, type,
+	    (unsigned long long)rbc->rbc_count,
+	    (unsigned long long)(rbc->rbc_count ?
+	    div64_u64(rbc->rbc_total, rbc->rbc_count) : 0),
+	    (unsigned long long)splat_rwlock_test7_pct(rbc, 50),
+	    (unsigned long long)splat_rwlock_test7_pct(rbc, 90),
+	    (unsigned long long)splat_rwlock_test7_pct(rbc, 99),
+	    (unsigned long long)rbc->rbc_max);
+}
+
+static int
+splat_rwlock_test7_held(struct file *file, const char *policy, krwlock_t *rwl)
+{
+	int rc = 0;
+
+	rw_enter(rwl, RW_READER);
+	if (!RW_READ_HELD(rwl) || RW_WRITE_HELD(rwl) || !RW_LOCK_HELD(rwl))
+		rc = -EINVAL;
+
+	if (rc == 0 && rw_tryenter(rwl, RW_WRITER))
+		rc = -EINVAL;
+
+	if (rc == 0 && !rw_tryupgrade(rwl))
+		rc = -EINVAL;
+
+	if (rc == 0 && (!RW_WRITE_HELD(rwl) || RW_READ_HELD(rwl)))
+		rc = -EINVAL;
+
+	if (rc == 0) {
+		rw_downgrade(rwl);
+		if (!RW_READ_HELD(rwl) || RW_WRITE_HELD(rwl))
+			rc = -EINVAL;
+	}
+
+	rw_exit(rwl);
+
+	if (rc == 0 && RW_LOCK_HELD(rwl))
+		rc = -EINVAL;
+
+	if (rc)
+		splat_vprint(file, SPLAT_RWLOCK_TEST7_NAME,
+		    "%s policy held state incorrect\n", policy);
+
+	return (rc);
+}
+
+static int
+splat_rwlock_test7(struct file *file, void *arg)
+{
+	static const char *names[] = { "default", "writer", "reader", "fair" };
+	rw_bench_thr_t *rbt;
+	struct task_struct *thr;
+	rw_bench_t *rwb;
+	int policy, i, count, rc = 0;
+
+	rwb = kmem_zalloc(sizeof (rw_bench_t), KM_SLEEP);
+	rbt = kmem_zalloc(sizeof (rw_bench_thr_t) *
+	    (TEST7_READERS + TEST7_WRITERS), KM_SLEEP);
+	spin_lock_init(&rwb->rwb_lock);
+	init_waitqueue_head(&rwb->rwb_waitq);
+
+	for (policy = RW_POLICY_DEFAULT; policy <= RW_POLICY_FAIR; policy++) {
+		rw_init(&rwb->rwb_rwlock, SPLAT_RWLOCK_TEST_NAME, RW_DEFAULT,
+		    (void *)(uintptr_t)policy);
+
+		/* Native rwsems only support rw_tryupgrade() on some arches */
+		if (policy != RW_POLICY_DEFAULT) {
+			rc = splat_rwlock_test7_held(file, names[policy],
+			    &rwb->rwb_rwlock);
+			if (rc) {
+				rw_destroy(&rwb->rwb_rwlock);
+				break;
+			}
+		}
+
+		memset(rwb->rwb_class, 0, sizeof (rwb->rwb_class));
+		memset(rbt, 0, sizeof (rw_bench_thr_t) *
+		    (TEST7_READERS + TEST7_WRITERS));
+		rwb->rwb_stop = jiffies + TEST7_RUNTIME;
+		atomic_set(&rwb->rwb_threads, TEST7_READERS + TEST7_WRITERS);
+
+		for (i = 0, count = 0; i < TEST7_READERS + TEST7_WRITERS; i++) {
+			rbt[i].rbt_rwb = rwb;
+			rbt[i].rbt_type = (i < TEST7_WRITERS) ?
+			    RW_WRITER : RW_READER;
+			thr = spl_kthread_create(splat_rwlock_test7_thr,
+			    &rbt[i], "%s/%d", SPLAT_RWLOCK_TEST_NAME, i);
+			if (IS_ERR(thr)) {
+				atomic_dec(&rwb->rwb_threads);
+				continue;
+			}
+
+			wake_up_process(thr);
+			count++;
+		}
+
+		if (count > 0)
+			wait_event(rwb->rwb_waitq,
+			    atomic_read(&rwb->rwb_threads) == 0);
+
+		rw_destroy(&rwb->rwb_rwlock);
+
+		splat_rwlock_test7_report(file, names[policy], "reader",
+		    &rwb->rwb_class[0]);
+		splat_rwlock_test7_report(file, names[policy], "writer",
+		    &rwb->rwb_class[1]);
+	}
+
+	kmem_free(rbt, sizeof (rw_bench_thr_t) *
+	    (TEST7_READERS + TEST7_WRITERS));
+	kmem_free(rwb, sizeof (rw_bench_t));
+
+	return (rc);
+}
+
 splat_subsystem_t *
 splat_rwlock_init(void)
 {
@@ -652,6 +882,8 @@ splat_rwlock_init(void)
 		      SPLAT_RWLOCK_TEST5_ID, splat_rwlock_test5);
 	SPLAT_TEST_INIT(sub, SPLAT_RWLOCK_TEST6_NAME, SPLAT_RWLOCK_TEST6_DESC,
 		      SPLAT_RWLOCK_TEST6_ID, splat_rwlock_test6);
+	SPLAT_TEST_INIT(sub, SPLAT_RWLOCK_TEST7_NAME, SPLAT_RWLOCK_TEST7_DESC,
+		      SPLAT_RWLOCK_TEST7_ID, splat_rwlock_test7);
 
 	return sub;
 }
@@ -660,6 +892,7 @@ void
 splat_rwlock_fini(splat_subsystem_t *sub)
 {
 	ASSERT(sub);
+	SPLAT_TEST_FINI(sub, SPLAT_RWLOCK_TEST7_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_RWLOCK_TEST6_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_RWLOCK_TEST5_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_RWLOCK_TEST4_ID);
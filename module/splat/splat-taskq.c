@@ -25,12 +25,14 @@
 \*****************************************************************************/
 
 #include <sys/kmem.h>
+#include <sys/kmem_cache.h>
 #include <sys/vmem.h>
 #include <sys/random.h>
 #include <sys/taskq.h>
 #include <sys/time.h>
 #include <sys/timer.h>
 #include <linux/delay.h>
+#include <linux/math64_compat.h>
 #include "splat-internal.h"
 
 #define SPLAT_TASKQ_NAME		"taskq"
@@ -80,6 +82,18 @@
 #define SPLAT_TASKQ_TEST11_NAME		"dynamic"
 #define SPLAT_TASKQ_TEST11_DESC		"Dynamic task queue thread creation"
 
+#define SPLAT_TASKQ_TEST12_ID		0x020c
+#define SPLAT_TASKQ_TEST12_NAME		"concurrent"
+#define SPLAT_TASKQ_TEST12_DESC		"Dispatch and allocation scaling across cpus"
+
+#define SPLAT_TASKQ_TEST13_ID		0x020d
+#define SPLAT_TASKQ_TEST13_NAME		"throttle"
+#define SPLAT_TASKQ_TEST13_DESC		"Bounded taskq dispatch throttling"
+
+#define SPLAT_TASKQ_TEST14_ID		0x020e
+#define SPLAT_TASKQ_TEST14_NAME		"coalesce"
+#define SPLAT_TASKQ_TEST14_DESC		"Coalesce duplicate pending tasks"
+
 #define SPLAT_TASKQ_ORDER_MAX		8
 #define SPLAT_TASKQ_DEPTH_MAX		16
 
@@ -1479,6 +1493,369 @@ splat_taskq_test11(struct file *file, void *arg)
 	return (error);
 }
 
+/*
+ * Start one thread per online cpu and have them all hammer a single
+ * shared taskq and a single shared kmem cache.  Each phase is first run
+ * by a single thread, the rate with all cpus is then reported relative
+ * to it.  Contended cache lines in taskq_t and spl_kmem_cache_t show up
+ * as poor scaling, so comparing the result before and after a change to
+ * their layout measures its effect.  This test should always pass.
+ */
+#define	TEST12_DISPATCH_PER_THREAD	0x4000
+#define	TEST12_ALLOC_PER_THREAD		0x10000
+#define	TEST12_ALLOC_BATCH		32
+#define	TEST12_OBJ_SIZE			256
+
+typedef struct splat_taskq_bench {
+	taskq_t			*tb_taskq;
+	kmem_cache_t		*tb_cache;
+	int			tb_alloc;
+	atomic_t		tb_threads;
+	atomic_t		tb_count;
+	atomic_t		tb_errors;
+	wait_queue_head_t	tb_waitq;
+} splat_taskq_bench_t;
+
+static void
+splat_taskq_test12_func(void *arg)
+{
+	splat_taskq_bench_t *tb = (splat_taskq_bench_t *)arg;
+
+	atomic_inc(&tb->tb_count);
+}
+
+static void
+splat_taskq_test12_thread(void *arg)
+{
+	splat_taskq_bench_t *tb = (splat_taskq_bench_t *)arg;
+	void *objs[TEST12_ALLOC_BATCH];
+	int i, j;
+
+	if (tb->tb_alloc) {
+		for (i = 0; i < TEST12_ALLOC_PER_THREAD;
+		    i += TEST12_ALLOC_BATCH) {
+			for (j = 0; j < TEST12_ALLOC_BATCH; j++)
+				objs[j] = kmem_cache_alloc(tb->tb_cache,
+				    KM_SLEEP);
+
+			for (j = 0; j < TEST12_ALLOC_BATCH; j++)
+				kmem_cache_free(tb->tb_cache, objs[j]);
+		}
+	} else {
+		for (i = 0; i < TEST12_DISPATCH_PER_THREAD; i++) {
+			if (taskq_dispatch(tb->tb_taskq,
+			    splat_taskq_test12_func, tb, TQ_SLEEP) == 0)
+				atomic_inc(&tb->tb_errors);
+		}
+	}
+
+	if (atomic_dec_and_test(&tb->tb_threads))
+		wake_up(&tb->tb_waitq);
+
+	thread_exit();
+}
+
+static int
+splat_taskq_test12_run(struct file *file, splat_taskq_bench_t *tb,
+    int nthreads, int alloc, uint64_t *rate)
+{
+	struct timespec start, stop, delta;
+	uint64_t ns, ops;
+	int i;
+
+	tb->tb_alloc = alloc;
+	atomic_set(&tb->tb_threads, nthreads);
+	getnstimeofday(&start);
+
+	for (i = 0; i < nthreads; i++) {
+		if (thread_create(NULL, 0, splat_taskq_test12_thread, tb,
+		    0, &p0, TS_RUN, defclsyspri) == NULL) {
+			atomic_inc(&tb->tb_errors);
+			if (atomic_dec_and_test(&tb->tb_threads))
+				wake_up(&tb->tb_waitq);
+		}
+	}
+
+	wait_event(tb->tb_waitq, atomic_read(&tb->tb_threads) == 0);
+	if (!alloc)
+		taskq_wait(tb->tb_taskq);
+
+	getnstimeofday(&stop);
+	delta = timespec_sub(stop, start);
+	ns = MAX((uint64_t)delta.tv_sec * NANOSEC + delta.tv_nsec, 1);
+	ops = (uint64_t)nthreads * (alloc ?
+	    TEST12_ALLOC_PER_THREAD : TEST12_DISPATCH_PER_THREAD);
+
+	*rate = div64_u64(ops * NANOSEC, ns);
+
+	splat_vprint(file, SPLAT_TASKQ_TEST12_NAME,
+	    "%d threads %llu %s in %ld.%09lds, %llu ops/sec\n", nthreads,
+	    (unsigned long long)ops, alloc ? "allocs" : "dispatches",
+	    delta.tv_sec, delta.tv_nsec, (unsigned long long)*rate);
+
+	return (atomic_read(&tb->tb_errors) ? -EINVAL : 0);
+}
+
+static int
+splat_taskq_test12(struct file *file, void *arg)
+{
+	splat_taskq_bench_t tb;
+	int nthreads = num_online_cpus();
+	uint64_t base, rate;
+	int alloc, rc = 0;
+
+	tb.tb_taskq = taskq_create(SPLAT_TASKQ_TEST12_NAME, nthreads,
+	    defclsyspri, nthreads, INT_MAX, TASKQ_PREPOPULATE);
+	if (tb.tb_taskq == NULL)
+		return (-ENOMEM);
+
+	tb.tb_cache = kmem_cache_create(SPLAT_TASKQ_TEST12_NAME,
+	    TEST12_OBJ_SIZE, 0, NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
+	if (tb.tb_cache == NULL) {
+		taskq_destroy(tb.tb_taskq);
+		return (-ENOMEM);
+	}
+
+	atomic_set(&tb.tb_count, 0);
+	atomic_set(&tb.tb_errors, 0);
+	init_waitqueue_head(&tb.tb_waitq);
+
+	for (alloc = 0; alloc <= 1 && rc == 0; alloc++) {
+		rc = splat_taskq_test12_run(file, &tb, 1, alloc, &base);
+		if (rc == 0)
+			rc = splat_taskq_test12_run(file, &tb, nthreads,
+			    alloc, &rate);
+		if (rc)
+			break;
+
+		splat_vprint(file, SPLAT_TASKQ_TEST12_NAME,
+		    "%s scaling %d threads %llu%% of 1 thread, "
+		    "%llu%% per thread\n", alloc ? "alloc" : "dispatch",
+		    nthreads, (unsigned long long)div64_u64(rate * 100,
+		    MAX(base, 1)), (unsigned long long)div64_u64(rate * 100,
+		    MAX(base, 1) * nthreads));
+	}
+
+	if (rc == 0 && atomic_read(&tb.tb_count) !=
+	    (nthreads + 1) * TEST12_DISPATCH_PER_THREAD) {
+		splat_vprint(file, SPLAT_TASKQ_TEST12_NAME,
+		    "Only %d/%d tasks ran\n", atomic_read(&tb.tb_count),
+		    (nthreads + 1) * TEST12_DISPATCH_PER_THREAD);
+		rc = -ERANGE;
+	}
+
+	kmem_cache_destroy(tb.tb_cache);
+	taskq_destroy(tb.tb_taskq);
+
+	return (rc);
+}
+
+/*
+ * Create a single threaded taskq limited to a few queued tasks.  While
+ * the worker is blocked verify that TQ_NOSLEEP dispatches beyond the
+ * limit fail, then release it and verify TQ_SLEEP dispatches are throttled
+ * rather than queued without bound.
+ */
+#define	TEST13_LIMIT			4
+#define	TEST13_NUM_TASKS		100
+
+static void
+splat_taskq_throttle_block(void *arg)
+{
+	splat_taskq_arg_t *tq_arg = (splat_taskq_arg_t *)arg;
+
+	while (!ACCESS_ONCE(tq_arg->flag))
+		msleep(1);
+
+	atomic_inc(tq_arg->count);
+}
+
+static void
+splat_taskq_throttle_func(void *arg)
+{
+	splat_taskq_arg_t *tq_arg = (splat_taskq_arg_t *)arg;
+
+	msleep(1);
+	atomic_inc(tq_arg->count);
+}
+
+static int
+splat_taskq_test13(struct file *file, void *arg)
+{
+	splat_taskq_arg_t tq_arg;
+	atomic_t count;
+	taskq_t *tq;
+	int i, rc = 0;
+
+	tq = taskq_create(SPLAT_TASKQ_TEST13_NAME, 1, defclsyspri,
+	    1, INT_MAX, TASKQ_PREPOPULATE);
+	if (tq == NULL)
+		return (-ENOMEM);
+
+	taskq_set_limit(tq, TEST13_LIMIT);
+
+	tq_arg.flag = 0;
+	tq_arg.file = file;
+	tq_arg.name = SPLAT_TASKQ_TEST13_NAME;
+	tq_arg.count = &count;
+	atomic_set(&count, 0);
+
+	/* Occupy the only worker then fill the queue to its limit */
+	if (taskq_dispatch(tq, splat_taskq_throttle_block, &tq_arg,
+	    TQ_SLEEP) == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	while (ACCESS_ONCE(tq->tq_nactive) == 0)
+		msleep(1);
+
+	for (i = 0; i < TEST13_LIMIT; i++) {
+		if (taskq_dispatch(tq, splat_taskq_throttle_func, &tq_arg,
+		    TQ_NOSLEEP) == 0) {
+			splat_vprint(file, SPLAT_TASKQ_TEST13_NAME,
+			    "Dispatch %d below the limit failed\n", i);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	if (taskq_dispatch(tq, splat_taskq_throttle_func, &tq_arg,
+	    TQ_NOSLEEP) != 0) {
+		splat_vprint(file, SPLAT_TASKQ_TEST13_NAME, "%s",
+		    "TQ_NOSLEEP dispatch beyond the limit succeeded\n");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	tq_arg.flag = 1;
+
+	for (i = 0; i < TEST13_NUM_TASKS; i++) {
+		if (taskq_dispatch(tq, splat_taskq_throttle_func, &tq_arg,
+		    TQ_SLEEP) == 0) {
+			rc = -EINVAL;
+			goto out;
+		}
+
+		if (ACCESS_ONCE(tq->tq_nqueued) > TEST13_LIMIT) {
+			splat_vprint(file, SPLAT_TASKQ_TEST13_NAME,
+			    "Queue depth %d exceeds limit %d\n",
+			    tq->tq_nqueued, TEST13_LIMIT);
+			rc = -ERANGE;
+			goto out;
+		}
+	}
+
+	taskq_wait(tq);
+
+	splat_vprint(file, SPLAT_TASKQ_TEST13_NAME,
+	    "%d/%d tasks run, %llu throttled for %llu ms, %llu refused\n",
+	    atomic_read(&count), TEST13_NUM_TASKS + TEST13_LIMIT + 1,
+	    (unsigned long long)tq->tq_throttle_count,
+	    (unsigned long long)NSEC2MSEC(tq->tq_throttle_time),
+	    (unsigned long long)tq->tq_throttle_fail);
+
+	if (atomic_read(&count) != TEST13_NUM_TASKS + TEST13_LIMIT + 1)
+		rc = -ERANGE;
+	else if (tq->tq_throttle_count == 0 || tq->tq_throttle_fail != 1)
+		rc = -EINVAL;
+out:
+	tq_arg.flag = 1;
+	taskq_wait(tq);
+	taskq_destroy(tq);
+
+	return (rc);
+}
+
+/*
+ * Block the only worker of a taskq and repeatedly dispatch the same
+ * function and argument with TQ_COALESCE.  Every dispatch must return the
+ * id of the first pending task and it must run exactly once.  A different
+ * argument must never be coalesced.
+ */
+#define	TEST14_NUM_TASKS		100
+
+static int
+splat_taskq_test14(struct file *file, void *arg)
+{
+	splat_taskq_arg_t tq_arg, tq_other;
+	taskqid_t id, first, other;
+	atomic_t count;
+	taskq_t *tq;
+	int i, rc = 0;
+
+	tq = taskq_create(SPLAT_TASKQ_TEST14_NAME, 1, defclsyspri,
+	    1, INT_MAX, TASKQ_PREPOPULATE);
+	if (tq == NULL)
+		return (-ENOMEM);
+
+	tq_arg.flag = 0;
+	tq_arg.file = file;
+	tq_arg.name = SPLAT_TASKQ_TEST14_NAME;
+	tq_arg.count = &count;
+	tq_other = tq_arg;
+	atomic_set(&count, 0);
+
+	/* Occupy the only worker so dispatched tasks remain pending */
+	if (taskq_dispatch(tq, splat_taskq_throttle_block, &tq_arg,
+	    TQ_SLEEP) == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	while (ACCESS_ONCE(tq->tq_nactive) == 0)
+		msleep(1);
+
+	first = taskq_dispatch(tq, splat_taskq_throttle_func, &tq_arg,
+	    TQ_SLEEP | TQ_COALESCE);
+	if (first == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	for (i = 1; i < TEST14_NUM_TASKS; i++) {
+		id = taskq_dispatch(tq, splat_taskq_throttle_func, &tq_arg,
+		    TQ_SLEEP | TQ_COALESCE);
+		if (id != first) {
+			splat_vprint(file, SPLAT_TASKQ_TEST14_NAME,
+			    "Dispatch %d returned id %lu expected %lu\n",
+			    i, (unsigned long)id, (unsigned long)first);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	other = taskq_dispatch(tq, splat_taskq_throttle_func, &tq_other,
+	    TQ_SLEEP | TQ_COALESCE);
+	if (other == 0 || other == first) {
+		splat_vprint(file, SPLAT_TASKQ_TEST14_NAME,
+		    "Distinct argument coalesced to id %lu\n",
+		    (unsigned long)other);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	tq_arg.flag = 1;
+	taskq_wait(tq);
+
+	/* The blocking task plus one per distinct argument */
+	if (atomic_read(&count) != 3) {
+		splat_vprint(file, SPLAT_TASKQ_TEST14_NAME,
+		    "%d tasks run expected 3\n", atomic_read(&count));
+		rc = -ERANGE;
+	}
+
+	splat_vprint(file, SPLAT_TASKQ_TEST14_NAME,
+	    "%d dispatches, %llu coalesced\n", TEST14_NUM_TASKS + 1,
+	    (unsigned long long)tq->tq_coalesced);
+out:
+	tq_arg.flag = 1;
+	taskq_wait(tq);
+	taskq_destroy(tq);
+
+	return (rc);
+}
+
 splat_subsystem_t *
 splat_taskq_init(void)
 {
@@ -1518,6 +1895,12 @@ splat_taskq_init(void)
 	              SPLAT_TASKQ_TEST10_ID, splat_taskq_test10);
 	SPLAT_TEST_INIT(sub, SPLAT_TASKQ_TEST11_NAME, SPLAT_TASKQ_TEST11_DESC,
 	              SPLAT_TASKQ_TEST11_ID, splat_taskq_test11);
+	SPLAT_TEST_INIT(sub, SPLAT_TASKQ_TEST12_NAME, SPLAT_TASKQ_TEST12_DESC,
+	              SPLAT_TASKQ_TEST12_ID, splat_taskq_test12);
+	SPLAT_TEST_INIT(sub, SPLAT_TASKQ_TEST13_NAME, SPLAT_TASKQ_TEST13_DESC,
+	              SPLAT_TASKQ_TEST13_ID, splat_taskq_test13);
+	SPLAT_TEST_INIT(sub, SPLAT_TASKQ_TEST14_NAME, SPLAT_TASKQ_TEST14_DESC,
+	              SPLAT_TASKQ_TEST14_ID, splat_taskq_test14);
 
         return sub;
 }
@@ -1526,6 +1909,9 @@ void
 splat_taskq_fini(splat_subsystem_t *sub)
 {
         ASSERT(sub);
+	SPLAT_TEST_FINI(sub, SPLAT_TASKQ_TEST14_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_TASKQ_TEST13_ID);
+	SPLAT_TEST_FINI(sub, SPLAT_TASKQ_TEST12_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_TASKQ_TEST11_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_TASKQ_TEST10_ID);
 	SPLAT_TEST_FINI(sub, SPLAT_TASKQ_TEST9_ID);
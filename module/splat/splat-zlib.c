@@ -28,6 +28,8 @@
 #include <sys/random.h>
 #include <sys/kmem.h>
 #include <sys/vmem.h>
+#include <sys/time.h>
+#include <linux/math64_compat.h>
 #include "splat-internal.h"
 
 #define SPLAT_ZLIB_NAME			"zlib"
@@ -37,6 +39,10 @@
 #define SPLAT_ZLIB_TEST1_NAME		"compress/uncompress"
 #define SPLAT_ZLIB_TEST1_DESC		"Compress/Uncompress Test"
 
+#define SPLAT_ZLIB_TEST2_ID		0x0f02
+#define SPLAT_ZLIB_TEST2_NAME		"dictionary"
+#define SPLAT_ZLIB_TEST2_DESC		"Preset Dictionary Test"
+
 #define BUFFER_SIZE			(128 * 1024)
 
 static int
@@ -127,6 +133,160 @@ out:
 	return rc;
 }
 
+#define SPLAT_ZLIB_DICT_ID		0x73706c74
+#define SPLAT_ZLIB_DICT_SIZE		(4 * 1024)
+#define SPLAT_ZLIB_BLOCK_SIZE		512
+#define SPLAT_ZLIB_PASSES		256
+
+/*
+ * Fill a buffer with records resembling small structured metadata, the
+ * field names repeat but the values vary with the seed.
+ */
+static void
+splat_zlib_test2_fill(char *buf, size_t size, unsigned seed)
+{
+	size_t off = 0;
+	int n;
+
+	while (off < size) {
+		n = snprintf(buf + off, size - off,
+		    "{object=%u,type=dnode,blksz=%u,level=%u,birth=%u}",
+		    seed * 7919, (seed % 8 + 1) * 512, seed % 3, seed * 31);
+		if (n <= 0 || n >= size - off)
+			break;
+
+		off += n;
+		seed++;
+	}
+
+	memset(buf + off, 0, size - off);
+}
+
+/*
+ * Average time to compress the block, with the dictionary when dict is set.
+ */
+static uint64_t
+splat_zlib_test2_time(void *dst, void *src, int dict)
+{
+	size_t len;
+	hrtime_t start;
+	int i;
+
+	start = gethrtime();
+	for (i = 0; i < SPLAT_ZLIB_PASSES; i++) {
+		len = SPLAT_ZLIB_BLOCK_SIZE * 2;
+		if (dict)
+			(void) z_compress_dict(dst, &len, src,
+			    SPLAT_ZLIB_BLOCK_SIZE, 6, SPLAT_ZLIB_DICT_ID);
+		else
+			(void) z_compress_level(dst, &len, src,
+			    SPLAT_ZLIB_BLOCK_SIZE, 6);
+	}
+
+	return (div64_u64(gethrtime() - start, SPLAT_ZLIB_PASSES));
+}
+
+/*
+ * Compress a small block with and without a preset dictionary built from
+ * similar records.  Both must round trip and the dictionary must improve
+ * the compression ratio.  The time per call is reported for both since
+ * the dictionary is deflated again by every z_compress_dict() call.
+ */
+static int
+splat_zlib_test2(struct file *file, void *arg)
+{
+	char *dict, *src, *dst, *chk;
+	size_t plain_len, dict_len, chk_len;
+	int rc = 0, err;
+
+	dict = vmem_alloc(SPLAT_ZLIB_DICT_SIZE, KM_SLEEP);
+	src = vmem_alloc(SPLAT_ZLIB_BLOCK_SIZE, KM_SLEEP);
+	dst = vmem_alloc(SPLAT_ZLIB_BLOCK_SIZE * 2, KM_SLEEP);
+	chk = vmem_alloc(SPLAT_ZLIB_BLOCK_SIZE, KM_SLEEP);
+
+	splat_zlib_test2_fill(dict, SPLAT_ZLIB_DICT_SIZE, 1);
+	splat_zlib_test2_fill(src, SPLAT_ZLIB_BLOCK_SIZE, 1000);
+
+	err = z_dict_add(SPLAT_ZLIB_DICT_ID, dict, SPLAT_ZLIB_DICT_SIZE);
+	if (err != Z_OK) {
+		splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+		    "Failed z_dict_add(), %d\n", err);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	err = z_dict_add(SPLAT_ZLIB_DICT_ID, dict, SPLAT_ZLIB_DICT_SIZE);
+	if (err != Z_STREAM_ERROR) {
+		splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+		    "Duplicate z_dict_add() returned %d\n", err);
+		rc = -EINVAL;
+		goto out_remove;
+	}
+
+	plain_len = SPLAT_ZLIB_BLOCK_SIZE * 2;
+	err = z_compress_level(dst, &plain_len, src, SPLAT_ZLIB_BLOCK_SIZE, 6);
+	if (err != Z_OK) {
+		splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+		    "Failed z_compress_level(), %d\n", err);
+		rc = -EINVAL;
+		goto out_remove;
+	}
+
+	dict_len = SPLAT_ZLIB_BLOCK_SIZE * 2;
+	err = z_compress_dict(dst, &dict_len, src, SPLAT_ZLIB_BLOCK_SIZE, 6,
+	    SPLAT_ZLIB_DICT_ID);
+	if (err != Z_OK) {
+		splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+		    "Failed z_compress_dict(), %d\n", err);
+		rc = -EINVAL;
+		goto out_remove;
+	}
+
+	chk_len = SPLAT_ZLIB_BLOCK_SIZE;
+	err = z_uncompress_dict(chk, &chk_len, dst, dict_len,
+	    SPLAT_ZLIB_DICT_ID);
+	if (err != Z_OK || chk_len != SPLAT_ZLIB_BLOCK_SIZE ||
+	    memcmp(src, chk, SPLAT_ZLIB_BLOCK_SIZE) != 0) {
+		splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+		    "Failed z_uncompress_dict(), %d\n", err);
+		rc = -EINVAL;
+		goto out_remove;
+	}
+
+	splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+	    "Compressed %d bytes to %d bytes, %d bytes with dictionary\n",
+	    SPLAT_ZLIB_BLOCK_SIZE, (int)plain_len, (int)dict_len);
+
+	if (dict_len >= plain_len) {
+		splat_vprint(file, SPLAT_ZLIB_TEST2_NAME, "%s",
+		    "Dictionary did not improve compression\n");
+		rc = -EINVAL;
+		goto out_remove;
+	}
+
+	splat_vprint(file, SPLAT_ZLIB_TEST2_NAME,
+	    "Compressed in %llu ns/call, %llu ns/call with dictionary\n",
+	    splat_zlib_test2_time(dst, src, 0),
+	    splat_zlib_test2_time(dst, src, 1));
+
+out_remove:
+	if (z_dict_remove(SPLAT_ZLIB_DICT_ID) != Z_OK && rc == 0)
+		rc = -EINVAL;
+
+	/* The dictionary is gone, its id must now be rejected */
+	chk_len = SPLAT_ZLIB_BLOCK_SIZE;
+	if (rc == 0 && z_uncompress_dict(chk, &chk_len, dst, dict_len,
+	    SPLAT_ZLIB_DICT_ID) != Z_STREAM_ERROR)
+		rc = -EINVAL;
+out:
+	vmem_free(chk, SPLAT_ZLIB_BLOCK_SIZE);
+	vmem_free(dst, SPLAT_ZLIB_BLOCK_SIZE * 2);
+	vmem_free(src, SPLAT_ZLIB_BLOCK_SIZE);
+	vmem_free(dict, SPLAT_ZLIB_DICT_SIZE);
+
+	return rc;
+}
+
 splat_subsystem_t *
 splat_zlib_init(void)
 {
@@ -146,6 +306,8 @@ splat_zlib_init(void)
 
         SPLAT_TEST_INIT(sub, SPLAT_ZLIB_TEST1_NAME, SPLAT_ZLIB_TEST1_DESC,
 	              SPLAT_ZLIB_TEST1_ID, splat_zlib_test1);
+        SPLAT_TEST_INIT(sub, SPLAT_ZLIB_TEST2_NAME, SPLAT_ZLIB_TEST2_DESC,
+	              SPLAT_ZLIB_TEST2_ID, splat_zlib_test2);
 
         return sub;
 }
@@ -155,6 +317,7 @@ splat_zlib_fini(splat_subsystem_t *sub)
 {
         ASSERT(sub);
 
+        SPLAT_TEST_FINI(sub, SPLAT_ZLIB_TEST2_ID);
         SPLAT_TEST_FINI(sub, SPLAT_ZLIB_TEST1_ID);
 
         kfree(sub);